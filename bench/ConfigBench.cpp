@@ -0,0 +1,167 @@
+/**
+ * Benchmark of loading configuration files with 100, 1000 and 10000 items and resolving
+ * the layers the way 'create' does (defaults < global config < parameter file < command line).
+ * The line-by-line loader used before Config is kept here as the baseline.
+ * Usage: launch-bench-ConfigBench [ITERATIONS]
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+
+#include "Config.h"
+
+using namespace Launch;
+
+
+namespace {
+
+const int ITEM_COUNTS[] = {100, 1000, 10000};
+const int DEFAULT_ITERATIONS = 100;
+
+typedef std::map<const std::string, const std::string> legacyMapType;
+
+//Write a config file with the given number of items, with comments and quoted values in between
+void WriteConfigFile(const std::string& filename, int itemCount);
+//The former Tools::LoadFileIntoMap: getline, a push_back per character, erase and insert per item
+bool LegacyLoadFileIntoMap(const std::string& filename, legacyMapType& outMap);
+//The former merging of the layers: copy missing values, one layer after another
+void LegacyAddMissingValues(legacyMapType& outMap, const legacyMapType& sourceMap);
+
+} //anonymous namespace
+
+
+int main(int argc, char** argv) {
+    int iterations = DEFAULT_ITERATIONS;
+    if (argc > 1)
+        iterations = std::atoi(argv[1]);
+    if (iterations <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [ITERATIONS]\n";
+        return 1;
+    }
+
+    boost::filesystem::path baseFolder = boost::filesystem::temp_directory_path()
+                                         / boost::filesystem::unique_path("launch-bench-%%%%%%%%");
+    boost::filesystem::create_directories(baseFolder);
+    std::string globalFile = (baseFolder / "global.conf").string();
+    std::string paramFile = (baseFolder / "params.conf").string();
+
+    for (size_t i=0; i < sizeof(ITEM_COUNTS) / sizeof(ITEM_COUNTS[0]); ++i) {
+        int itemCount = ITEM_COUNTS[i];
+        WriteConfigFile(globalFile, itemCount);
+        WriteConfigFile(paramFile, itemCount);
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        bool success = true;
+        for (int it=0; it < iterations; ++it) {
+            Config global;
+            Config params;
+            success = global.loadFile(globalFile, CONFIG_LAYER_GLOBAL) && success;
+            success = params.loadFile(paramFile, CONFIG_LAYER_FILE) && success;
+            params.set("cpus", "2", CONFIG_LAYER_COMMAND_LINE);
+            params.merge(global);
+            params.set("memory", "2048", CONFIG_LAYER_DEFAULTS);
+            success = params.toMap().size() >= static_cast<size_t>(itemCount) && success;
+        }
+        double configUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                            std::chrono::steady_clock::now() - start).count();
+
+        start = std::chrono::steady_clock::now();
+        for (int it=0; it < iterations; ++it) {
+            legacyMapType global;
+            legacyMapType params;
+            success = LegacyLoadFileIntoMap(globalFile, global) && success;
+            success = LegacyLoadFileIntoMap(paramFile, params) && success;
+            params.erase("cpus");
+            params.insert(std::make_pair("cpus", "2"));
+            LegacyAddMissingValues(params, global);
+            legacyMapType defaults = {{"memory", "2048"}};
+            LegacyAddMissingValues(params, defaults);
+            success = params.size() >= static_cast<size_t>(itemCount) && success;
+        }
+        double legacyUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                            std::chrono::steady_clock::now() - start).count();
+
+        std::cout << "config  items: " << itemCount
+                  << "\titerations: " << iterations
+                  << "\tmean: " << configUs / iterations << " us"
+                  << "\tlegacy mean: " << legacyUs / iterations << " us"
+                  << (success ? "" : "\t(FAILED)") << std::endl;
+    }
+
+    boost::system::error_code ec;
+    boost::filesystem::remove_all(baseFolder, ec);
+
+    return 0;
+}
+
+
+namespace {
+
+void WriteConfigFile(const std::string& filename, int itemCount) {
+    std::ofstream ofs(filename.c_str());
+    for (int i=0; i < itemCount; ++i) {
+        if (i % 10 == 0)
+            ofs << "########### Section " << i / 10 << " ###########\n";
+        if (i % 3 == 0)
+            ofs << "benchKey" << i << " = \"quoted value number " << i << "\"\n";
+        else
+            ofs << "benchKey" << i << "=/some/path/to/a/folder/" << i << "\n";
+    }
+}
+
+
+bool LegacyLoadFileIntoMap(const std::string& filename, legacyMapType& outMap) {
+    std::ifstream ifs (filename);
+    if (!ifs.good())
+        return false;
+
+    for (std::string line; std::getline(ifs, line); ) {
+        std::string key, value;
+        size_t len = line.size();
+        size_t i = 0;
+
+        if (len == 0 || line[0] == COMMENT_CHAR)
+            continue;
+
+        while (i < len && line[i++] != KEY_VALUE_SEPARATOR)
+            key.push_back(line[i-1]);
+
+        while (i++ < len)
+            value.push_back(line[i-1]);
+
+        boost::trim(key);
+        boost::trim(value);
+        size_t valueSize = value.size();
+        if (valueSize > 1 && (
+                (value[0] == '"' && value[valueSize-1] == '"') ||
+                (value[0] == '\'' && value[valueSize-1] == '\'') )) {
+            value.erase(0, 1);
+            value.erase(value.size()-1);
+        }
+
+        if (key.empty() || value.empty())
+            continue;
+        legacyMapType::iterator it = outMap.find(key);
+        if (it != outMap.end())
+            outMap.erase(it);
+        outMap.insert(std::make_pair(key, value));
+    }
+    return true;
+}
+
+
+void LegacyAddMissingValues(legacyMapType& outMap, const legacyMapType& sourceMap) {
+    for (legacyMapType::const_iterator it = sourceMap.begin(); it != sourceMap.end(); ++it) {
+        if (outMap.find(it->first) == outMap.end())
+            outMap.insert(std::make_pair(it->first, it->second));
+    }
+}
+
+} //anonymous namespace
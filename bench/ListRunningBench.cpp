@@ -0,0 +1,136 @@
+/**
+ * Benchmark of 'list --running' with 10, 100 and 1000 sessions against a stand-in hypervisor.
+ * The session index is generated for fake session files, every other machine is running.
+ * Usage: launch-bench-ListRunningBench [ITERATIONS]
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
+#include <CernVM/Utilities.h>
+
+#include "HypervisorContext.h"
+#include "RequestHandler.h"
+#include "SessionIndex.h"
+#include "Tools.h"
+
+using namespace Launch;
+
+
+namespace {
+
+const int SESSION_COUNTS[] = {10, 100, 1000};
+const int DEFAULT_ITERATIONS = 200;
+
+//Stand-in for the hypervisor: running machines are given, no VBoxManage is invoked
+class StandInContext : public HypervisorContext {
+    public:
+        StandInContext(const runningSetType& running)
+            : _running(running) {
+        }
+        virtual const runningSetType* runningMachines() {
+            return &_running;
+        }
+
+    private:
+        runningSetType _running;
+};
+
+//Create fake session files and a fresh session index for them, returns the running set
+runningSetType PrepareSessions(int sessionCount);
+
+} //anonymous namespace
+
+
+int main(int argc, char** argv) {
+    int iterations = DEFAULT_ITERATIONS;
+    if (argc > 1)
+        iterations = std::atoi(argv[1]);
+    if (iterations <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [ITERATIONS]\n";
+        return 1;
+    }
+
+    boost::filesystem::path baseFolder = boost::filesystem::temp_directory_path()
+                                         / boost::filesystem::unique_path("launch-bench-%%%%%%%%");
+    boost::filesystem::create_directories(baseFolder);
+    setAppDataBasePath(baseFolder.string());
+
+    RequestHandler handler;
+    std::ostringstream devNull;
+
+    for (size_t i=0; i < sizeof(SESSION_COUNTS) / sizeof(SESSION_COUNTS[0]); ++i) {
+        int sessionCount = SESSION_COUNTS[i];
+        StandInContext ctx(PrepareSessions(sessionCount));
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        bool success = true;
+        for (int it=0; it < iterations; ++it) {
+            ctx.invalidate(); //every iteration behaves like a new cernvm-launch process
+            std::streambuf* oldOut = std::cout.rdbuf(devNull.rdbuf());
+            success = handler.listRunningCvmMachines(ctx) && success;
+            std::cout.rdbuf(oldOut);
+            devNull.str("");
+        }
+        double totalUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                            std::chrono::steady_clock::now() - start).count();
+
+        std::cout << "list --running  sessions: " << sessionCount
+                  << "\titerations: " << iterations
+                  << "\tmean: " << totalUs / iterations << " us"
+                  << (success ? "" : "\t(FAILED)") << std::endl;
+    }
+
+    boost::system::error_code ec;
+    boost::filesystem::remove_all(baseFolder, ec);
+
+    return 0;
+}
+
+
+namespace {
+
+runningSetType PrepareSessions(int sessionCount) {
+    std::string runFolder = Tools::GetDataFolder() + "/run";
+    boost::filesystem::remove_all(runFolder);
+    boost::filesystem::create_directories(runFolder);
+
+    //stamps in the past, so the index is trusted (see SessionIndex::load)
+    std::time_t stamp = std::time(NULL) - 60;
+    std::vector<SessionIndexEntry> entries;
+    runningSetType running;
+
+    for (int i=0; i < sessionCount; ++i) {
+        std::ostringstream name;
+        name << "bench-machine-" << i;
+
+        std::string sessionFile = runFolder + "/" + name.str() + ".conf";
+        std::ofstream(sessionFile.c_str()) << "name=" << name.str() << "\n";
+        boost::filesystem::last_write_time(sessionFile, stamp);
+
+        SessionIndexEntry entry;
+        entry.name = name.str();
+        entry.cernvmVersion = "latest";
+        entry.apiPort = "22";
+        entry.baseFolder = runFolder + "/" + name.str();
+        entries.push_back(entry);
+
+        if (i % 2 == 0)
+            running.insert(entry.name);
+    }
+    boost::filesystem::last_write_time(runFolder, stamp);
+
+    SessionIndex index(runFolder, Tools::GetDataFolder() + "/" + SESSION_INDEX_FILENAME);
+    if (!index.store(entries))
+        std::cerr << "Unable to store the session index\n";
+
+    return running;
+}
+
+} //anonymous namespace
@@ -1,6 +1,6 @@
 #!/usr/bin/env python2.6
 
-import os, sys, subprocess, re, time, shutil
+import os, sys, subprocess, re, time, shutil, tempfile
 import ConfigParser
 try:
     # try with the standard library (Python2.7 and newer)
@@ -14,6 +14,8 @@ except ImportError:
 CI_DIR = os.path.dirname(os.path.abspath(__file__)) + os.sep
 # Directory where all the test files are (./ci/tests)
 TEST_DIR = os.path.join(CI_DIR, "tests") + os.sep
+# Directory for the files written by the tests (the 'tmp:' macro), created on the first use
+TMP_DIR = None
 
 
 # Main function, its exit code is also the exit code of the script
@@ -42,15 +44,19 @@ def Main():
 
     testFilesCount = len(testFilesList)
     fileCount = 1
-    for testFile in testFilesList:
-        print(100*"=")
-        print("Test [%d/%d]: %s" % (fileCount, testFilesCount, testFile[: -4])) # strip the '.ini'
-        fileCount += 1
-
-        success = RunTest(launchBinary, testFile)
-        if not success:
-            mainEc += 1
-            failedTests.append(testFile)
+    try:
+        for testFile in testFilesList:
+            print(100*"=")
+            print("Test [%d/%d]: %s" % (fileCount, testFilesCount, testFile[: -4])) # strip the '.ini'
+            fileCount += 1
+
+            success = RunTest(launchBinary, testFile)
+            if not success:
+                mainEc += 1
+                failedTests.append(testFile)
+    finally:
+        if TMP_DIR:
+            shutil.rmtree(TMP_DIR, ignore_errors=True)
 
     print(100*"=")
     if mainEc == 0:
@@ -261,10 +267,16 @@ def MacroReplace(cmdList):
     return result
 
 
-# If the 'file:' pattern is present in the string, it gets replaced by the TEST_DIR
+# If the 'file:' pattern is present in the string, it gets replaced by the TEST_DIR,
+# the 'tmp:' pattern by the TMP_DIR
 def PathExpansion(string):
+    global TMP_DIR
     if "file:" in string:
         return string.replace("file:", TEST_DIR)
+    if "tmp:" in string:
+        if not TMP_DIR:
+            TMP_DIR = tempfile.mkdtemp(prefix="launch-test-") + os.sep
+        return string.replace("tmp:", TMP_DIR)
     return string
 
 
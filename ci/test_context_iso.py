@@ -0,0 +1,217 @@
+#!/usr/bin/env python2.6
+
+# Create a machine with extra context files against the stand-in VBoxManage (ci/fake-vbox) and verify
+# the context ISO built by CernVM-Launch with an independent reader (isoinfo, 7z or bsdtar):
+# the files are stored under their destinations (nested directories, names colliding in ISO9660
+# like 'a-b' and 'a_b') and their content is the same byte for byte.
+
+import os, sys, re, shutil, tempfile, optparse
+
+from test import FindExecutable, RunCmd
+from test_fake_vbox import PrepareEnvironment, TEST_DIR
+
+MACHINE_NAME = "launch_context_iso_machine"
+
+# Context files: destination in the ISO, content. 'a-b' and 'a_b' are both 'A_B' in ISO9660
+CONTEXT_FILES = (
+    ("a-b", "dash\n"),
+    ("a_b", "underscore\n"),
+    ("deep/nested/dir/a-b", "nested dash\n"),
+    ("deep/nested/dir/a_b", "nested underscore\n"),
+    ("deep/nested/dir/data.bin", None), # random data spanning several sectors
+    ("deep/empty", ""),
+    ("deep/nested/a-file-name-longer-than-the-iso9660-limit.txt", "long name\n"),
+)
+# Files every context ISO has
+GENERATED_FILES = ("ec2/latest/user-data", "ec2/latest/meta-data.json",
+                   "openstack/latest/user_data", "openstack/latest/meta_data.json", "readme")
+
+
+def Main():
+    parser = optparse.OptionParser(usage="%prog [options]")
+    parser.add_option("--launch", help="cernvm-launch binary (default: search the build)")
+    parser.add_option("--keep", action="store_true", help="keep the working directory")
+    parser.set_defaults(latency=0.0, fail=[], fail_rate=[]) # no latency nor failures of the stand-in
+    options, _ = parser.parse_args()
+
+    launchBinary = options.launch or FindExecutable()
+    if not launchBinary:
+        print("Unable to find a CernVM-Launch binary")
+        return -1
+    reader = FindIsoReader()
+    if not reader:
+        print("Unable to find isoinfo, 7z or bsdtar to read the ISO")
+        return -1
+
+    workDir = tempfile.mkdtemp(prefix="launch-context-iso-")
+    print("Working directory: %s" % workDir)
+    try:
+        PrepareEnvironment(workDir, options)
+        isoFile = CreateMachine(launchBinary, workDir)
+        if not isoFile:
+            return 1
+        print("Context ISO: %s (read by %s)" % (isoFile, reader))
+        failures = VerifyIso(reader, isoFile, workDir)
+        RunCmd([launchBinary, "destroy", "--force", MACHINE_NAME])
+    finally:
+        if not options.keep:
+            shutil.rmtree(workDir, ignore_errors=True)
+
+    if failures == 0:
+        print("The context ISO is correct")
+    else:
+        print("FAILED checks: %d" % failures)
+    return failures
+
+
+def FindIsoReader():
+    for reader in ("isoinfo", "7z", "bsdtar"):
+        for folder in os.environ.get("PATH", "").split(os.pathsep):
+            if os.path.isfile(os.path.join(folder, reader)):
+                return reader
+    return None
+
+
+# Write the context files, create the machine with them and return the path of its context ISO
+def CreateMachine(launchBinary, workDir):
+    sourceDir = os.path.join(workDir, "context")
+    os.makedirs(sourceDir)
+    args = [launchBinary, "create", "--no-start", "--name", MACHINE_NAME, "--iso", os.path.join(workDir, "ucernvm.iso")]
+    for i in range(len(CONTEXT_FILES)):
+        destination, content = CONTEXT_FILES[i]
+        source = os.path.join(sourceDir, "file%d" % i)
+        if content is None:
+            content = os.urandom(150000)
+        f = open(source, "wb")
+        try:
+            f.write(content)
+        finally:
+            f.close()
+        args += ["--context-file", "%s:%s" % (source, destination)]
+    args.append(os.path.join(TEST_DIR, "userData.conf"))
+
+    stdout, stderr, ec = RunCmd(args)
+    if ec != 0:
+        print("FAILED to create the machine (exit code %d)" % ec)
+        print("\tstdout: %s" % stdout.strip())
+        print("\tstderr: %s" % stderr.strip())
+        return None
+
+    # the ISO attached by 'storageattach ... --medium ISO'
+    callsLog = open(os.path.join(os.environ["FAKE_VBOX_STATE"], "calls.log"))
+    try:
+        for line in callsLog:
+            args = line.rstrip("\n").split("\t")[-1].split()
+            if args and args[0] == "storageattach" and "--medium" in args:
+                return args[args.index("--medium") + 1]
+    finally:
+        callsLog.close()
+    print("FAILED: no context ISO was attached to the machine")
+    return None
+
+
+# Compare the files in the ISO with the sources, return the number of failed checks
+def VerifyIso(reader, isoFile, workDir):
+    failures = 0
+    files = ListJolietFiles(reader, isoFile)
+    expected = [CONTEXT_FILES[i][0] for i in range(len(CONTEXT_FILES))] + list(GENERATED_FILES)
+    for path in expected:
+        if path not in files:
+            failures += 1
+            print("FAILED: '%s' is not in the ISO" % path)
+    for path in files:
+        if path not in expected:
+            failures += 1
+            print("FAILED: unexpected file '%s' in the ISO" % path)
+
+    extractDir = os.path.join(workDir, "extracted")
+    ExtractJoliet(reader, isoFile, files, extractDir)
+    for i in range(len(CONTEXT_FILES)):
+        destination = CONTEXT_FILES[i][0]
+        if ReadFile(os.path.join(workDir, "context", "file%d" % i)) != ReadFile(os.path.join(extractDir, destination)):
+            failures += 1
+            print("FAILED: content of '%s' differs from its source" % destination)
+
+    # ISO9660 names (read by clients without Joliet) must be unique as well
+    primaryFiles = ListPrimaryFiles(reader, isoFile)
+    if primaryFiles is None:
+        print("Skipping the check of the ISO9660 names, %s cannot read them" % reader)
+    elif len(primaryFiles) != len(expected) or len(set([f.upper() for f in primaryFiles])) != len(primaryFiles):
+        failures += 1
+        print("FAILED: ISO9660 names are not unique: %s" % ", ".join(primaryFiles))
+    return failures
+
+
+# Paths of the files (not directories) in the Joliet tree
+def ListJolietFiles(reader, isoFile):
+    if reader == "isoinfo":
+        return ParseIsoinfoListing(RunCmd(["isoinfo", "-l", "-J", "-i", isoFile])[0])
+    if reader == "7z":
+        stdout = RunCmd(["7z", "l", "-slt", isoFile])[0]
+        files = []
+        for block in stdout.split("\n\n"):
+            path = re.search(r"^Path = (.*)$", block, re.MULTILINE)
+            folder = re.search(r"^Folder = (.*)$", block, re.MULTILINE)
+            if path and folder and folder.group(1).strip() != "+":
+                files.append(path.group(1).strip().replace(os.sep, "/"))
+        return files
+    stdout = RunCmd(["bsdtar", "tvf", isoFile])[0]
+    return [line.split(None, 8)[8] for line in stdout.splitlines() if line.startswith("-")]
+
+
+# Paths of the files in the primary (ISO9660) tree, None if the reader cannot tell
+def ListPrimaryFiles(reader, isoFile):
+    if reader == "isoinfo":
+        return ParseIsoinfoListing(RunCmd(["isoinfo", "-l", "-i", isoFile])[0])
+    if reader == "bsdtar":
+        stdout = RunCmd(["bsdtar", "tvf", isoFile, "--options", "iso9660:!joliet"])[0]
+        return [line.split(None, 8)[8] for line in stdout.splitlines() if line.startswith("-")]
+    return None
+
+
+# 'isoinfo -l' prints 'Directory listing of /DIR/' followed by a line per entry, ending by '[ EXTENT FLAGS]  NAME'
+def ParseIsoinfoListing(stdout):
+    files = []
+    directory = ""
+    for line in stdout.splitlines():
+        header = re.match(r"^Directory listing of /(.*)$", line)
+        entry = re.match(r"^-.*\]\s+(.*?)\s*$", line) # files only, directories start by 'd'
+        if header:
+            directory = header.group(1)
+        elif entry:
+            files.append(directory + re.sub(r";1$", "", entry.group(1)))
+    return files
+
+
+def ExtractJoliet(reader, isoFile, files, extractDir):
+    os.makedirs(extractDir)
+    if reader == "7z":
+        RunCmd(["7z", "x", "-o" + extractDir, isoFile])
+    elif reader == "bsdtar":
+        RunCmd(["bsdtar", "xf", isoFile, "-C", extractDir])
+    else:
+        for path in files:
+            target = os.path.join(extractDir, path)
+            if not os.path.isdir(os.path.dirname(target)):
+                os.makedirs(os.path.dirname(target))
+            f = open(target, "wb")
+            try:
+                f.write(RunCmd(["isoinfo", "-J", "-x", "/" + path, "-i", isoFile])[0])
+            finally:
+                f.close()
+
+
+# Content of the file, None if it cannot be read
+def ReadFile(path):
+    try:
+        f = open(path, "rb")
+    except IOError:
+        return None
+    try:
+        return f.read()
+    finally:
+        f.close()
+
+
+if __name__ == "__main__":
+    sys.exit(Main())
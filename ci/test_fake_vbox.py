@@ -0,0 +1,141 @@
+#!/usr/bin/env python2.6
+
+# Run the create/list/start/stop/destroy cycle against the stand-in VBoxManage (ci/fake-vbox),
+# so CernVM-Launch can be tested and its own overhead benchmarked without VirtualBox.
+#
+# Every step is timed and the number of VBoxManage invocations it needed is reported.
+# Use --latency, --fail and --fail-rate to configure the stand-in (see ci/fake-vbox/VBoxManage).
+
+import os, sys, re, time, json, shutil, tempfile, optparse
+
+from test import FindExecutable, RunCmd
+
+CI_DIR = os.path.dirname(os.path.abspath(__file__))
+TEST_DIR = os.path.join(CI_DIR, "tests")
+FAKE_VBOXMANAGE = os.path.join(CI_DIR, "fake-vbox", "VBoxManage")
+
+
+# Steps of one cycle: name, cernvm-launch arguments, expected exit code, expected output regex
+def CycleSteps(machineName, isoPath):
+    return (
+        ("create", ["create", "--no-start", "--name", machineName, "--iso", isoPath,
+                    os.path.join(TEST_DIR, "userData.conf")], 0, None),
+        ("list", ["list"], 0, r".*%s:\s+CVM:.*" % machineName),
+        ("start", ["start", machineName], 0, None),
+        ("list --running", ["list", "--running"], 0, r".*%s:\s+CVM:.*" % machineName),
+        ("stop", ["stop", machineName], 0, None),
+        ("destroy", ["destroy", "--force", machineName], 0, None),
+    )
+
+
+def Main():
+    parser = optparse.OptionParser(usage="%prog [options]")
+    parser.add_option("--launch", help="cernvm-launch binary (default: search the build)")
+    parser.add_option("--repeat", type="int", default=1, help="how many times to run the cycle")
+    parser.add_option("--latency", type="float", default=0.0, help="default latency of every VBoxManage call [s]")
+    parser.add_option("--fail", action="append", default=[], metavar="CMD=N",
+                      help="fail the next N calls of a VBoxManage command")
+    parser.add_option("--fail-rate", action="append", default=[], metavar="CMD=P",
+                      help="fail a VBoxManage command with the probability P")
+    parser.add_option("--keep", action="store_true", help="keep the working directory")
+    options, _ = parser.parse_args()
+
+    launchBinary = options.launch or FindExecutable()
+    if not launchBinary:
+        print("Unable to find a CernVM-Launch binary")
+        return -1
+
+    workDir = tempfile.mkdtemp(prefix="launch-fake-vbox-")
+    print("Working directory: %s" % workDir)
+    try:
+        PrepareEnvironment(workDir, options)
+        return RunCycles(launchBinary, workDir, options.repeat)
+    finally:
+        if not options.keep:
+            shutil.rmtree(workDir, ignore_errors=True)
+
+
+# Fake home with a global config, stand-in state and configuration, everything exported in os.environ
+def PrepareEnvironment(workDir, options):
+    homeDir = os.path.realpath(os.path.join(workDir, "home"))
+    launchHome = os.path.join(homeDir, "launch")
+    os.makedirs(launchHome)
+
+    config = open(os.path.join(homeDir, ".cernvm-launch.conf"), "w")
+    config.write("sharedFolder=%s\nlaunchHomeFolder=%s\n" % (homeDir, launchHome))
+    config.close()
+
+    fakeConfig = {"latency": {"default": options.latency}, "fail": {}, "fail_rate": {}}
+    for item in options.fail:
+        cmd, count = item.rsplit("=", 1)
+        fakeConfig["fail"][cmd] = int(count)
+    for item in options.fail_rate:
+        cmd, rate = item.rsplit("=", 1)
+        fakeConfig["fail_rate"][cmd] = float(rate)
+    configFile = open(os.path.join(workDir, "fake-vbox.json"), "w")
+    json.dump(fakeConfig, configFile)
+    configFile.close()
+
+    # empty ISO, so libcernvm does not download a ucernvm image
+    open(os.path.join(workDir, "ucernvm.iso"), "w").close()
+
+    os.environ["HOME"] = homeDir
+    os.environ["FAKE_VBOX_STATE"] = os.path.join(workDir, "vbox")
+    os.environ["FAKE_VBOX_CONFIG"] = os.path.join(workDir, "fake-vbox.json")
+    os.environ["CERNVM_LAUNCH_VBOXMANAGE"] = FAKE_VBOXMANAGE
+
+
+def CountVBoxCalls():
+    callsLog = os.path.join(os.environ["FAKE_VBOX_STATE"], "calls.log")
+    if not os.path.exists(callsLog):
+        return 0
+    f = open(callsLog)
+    try:
+        return len(f.readlines())
+    finally:
+        f.close()
+
+
+# Run the cycle 'repeat' times, print the timing table and return the number of failed steps
+def RunCycles(launchBinary, workDir, repeat):
+    timings = {} # step name -> list of (seconds, VBoxManage calls)
+    stepNames = []
+    failures = 0
+
+    for i in range(repeat):
+        steps = CycleSteps("fake_machine_%d" % i, os.path.join(workDir, "ucernvm.iso"))
+        for name, args, expectedEc, expectedRegex in steps:
+            callsBefore = CountVBoxCalls()
+            start = time.time()
+            stdout, stderr, ec = RunCmd([launchBinary] + args)
+            duration = time.time() - start
+
+            if name not in timings:
+                timings[name] = []
+                stepNames.append(name)
+            timings[name].append((duration, CountVBoxCalls() - callsBefore))
+
+            if ec != expectedEc or (expectedRegex and not re.search(expectedRegex, stdout)):
+                failures += 1
+                print("FAILED step '%s' (exit code %d, expected %d)" % (name, ec, expectedEc))
+                print("\tstdout: %s" % stdout.strip())
+                print("\tstderr: %s" % stderr.strip())
+
+    print(100*"=")
+    print("%-16s %6s %10s %10s %10s %12s" % ("step", "runs", "min [s]", "mean [s]", "max [s]", "VBox calls"))
+    for name in stepNames:
+        durations = [t[0] for t in timings[name]]
+        calls = [t[1] for t in timings[name]]
+        print("%-16s %6d %10.3f %10.3f %10.3f %12.1f" % (name, len(durations), min(durations),
+              sum(durations) / len(durations), max(durations), float(sum(calls)) / len(calls)))
+    print(100*"=")
+
+    if failures == 0:
+        print("All fake VirtualBox steps successful")
+    else:
+        print("FAILED steps: %d" % failures)
+    return failures
+
+
+if __name__ == "__main__":
+    sys.exit(Main())
@@ -0,0 +1,41 @@
+/**
+ * Fuzz target of the configuration tokenizer (libFuzzer).
+ * Usage: launch-fuzz-ConfigFuzz fuzz/corpus/ConfigFuzz
+ */
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Config.h"
+
+using namespace Launch;
+
+
+extern "C" int LLVMFuzzerInitialize(int* argc, char*** argv) {
+    std::cerr.rdbuf(NULL); //invalid values are expected, do not flood the output with them
+    return 0;
+}
+
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    Config config;
+    config.loadBuffer(reinterpret_cast<const char*>(data), size, CONFIG_LAYER_FILE, "fuzz");
+
+    //every stored item has a non-empty key and value, and an item of a higher layer always wins
+    std::vector<std::string> keys = config.keys();
+    for (size_t i=0; i < keys.size(); ++i) {
+        std::string value = config.get(keys[i]);
+        if (keys[i].empty() || value.empty())
+            std::abort();
+        config.set(keys[i], "1" + value, CONFIG_LAYER_DEFAULTS);
+        if (config.get(keys[i]) != value)
+            std::abort();
+        config.set(keys[i], "1", CONFIG_LAYER_COMMAND_LINE);
+        if (config.get(keys[i]) != "1")
+            std::abort();
+    }
+    return 0;
+}
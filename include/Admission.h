@@ -0,0 +1,57 @@
+/**
+ * Admission control of starting machines: the memory and CPUs of the running machines,
+ * plus the machine to start, must fit into the host capacity (multiplied by the configured
+ * overcommit ratios). Machines which do not fit wait until others stop, or are rejected.
+ */
+
+#ifndef _ADMISSION_H
+#define _ADMISSION_H
+
+#include <string>
+
+#include "HypervisorContext.h"
+
+namespace Launch {
+namespace Admission {
+    //Folder (in the data folder) with the lock and the reservations of the admitted machines
+    const std::string ADMISSION_FOLDER = "admission";
+    //Defaults of the global config keys
+    const int DEFAULT_MEMORY_OVERCOMMIT_PERCENT = 100;
+    const int DEFAULT_CPU_OVERCOMMIT_PERCENT = 400;
+    const int DEFAULT_TIMEOUT_MS = 300000;
+
+    struct HostCapacity {
+        long long memoryMB;
+        long long availableMemoryMB; //memory available without swapping, -1 if unknown
+        unsigned cpus;
+    };
+
+    //Resources of an admitted machine, counted until the reservation is released (or the process exits)
+    //so machines started concurrently (by other threads or processes) are not admitted twice
+    class Reservation {
+        public:
+            Reservation();
+            ~Reservation();
+            void release();
+
+        private:
+            Reservation(const Reservation&);
+            Reservation& operator=(const Reservation&);
+            friend bool Admit(HypervisorContext&, const std::string&, int, int, Reservation&);
+
+            std::string _file;
+    };
+
+    //Check if the admission control is enabled (admissionControl in the global config, enabled by default)
+    bool IsEnabled();
+    //Get the memory and CPU count of the host
+    bool GetHostCapacity(HostCapacity& outCapacity);
+    //Wait until the machine fits into the host capacity, at most admissionTimeoutMs (from the global config).
+    //Returns false (and prints why) if it never fits, or the timeout passed. Returns true without
+    //a reservation if the admission control is disabled
+    bool Admit(HypervisorContext& ctx, const std::string& machineName, int memoryMB, int cpus,
+               Reservation& outReservation);
+} //namespace Admission
+} //namespace Launch
+
+#endif //_ADMISSION_H
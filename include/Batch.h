@@ -0,0 +1,31 @@
+/**
+ * Batch mode: several commands (one per line of a script) handled by one process,
+ * sharing the global config, the hypervisor and the loaded sessions.
+ */
+
+#ifndef _BATCH_H
+#define _BATCH_H
+
+#include <string>
+#include <vector>
+
+#include "HypervisorContext.h"
+#include "RequestHandler.h"
+
+namespace Launch {
+namespace Batch {
+    //Function which parses the arguments and invokes the handler, returns the exit code
+    typedef int (*dispatchFuncType)(int argc, char** argv, HypervisorContext& ctx, RequestHandler& handler);
+
+    //Split a line into words: separated by whitespace, '...' and "..." quote, '\' escapes the next character.
+    //Returns false (and prints why) on an unterminated quote
+    bool SplitCommandLine(const std::string& line, std::vector<std::string>& outWords);
+    //Run the commands of the file ('-' for stdin), on at most 'parallelism' threads (lines must be
+    //independent if it is more than 1). Empty lines and lines starting with '#' are skipped.
+    //A result line is printed for every command. Returns true if all the commands succeeded
+    bool Run(const std::string& filename, unsigned parallelism, HypervisorContext& ctx, RequestHandler& handler,
+             dispatchFuncType dispatch);
+} //namespace Batch
+} //namespace Launch
+
+#endif //_BATCH_H
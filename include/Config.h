@@ -0,0 +1,75 @@
+/**
+ * Layered configuration: hardcoded defaults < global config < parameter file < command line.
+ * Every value remembers the layer it comes from, so the precedence is resolved when a value
+ * is set, whatever the order of loading the layers is. Values of the known numeric and
+ * boolean keys are validated when they are set.
+ */
+
+#ifndef _CONFIG_H
+#define _CONFIG_H
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+//Configuration file defines
+#define KEY_VALUE_SEPARATOR '='
+#define COMMENT_CHAR        '#'
+
+namespace Launch {
+
+//Layers of the configuration, from the lowest precedence
+enum ConfigLayer {
+    CONFIG_LAYER_DEFAULTS,     //hardcoded defaults
+    CONFIG_LAYER_GLOBAL,       //global config file
+    CONFIG_LAYER_FILE,         //parameter file given by the user
+    CONFIG_LAYER_COMMAND_LINE, //command line options (and values derived by Launch)
+};
+
+class Config {
+    public:
+        //Load the key=value lines of the file (or a pipe) into the layer, in a single pass over its content.
+        //Lines starting with '#', lines without '=' and empty values are ignored, quotes around values are stripped.
+        //Returns false if the file cannot be read or it contains an invalid value (all such values are reported)
+        bool loadFile(const std::string& filename, ConfigLayer layer);
+        //The same for a buffer, origin (e.g. the file name) and firstLine (line number of the buffer
+        //in the origin) are used in the error messages
+        bool loadBuffer(const char* data, size_t size, ConfigLayer layer, const std::string& origin,
+                        unsigned firstLine=1);
+        //Set the value, unless the key is set in a higher layer. Returns false (and prints why) if the value is invalid
+        bool set(const std::string& key, const std::string& value, ConfigLayer layer);
+        //Set all values of the other config, in their layers
+        void merge(const Config& other);
+        void erase(const std::string& key);
+        //Remove the key and return its value (empty if it is not set)
+        std::string extract(const std::string& key);
+
+        bool has(const std::string& key) const;
+        std::string get(const std::string& key, const std::string& defaultValue="") const;
+        //Typed getters, defaultValue is returned for a missing key (or a value of an unknown key which is not valid)
+        int  getInt(const std::string& key, int defaultValue) const;
+        bool getBool(const std::string& key, bool defaultValue) const;
+        std::vector<std::string> keys() const;
+        //Resolved values, e.g. for ParameterMap::fromMap
+        std::map<const std::string, const std::string> toMap() const;
+        //Check if the key configures CernVM-Launch itself (e.g. parallelism), not a machine
+        static bool IsLaunchKey(const std::string& key);
+
+    private:
+        struct Value {
+            std::string value;
+            ConfigLayer layer;
+        };
+
+        //Check the value of a known key, outError describes the expected value
+        static bool validate(const std::string& key, const std::string& value, std::string& outError);
+        //Store the value (already validated) if the layer is not lower than the one of the current value
+        void store(const std::string& key, const std::string& value, ConfigLayer layer);
+
+        std::map<std::string, Value> _values;
+};
+
+} //namespace Launch
+
+#endif //_CONFIG_H
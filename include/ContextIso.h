@@ -0,0 +1,43 @@
+/**
+ * Context (user data) ISOs. The ISOs are built by Launch, with the layout of libcernvm plus
+ * optional extra files, and optionally cached: machines created with the same context share
+ * one ISO, which is built only once and attached read-only. ISOs no machine uses are evicted.
+ */
+
+#ifndef _CONTEXT_ISO_H
+#define _CONTEXT_ISO_H
+
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include <CernVM/Hypervisor.h>
+
+namespace Launch {
+namespace ContextIso {
+    //Folder (in the data folder) with the cached ISOs, named by the hash of their content
+    const std::string CONTEXT_ISO_FOLDER = "context";
+    //ISOs used (built or reused) in the last hour are not evicted, a create may be about to attach them
+    const std::time_t CONTEXT_ISO_GRACE_S = 3600;
+
+    //Extra file added to the context ISO
+    struct ContextFile {
+        std::string source;       //path to the local file
+        std::string destination;  //path in the ISO
+    };
+
+    //Parse 'path[:destination]', the destination defaults to the file name (in the root of the ISO)
+    bool ParseContextFile(const std::string& arg, ContextFile& outFile);
+    //Check if the cache is enabled (contextIsoCache in the global config, disabled by default)
+    bool IsCacheEnabled();
+    //Get the ISO for the user data and the extra files, build it if it is not cached yet
+    bool GetCachedIso(const std::string& userData, const std::vector<ContextFile>& files, std::string& outFile);
+    //Attach the ISO as the context CD-ROM of a created (powered off) machine
+    bool Attach(HVInstancePtr hv, HVSessionPtr session, const std::string& isoFile);
+    //Remove the ISOs no machine uses, according to 'VBoxManage list dvds'.
+    //Returns the number of removed ISOs
+    int Evict(HVInstancePtr hv);
+} //namespace ContextIso
+} //namespace Launch
+
+#endif //_CONTEXT_ISO_H
@@ -0,0 +1,35 @@
+/**
+ * Optional daemon mode, which keeps the hypervisor and loaded sessions warm between commands.
+ * Clients forward their commands over a local Unix socket, if no daemon is running,
+ * the commands are handled in-process as usual.
+ */
+
+#ifndef _DAEMON_H
+#define _DAEMON_H
+
+#include <string>
+
+#include "HypervisorContext.h"
+#include "RequestHandler.h"
+
+namespace Launch {
+namespace Daemon {
+    //Function which parses the arguments and invokes the handler, returns the exit code
+    typedef int (*dispatchFuncType)(int argc, char** argv, HypervisorContext& ctx, RequestHandler& handler);
+
+    //Path to the daemon socket (inside the data folder)
+    std::string GetSocketPath();
+    //Check if the command can be handled by the daemon (non-interactive commands only)
+    bool        IsForwardable(int argc, char** argv);
+    //Forward the command to a running daemon and print its output.
+    //Returns false if no daemon is running (the command should be handled in-process).
+    bool        ForwardRequest(int argc, char** argv, int& outExitCode);
+    //Serve forwarded commands until a stop request arrives. The context is kept
+    //for the whole lifetime of the daemon. Does not work on Windows.
+    bool        Serve(HypervisorContext& ctx, RequestHandler& handler, dispatchFuncType dispatch);
+    //Ask a running daemon to exit
+    bool        StopDaemon();
+} //namespace Daemon
+} //namespace Launch
+
+#endif //_DAEMON_H
@@ -0,0 +1,40 @@
+/**
+ * Exclusive advisory lock of a file, shared by all CernVM-Launch processes (and threads)
+ * working with the same data folder.
+ */
+
+#ifndef _FILE_LOCK_H
+#define _FILE_LOCK_H
+
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+namespace Launch {
+
+//Locks the file (created if missing) in the constructor, blocking until the lock is acquired,
+//and unlocks it in the destructor. The lock is released by the OS if the process dies
+class FileLock {
+    public:
+        explicit FileLock(const std::string& filename);
+        ~FileLock();
+        //Check if the lock was acquired (an error message is printed if not)
+        bool locked() const;
+
+    private:
+        FileLock(const FileLock&);
+        FileLock& operator=(const FileLock&);
+
+#ifdef _WIN32
+        HANDLE _file;
+#else
+        int _fd;
+#endif
+        bool _locked;
+};
+
+} //namespace Launch
+
+#endif //_FILE_LOCK_H
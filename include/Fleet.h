@@ -0,0 +1,62 @@
+/**
+ * Declarative fleet of machines: a manifest with the desired machines, and reconciling
+ * the existing sessions with it (create, start, stop or destroy only what differs).
+ */
+
+#ifndef _FLEET_H
+#define _FLEET_H
+
+#include <string>
+#include <vector>
+
+#include "Config.h"
+#include "HypervisorContext.h"
+#include "RequestHandler.h"
+
+namespace Launch {
+namespace Fleet {
+    //Parameter stored in the sessions created by apply, to detect changes of the user data file
+    const std::string USER_DATA_HASH_PARAM = "userDataHash";
+
+    //Machine of the manifest
+    struct FleetMachine {
+        std::string name;
+        std::string userDataFile;
+        bool running;  //desired state
+        Config params; //creation parameters (from the defaults and the section of the machine)
+    };
+
+    enum ActionType {
+        ACTION_CREATE,
+        ACTION_RECREATE, //parameters differ: destroy and create again
+        ACTION_START,
+        ACTION_STOP,
+        ACTION_DESTROY,  //not in the manifest (with prune only)
+    };
+
+    //Step of the plan, one per machine
+    struct Action {
+        ActionType type;
+        std::string machineName;
+        std::string reason;      //what differs, printed in the plan
+        size_t machineIndex;     //index in the manifest (unless destroy)
+    };
+
+    //Load the manifest: 'key=value' lines, as in a parameter file, before the first '[NAME]' line are
+    //defaults of all machines, the lines after it are parameters of the machine NAME.
+    //'state' (running or stopped) and 'userDataFile' (relative to the manifest) are not creation parameters
+    bool LoadManifest(const std::string& filename, std::vector<FleetMachine>& outMachines);
+    //Load a single machine from a file in the format of a manifest section (e.g. a pool profile)
+    bool LoadMachineFile(const std::string& filename, const std::string& name, FleetMachine& outMachine);
+    //Compare the manifest with the existing sessions. prune: destroy the machines missing in the manifest
+    bool Plan(HypervisorContext& ctx, const std::vector<FleetMachine>& machines, bool prune,
+              std::vector<Action>& outPlan);
+    //Print the plan, one action per line
+    void PrintPlan(const std::vector<Action>& plan);
+    //Run the plan, actions of different machines run concurrently (at most 'parallelism' at once)
+    bool Apply(HypervisorContext& ctx, RequestHandler& handler, const std::vector<FleetMachine>& machines,
+               const std::vector<Action>& plan, unsigned parallelism);
+} //namespace Fleet
+} //namespace Launch
+
+#endif //_FLEET_H
@@ -0,0 +1,77 @@
+/**
+ * Per-command hypervisor context, memoizing the hypervisor instance, the loaded sessions
+ * and the running machines, so every libcernvm/VBoxManage round trip is done only once.
+ */
+
+#ifndef _HYPERVISOR_CONTEXT_H
+#define _HYPERVISOR_CONTEXT_H
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <CernVM/Hypervisor.h>
+
+#include "SessionIndex.h"
+
+namespace Launch {
+
+typedef std::map<std::string, HVSessionPtr> sessionMapType;
+typedef std::unordered_set<std::string>     runningSetType;
+
+//Created once per command (or kept for the whole lifetime of the daemon) and passed
+//to all RequestHandler methods. Everything is loaded lazily on the first use.
+//Methods are virtual, so a stand-in hypervisor can be used for benchmarks.
+//Methods can be called from several threads (e.g. bulk operations), they are serialized by mutex().
+class HypervisorContext {
+    public:
+        HypervisorContext();
+        virtual ~HypervisorContext();
+        //Get the hypervisor, detect it on the first call. Prints an error message on failure
+        virtual HVInstancePtr hypervisor();
+        //Get a copy of the stored sessions, load them on the first call. The copy can be walked
+        //while other threads create or delete sessions. Returns an empty map if there is no hypervisor
+        virtual sessionMapType sessions();
+        //Find a stored session by the machine name (without opening it), NULL if there is none
+        HVSessionPtr sessionByName(const std::string& machineName);
+        //Get the basic information about the stored sessions from the session index.
+        //The sessions are loaded (and the index rebuilt) only if the index is stale.
+        //Returns NULL if the index is stale and there is no hypervisor
+        virtual const std::vector<SessionIndexEntry>* indexedSessions();
+        //Get the set of running machine names, query the hypervisor on the first call.
+        //Returns NULL if there is no hypervisor
+        virtual const runningSetType* runningMachines();
+        //Check if a machine with the given name is running
+        bool isRunning(const std::string& machineName);
+        //Find and open a session by the machine name, opened sessions are memoized.
+        //Sessions of different machines are opened concurrently, the same one only once
+        virtual HVSessionPtr openSession(const std::string& machineName);
+        //Drop the loaded and opened sessions and the running machines, they are loaded again on the next use
+        virtual void invalidate();
+        //Drop the running machines only (e.g. after a machine was started or stopped)
+        void invalidateRunningMachines();
+        //Forget the session of a destroyed machine
+        void forgetSession(const std::string& machineName);
+        //Lock it while modifying the hypervisor sessions directly (e.g. allocating a new one)
+        std::recursive_mutex& mutex();
+
+    private:
+        bool _sessionsLoaded;
+        bool _indexLoaded;
+        bool _runningLoaded;
+        SessionIndex _sessionIndex;
+        HVInstancePtr _hypervisor;
+        runningSetType _runningMachines;
+        std::map<std::string, HVSessionPtr> _openedSessions;
+        std::set<std::string> _openingSessions; //being opened by a thread without holding the mutex
+        std::recursive_mutex _mutex;
+        std::condition_variable_any _sessionOpened; //signalled when a session leaves _openingSessions
+};
+
+} //namespace Launch
+
+#endif //_HYPERVISOR_CONTEXT_H
@@ -0,0 +1,71 @@
+/**
+ * Content-addressed cache of the downloaded CernVM images. libcernvm keeps the images in its
+ * cache folder under its own names, we keep these names as hardlinks to objects named by
+ * the SHA-256 of their content, so the same image is stored only once. The least recently
+ * used images are evicted when the cache grows over its size limit. Processes changing
+ * the index (fetch and evict) lock it, so their updates are not lost.
+ */
+
+#ifndef _IMAGE_CACHE_H
+#define _IMAGE_CACHE_H
+
+#include <ctime>
+#include <map>
+#include <string>
+
+#include <CernVM/Hypervisor.h>
+
+namespace Launch {
+
+//libcernvm cache folder (in the data folder)
+const std::string IMAGE_CACHE_FOLDER = "cache";
+//Image cache index file name, stored in the cache folder
+const std::string IMAGE_CACHE_INDEX_FILENAME = "images.index";
+//Folder (in the cache folder) with the content-addressed objects
+const std::string IMAGE_CACHE_OBJECTS_FOLDER = "objects";
+
+//Information about one image file of libcernvm
+struct ImageCacheEntry {
+    std::string checksum; //SHA-256 of the content (name of the object), empty if it could not be linked
+    std::time_t lastUsed;
+};
+
+class ImageCache {
+    public:
+        //cacheFolder: the libcernvm cache folder (with the downloaded images)
+        explicit ImageCache(const std::string& cacheFolder);
+        //Download the image if it is not cached yet, store it by its checksum and mark it as used.
+        //outFile: path to the image (as libcernvm names it)
+        bool fetch(HVInstancePtr hv, const std::string& version, const std::string& flavor,
+                   const std::string& arch, std::string& outFile);
+        //Evict the least recently used images until the cache fits into limitBytes.
+        //Images attached to any machine and the keepFile are never evicted
+        bool evict(HVInstancePtr hv, unsigned long long limitBytes, const std::string& keepFile="");
+        //Print the cached images and the total size
+        void print();
+        //Size of the cached images in bytes (an image stored under several names is counted once)
+        unsigned long long totalSize();
+        //Get the cache size limit from the global config (cacheSizeLimitMB), 0 means unlimited
+        static unsigned long long SizeLimit();
+
+    private:
+        typedef std::map<std::string, ImageCacheEntry> entriesType; //keyed by the file name
+
+        bool load();
+        bool store();
+        //Add images which are not in the index yet (e.g. downloaded by an older version)
+        void scanCacheFolder();
+        //Link the file to its object (replacing the file by the object if the content is stored already)
+        bool addFile(const std::string& filename);
+        //Size of the image file (the same as of its object, they are hardlinks)
+        unsigned long long entrySize(const std::string& filename) const;
+        std::string objectPath(const std::string& checksum) const;
+
+        std::string _cacheFolder;
+        std::string _indexFile;
+        entriesType _entries;
+};
+
+} //namespace Launch
+
+#endif //_IMAGE_CACHE_H
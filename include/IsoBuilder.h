@@ -0,0 +1,78 @@
+/**
+ * Builder of small ISO9660 images with Joliet names (used for the context ISOs).
+ * Only the directory tree is kept in memory, contents of the added files are streamed
+ * into the image when it is written.
+ */
+
+#ifndef _ISO_BUILDER_H
+#define _ISO_BUILDER_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace Launch {
+
+class IsoBuilder {
+    public:
+        explicit IsoBuilder(const std::string& volumeId);
+        //Add a file with the content of sourceFile, the file is read when the image is written.
+        //destination: path in the image ('/' separated), directories are created as needed
+        bool addFile(const std::string& destination, const std::string& sourceFile);
+        //Add a file with the given content
+        bool addData(const std::string& destination, const std::string& content);
+        //Write the image, returns false (and prints the reason) on failure
+        bool write(const std::string& isoFile);
+
+    private:
+        struct Node {
+            std::string name;         //name as given (UTF-8)
+            bool isDirectory;
+            size_t parent;            //index of the parent directory (root is its own parent)
+            std::vector<size_t> children;
+            std::string sourceFile;   //file to stream the content from, empty for in-memory data
+            std::string data;
+            uint64_t size;            //file size or the size of the primary directory
+            uint32_t jolietSize;      //size of the Joliet directory
+            uint32_t extent;          //first sector of the file or of the primary directory
+            uint32_t jolietExtent;    //first sector of the Joliet directory (files share the extent)
+            uint16_t number;          //directory number in the primary path table
+            uint16_t jolietNumber;    //directory number in the Joliet path table
+            std::string isoName;      //ISO9660 identifier
+            std::string jolietName;   //Joliet identifier (UCS-2BE)
+        };
+
+        //Create the parent directories of the destination as needed and add the node there
+        bool addNode(const std::string& destination, Node& node);
+        //Give all nodes unique ISO9660 and Joliet identifiers
+        void assignNames();
+        //Directories of the tree in the path table order (by level, parent and name)
+        std::vector<size_t> directoryOrder(bool joliet);
+        //Assign sectors to the path tables, directories and files. Returns the image size in sectors
+        uint32_t layout();
+        void writeVolumeDescriptor(std::ostream& out, bool joliet, uint32_t totalSectors);
+        void writePathTable(std::ostream& out, bool joliet, bool bigEndian);
+        void writeDirectory(std::ostream& out, size_t directory, bool joliet);
+        bool writeFileContent(std::ostream& out, const Node& node);
+        //Directory record of the node, identifier "\0" and "\1" stand for "." and ".."
+        std::string directoryRecord(const Node& node, bool joliet, const std::string& identifier) const;
+        std::vector<size_t> sortedChildren(size_t directory, bool joliet) const;
+        uint32_t pathTableSize(bool joliet) const;
+
+        std::string _volumeId;
+        std::vector<Node> _nodes; //root directory is the first node
+        std::vector<size_t> _directories;        //primary directories in the path table order
+        std::vector<size_t> _jolietDirectories;  //Joliet directories in the path table order
+        std::vector<size_t> _files;              //files in the order of their content in the image
+        uint32_t _pathTableExtent;
+        uint32_t _jolietPathTableExtent;
+        uint32_t _pathTableSectors;
+        uint32_t _jolietPathTableSectors;
+        unsigned char _recordDate[7];
+        std::string _volumeDate;
+};
+
+} //namespace Launch
+
+#endif //_ISO_BUILDER_H
@@ -0,0 +1,27 @@
+/**
+ * Metrics of the machines in the Prometheus text format, written into a file for the textfile
+ * collector of node_exporter: numbers of machines by state, resources of every machine,
+ * size of the image cache and histograms of the operation times (from the stats log).
+ */
+
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <string>
+
+#include "HypervisorContext.h"
+
+namespace Launch {
+namespace Metrics {
+    //Prefix of all metric names
+    const std::string METRIC_PREFIX = "cernvm_launch_";
+
+    //Write the metrics into the file. It is replaced by a rename, so a scrape never reads a half written file
+    bool WriteTextfile(HypervisorContext& ctx, const std::string& filename);
+    //Write the metrics every intervalS seconds (the machines are queried again every time) until the process
+    //is killed, or only once if intervalS is 0
+    bool Export(HypervisorContext& ctx, const std::string& filename, int intervalS);
+} //namespace Metrics
+} //namespace Launch
+
+#endif //_METRICS_H
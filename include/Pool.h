@@ -0,0 +1,36 @@
+/**
+ * Pools of pre-warmed machines: machines created from a profile, booted and saved, so
+ * 'create --from-pool' only renames one of them and resumes it.
+ */
+
+#ifndef _POOL_H
+#define _POOL_H
+
+#include <string>
+
+#include "HypervisorContext.h"
+#include "RequestHandler.h"
+
+namespace Launch {
+namespace Pool {
+    //Folder (in the data folder) with the registered profiles, their locks and refill logs
+    const std::string POOL_FOLDER = "pool";
+    //Session parameters of the pool machines: the profile, and '1' once the machine is booted and saved
+    const std::string POOL_PROFILE_PARAM = "poolProfile";
+    const std::string POOL_READY_PARAM = "poolReady";
+
+    //Fill the pool of the profile up to 'count' ready machines, at most 'parallelism' created at once.
+    //profile: a profile file (registered under its file name without the extension), or a registered profile.
+    //count: 0 keeps the registered size
+    bool Fill(HypervisorContext& ctx, RequestHandler& handler, const std::string& profile, unsigned count,
+              unsigned parallelism);
+    //Print the registered profiles with their ready machines
+    bool Status(HypervisorContext& ctx);
+    //Claim a ready machine of the profile as machineName and resume it (if startMachine). If the pool
+    //is empty, the machine is created from the profile. The pool is refilled in the background
+    bool CreateFromPool(HypervisorContext& ctx, RequestHandler& handler, const std::string& profile,
+                        const std::string& machineName, bool startMachine);
+} //namespace Pool
+} //namespace Launch
+
+#endif //_POOL_H
@@ -0,0 +1,57 @@
+/**
+ * Host ports forwarded to the API ports of the machines. Launch allocates them from one table
+ * in the data folder, shared by all CernVM-Launch processes under a file lock, so machines
+ * created concurrently never get the same port.
+ */
+
+#ifndef _PORT_ALLOCATOR_H
+#define _PORT_ALLOCATOR_H
+
+#include <string>
+#include <vector>
+
+#include "HypervisorContext.h"
+
+namespace Launch {
+namespace PortAllocator {
+    //Table of the allocations (in the data folder), locked by PORTS_FILE.lock
+    const std::string PORTS_FILE = "ports";
+    //Range of the allocated ports (portRangeStart and portRangeEnd in the global config)
+    const int DEFAULT_RANGE_START = 40000;
+    const int DEFAULT_RANGE_END = 49999;
+
+    //Host port allocated to a machine
+    struct Allocation {
+        int port;
+        std::string machineName;
+    };
+
+    //Allocate a free port of the range to the machine, or get the one it already has. Ports used by other
+    //programs are skipped. A missing table is created from the forwarded ports of the existing sessions
+    bool Allocate(HypervisorContext& ctx, const std::string& machineName, int& outPort);
+    //Release the port of the machine (e.g. when it is destroyed)
+    bool Release(const std::string& machineName);
+    //Move the allocation to the new name of the machine
+    bool Rename(const std::string& oldName, const std::string& newName);
+    //Get all allocations (sorted by the port) and the range
+    bool List(HypervisorContext& ctx, std::vector<Allocation>& outAllocations, int& outRangeStart, int& outRangeEnd);
+
+    //Releases the port of a machine being created when it goes out of scope, unless the creation succeeded
+    class ReleaseGuard {
+        public:
+            explicit ReleaseGuard(const std::string& machineName);
+            ~ReleaseGuard();
+            //The machine was created, it keeps its port
+            void keep();
+
+        private:
+            ReleaseGuard(const ReleaseGuard&);
+            ReleaseGuard& operator=(const ReleaseGuard&);
+
+            std::string _machineName;
+            bool _keep;
+    };
+} //namespace PortAllocator
+} //namespace Launch
+
+#endif //_PORT_ALLOCATOR_H
@@ -0,0 +1,31 @@
+/**
+ * Running a command on several machines over SSH, with the connections of every machine
+ * multiplexed by one OpenSSH master (ControlMaster), which outlives the command for a while.
+ */
+
+#ifndef _REMOTE_EXEC_H
+#define _REMOTE_EXEC_H
+
+#include <string>
+#include <vector>
+
+#include "HypervisorContext.h"
+
+namespace Launch {
+namespace RemoteExec {
+    //Folder (in the data folder) with the control sockets of the SSH masters
+    const std::string SSH_FOLDER = "ssh";
+    //How long an idle SSH master is kept, in seconds (sshControlPersistSeconds in the global config, 0 disables it)
+    const int DEFAULT_CONTROL_PERSIST_S = 600;
+
+    //Run the command as the user on the running machines, over SSH to their forwarded API ports,
+    //at most 'parallelism' machines at once. The words of the command are joined by spaces and run
+    //by the shell of the machine (as by ssh). The output of every machine is printed in one block
+    //when its command finishes. Returns true if the command succeeded on all machines.
+    //Not supported on Windows
+    bool Run(HypervisorContext& ctx, const std::vector<std::string>& machineNames, const std::string& user,
+             const std::vector<std::string>& command, unsigned parallelism);
+} //namespace RemoteExec
+} //namespace Launch
+
+#endif //_REMOTE_EXEC_H
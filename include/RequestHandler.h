@@ -6,8 +6,12 @@
 #ifndef _REQUEST_HANDLER_H
 #define _REQUEST_HANDLER_H
 
+#include <functional>
 #include <string>
+#include <vector>
 
+#include "ContextIso.h"
+#include "HypervisorContext.h"
 #include "Tools.h"
 
 namespace Launch {
@@ -27,36 +31,97 @@ const std::string DEFAULT_USER_DATA = \
 "keyboard=us-acentos\n"
 "startXDM=on\n";
 
+//Snapshot of a base machine, from which linked clones are created
+const std::string GOLDEN_SNAPSHOT = "launch-golden";
+
+//Operation on a single machine (e.g. a bound startMachine call), returns true on success
+typedef std::function<bool (const std::string& machineName)> machineOperationType;
+
 //Handles user requests, providing appropriate response.
 //All of the methods return true on success, false otherwise.
+//The hypervisor, sessions and running machines are taken from the given per-command context.
 class RequestHandler {
     public:
         //Check if a given machine is running
-        bool isMachineRunning(const std::string& machineName);
+        bool isMachineRunning(HypervisorContext& ctx, const std::string& machineName);
         //List existing CernVM machines
-        bool listCvmMachines();
+        bool listCvmMachines(HypervisorContext& ctx);
         //List only running CernVM machines
-        bool listRunningCvmMachines();
+        bool listRunningCvmMachines(HypervisorContext& ctx);
+        //List the cached CernVM images
+        bool listCachedImages();
         //List details (information) about given machine
-        bool listMachineDetail(const std::string& machineName);
+        bool listMachineDetail(HypervisorContext& ctx, const std::string& machineName);
+        //List machines as a JSON array with all parameters, local fields, forwarded ports and the running state.
+        //Every machine is written to stdout as soon as it is processed.
+        //runningOnly: only running machines, machineName: only the given machine (empty for all)
+        bool listMachinesJson(HypervisorContext& ctx, bool runningOnly, const std::string& machineName);
+        //List the host ports allocated to the machines (see PortAllocator), with the allocations of machines
+        //which do not exist anymore. runningOnly: only running machines, machineName: only the given machine
+        bool listPortAllocations(HypervisorContext& ctx, bool runningOnly, const std::string& machineName);
         //Create a new VM.
         //userDataFile: contextualization file
         //startMachine: whether to start the machine after creation
-        //params: parameter map with creation parameters
-        bool createMachine(const std::string& userDataFile, bool startMachine, Tools::configMapType& params);
+        //params: creation parameters (from the parameter file and the command line)
+        //contextFiles: extra files added to the context ISO
+        bool createMachine(HypervisorContext& ctx, const std::string& userDataFile, bool startMachine,
+                           Config& params,
+                           const std::vector<ContextIso::ContextFile>& contextFiles = std::vector<ContextIso::ContextFile>());
+        //Create 'count' machines with the same parameters, named namePrefix-1, namePrefix-2, ...
+        //(names of existing machines are skipped). At most 'parallelism' machines are created at once.
+        //Prints a per-machine summary, returns true only if all machines were created
+        bool createMachines(HypervisorContext& ctx, const std::string& userDataFile, bool startMachine,
+                            Config& params, unsigned count, const std::string& namePrefix,
+                            unsigned parallelism,
+                            const std::vector<ContextIso::ContextFile>& contextFiles = std::vector<ContextIso::ContextFile>());
+        //Create a new VM as a linked clone of the golden snapshot of baseName (see goldenMachine).
+        //Only name, cpus and memory can be given in params, everything else is taken from the base
+        bool createLinkedClone(HypervisorContext& ctx, const std::string& baseName, bool startMachine,
+                               Config& params);
+        //Take the golden snapshot of a stopped machine, so it can be used as a base of linked clones
+        bool goldenMachine(HypervisorContext& ctx, const std::string& machineName);
         //Import an OVA image
-        bool importMachine(const std::string& imageFilename, bool startMachine, Tools::configMapType& params);
+        bool importMachine(HypervisorContext& ctx, const std::string& imageFilename, bool startMachine,
+                           Config& params);
         //Destroy a machine. By default, it does not destroy a running machine, use force=true for that
-        bool destroyMachine(const std::string& machineName, bool force=false);
+        bool destroyMachine(HypervisorContext& ctx, const std::string& machineName, bool force=false);
+        //Destroy several machines concurrently. Without force, the user is asked only once
+        //about all of the running machines (declined ones are skipped)
+        bool destroyMachines(HypervisorContext& ctx, const std::vector<std::string>& machineNames, bool force,
+                             unsigned parallelism);
+        //Run the operation for every machine, at most 'parallelism' at once. With more than one machine,
+        //a per-machine result is printed. Returns true only if the operation succeeded for all machines
+        bool forEachMachine(const std::vector<std::string>& machineNames, const machineOperationType& operation,
+                            unsigned parallelism);
+        //List the snapshots of the machine, the current one is marked
+        bool listSnapshots(HypervisorContext& ctx, const std::string& machineName);
         //Pause machine
-        bool pauseMachine(const std::string& machineName);
+        bool pauseMachine(HypervisorContext& ctx, const std::string& machineName);
+        //Download the CernVM images of the given versions into the image cache (if not cached yet)
+        bool prefetchImages(HypervisorContext& ctx, const std::vector<std::string>& versions,
+                            const std::string& flavor, const std::string& arch);
+        //Expand the machine names and glob patterns (e.g. 'ci-*') into names of existing machines.
+        //Plain names are used as they are, a pattern matching no machine is an error.
+        //all: take all existing machines (patterns must be empty)
+        bool resolveMachineNames(HypervisorContext& ctx, const std::vector<std::string>& patterns, bool all,
+                                 std::vector<std::string>& outNames);
+        //Restore the machine to the snapshot. A running machine is powered off (its state is discarded),
+        //restored and started again, so it resumes the state of a snapshot taken while it was running
+        bool restoreMachine(HypervisorContext& ctx, const std::string& machineName, const std::string& tag);
+        //Take a snapshot of the machine (a live one, if the machine is running). A snapshot with the same tag is replaced
+        bool snapshotMachine(HypervisorContext& ctx, const std::string& machineName, const std::string& tag);
         //SSH into machine. It find an SSH executable and replaces cernvm-launch binary
         //with this binary (execv). Does not work on Windows.
-        bool sshIntoMachine(const std::string& login);
+        //waitReady: wait for the SSH server of the machine first (see waitForReady)
+        bool sshIntoMachine(HypervisorContext& ctx, const std::string& login, bool waitReady=false);
         //Start machine. The machine can be either paused or stopped
-        bool startMachine(const std::string& machineName);
+        bool startMachine(HypervisorContext& ctx, const std::string& machineName);
         //Stop machine. Saves the state, does not do a power off
-        bool stopMachine(const std::string& machineName);
+        bool stopMachine(HypervisorContext& ctx, const std::string& machineName);
+        //Wait until the SSH server of a running machine answers on its forwarded API port and print
+        //the time of the wait and since the machine was started.
+        //timeoutMs: deadline of the wait, negative for readyTimeoutMs of the global config
+        bool waitForReady(HypervisorContext& ctx, const std::string& machineName, int timeoutMs=-1);
 };
 
 } //namespace Launch
@@ -0,0 +1,42 @@
+/**
+ * Exponential backoff with jitter under an overall deadline, for operations
+ * waiting for VirtualBox to release a machine.
+ */
+
+#ifndef _RETRY_POLICY_H
+#define _RETRY_POLICY_H
+
+#include <chrono>
+#include <random>
+#include <string>
+
+namespace Launch {
+
+class RetryPolicy {
+    public:
+        //initialDelayMs: first delay, doubled after every wait up to maxDelayMs.
+        //timeoutMs: overall deadline, counted from the construction
+        RetryPolicy(int initialDelayMs, int maxDelayMs, int timeoutMs);
+        //Create the policy from the global config keys PREFIXRetryInitialMs, PREFIXRetryMaxMs and PREFIXTimeoutMs,
+        //given values are used for missing (or invalid) keys
+        static RetryPolicy FromConfig(const std::string& prefix, int initialDelayMs, int maxDelayMs, int timeoutMs);
+        //Sleep before the next attempt (a random delay between half and the full current delay,
+        //shortened to the deadline). Returns false without sleeping if the deadline has passed
+        bool backoff();
+        //Milliseconds since the construction
+        long long elapsedMs() const;
+        //Number of backoff() calls which slept
+        int waits() const;
+
+    private:
+        std::chrono::steady_clock::time_point _start;
+        std::chrono::steady_clock::time_point _deadline;
+        int _delayMs;
+        int _maxDelayMs;
+        int _waits;
+        std::mt19937 _random;
+};
+
+} //namespace Launch
+
+#endif //_RETRY_POLICY_H
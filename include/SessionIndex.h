@@ -0,0 +1,52 @@
+/**
+ * Compact on-disk index of the stored sessions, so listing the machines does not need
+ * to load and parse every session file. The index is invalidated by the modification
+ * times of the run folder and of the files in it.
+ */
+
+#ifndef _SESSION_INDEX_H
+#define _SESSION_INDEX_H
+
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace Launch {
+
+//Session index file name, stored in the data folder (outside of the run folder it watches)
+const std::string SESSION_INDEX_FILENAME = "session.index";
+
+//Information about one machine stored in the index
+struct SessionIndexEntry {
+    std::string name;
+    std::string cernvmVersion;
+    std::string apiPort;
+    std::string baseFolder;
+};
+
+class SessionIndex {
+    public:
+        //runFolder: folder with the libcernvm session files, indexFile: where the index is stored
+        SessionIndex(const std::string& runFolder, const std::string& indexFile);
+        //Load the index file. Returns false if it is missing, corrupted or stale
+        bool load();
+        //Replace the entries and store the index file, stamped with the current state of the run folder
+        bool store(const std::vector<SessionIndexEntry>& entries);
+        //Entries loaded or stored by the last successful call
+        const std::vector<SessionIndexEntry>& entries() const;
+
+    private:
+        typedef std::map<std::string, std::time_t> fileStampsType;
+
+        //Get modification times of the run folder and of the regular files in it
+        bool scanRunFolder(std::time_t& outFolderStamp, fileStampsType& outFileStamps) const;
+
+        std::string _runFolder;
+        std::string _indexFile;
+        std::vector<SessionIndexEntry> _entries;
+};
+
+} //namespace Launch
+
+#endif //_SESSION_INDEX_H
@@ -0,0 +1,80 @@
+/**
+ * History of the operations on machines (create, start, resume, stop, destroy, ...) and their
+ * phases, kept in an append-only log in the data folder, and the latency statistics built from it.
+ */
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "HypervisorContext.h"
+
+namespace Launch {
+namespace Stats {
+    //Log of the operations (in the data folder). When it grows over MAX_LOG_SIZE, it is moved
+    //to STATS_FILE.1 (replacing the older one) and a new log is started
+    const std::string STATS_FILE = "stats.log";
+    const long long MAX_LOG_SIZE = 8 * 1024 * 1024;
+    //A version needs this many successful operations to be compared with the previous one
+    const size_t MIN_REGRESSION_SAMPLES = 5;
+    //Slowdown of the median (in percent) reported as a regression (statsRegressionPercent in the global config)
+    const int DEFAULT_REGRESSION_PERCENT = 20;
+
+    //One logged operation
+    struct Record {
+        long long timestamp; //seconds since the epoch, when the operation finished
+        std::string operation;
+        std::string machineName;
+        bool success;
+        long long durationMs;
+        std::string cernvmVersion;
+        std::string hypervisorVersion;
+        std::map<std::string, long long> phasesMs; //phase (trace span) name -> duration
+    };
+
+    //Records an operation on a machine from the construction to the destruction, with the phases
+    //(Trace spans) finished on the same thread meanwhile. The record is appended to the log on
+    //destruction, as failed unless succeeded() was called. Disabled by statsLog=0 in the global config
+    class Operation {
+        public:
+            //The CernVM version is taken from the session of the machine (if it exists)
+            Operation(HypervisorContext& ctx, const std::string& name, const std::string& machineName);
+            ~Operation();
+            //Change the name (e.g. 'start' is 'resume' for a saved machine)
+            void setName(const std::string& name);
+            //Set the CernVM version of a machine which has no session yet
+            void setCernVMVersion(const std::string& version);
+            void succeeded();
+            //Do not log the operation (e.g. it was declined by the user)
+            void cancel();
+            void addPhase(const std::string& name, long long durationUs);
+
+        private:
+            Operation(const Operation&);
+            Operation& operator=(const Operation&);
+
+            Record _record;
+            long long _startUs;
+            bool _enabled;
+            bool _cancelled;
+    };
+
+    //Check if some operation is being recorded (Trace measures the spans then, even if it is disabled)
+    bool IsRecording();
+    //Add the phase finished on the current thread to the operations recorded by the thread
+    void AddPhase(const std::string& name, long long durationUs);
+    //Load the records of the log (and of the rotated one), oldest first
+    bool LoadRecords(std::vector<Record>& outRecords);
+    //Nearest-rank percentile (0-100) of the values, which are sorted in place. Returns 0 for no values
+    long long Percentile(std::vector<long long>& values, int percentile);
+    //Print p50/p95/p99 of the successful operations, per operation and per CernVM version,
+    //and the operations which got slower with the current VirtualBox or CernVM version.
+    //operation: only the given operation (empty for all)
+    bool Print(const std::string& operation);
+} //namespace Stats
+} //namespace Launch
+
+#endif //_STATS_H
@@ -12,44 +12,59 @@
 
 #include <CernVM/ParameterMap.h>
 
-
-//Configuration file defines
-#define KEY_VALUE_SEPARATOR '='
-#define COMMENT_CHAR        '#'
+#include "Config.h"
 
 namespace Launch {
 namespace Tools {
     // All methods return true on success, false otherwise.
 
     typedef std::map<const std::string, const std::string>  configMapType;
-    typedef std::map<const std::string, const std::string>* configMapTypePtr;
 
-    //Go through sourceMap and add values, which are not already present in the outMap
-    void             AddMissingValuesToMap(configMapType& outMap, const configMapType& sourceMap);
+    //Escape the string, so it can be used as a JSON string value (without the quotes)
+    std::string      EscapeJson(const std::string& str);
     //Create a default global config file
     bool             CreateDefaultGlobalConfig();
-    //Returns a singleton instance of global config map. Of the first call it tries to load it
-    configMapTypePtr GetGlobalConfig();
+    //Returns a singleton instance of global config. On the first call it tries to load it
+    //(or create a default one), returns NULL if it cannot be loaded
+    Config*          GetGlobalConfig();
+    //Returns the folder where libcernvm and CernVM-Launch keep their files (a subdirectory of launchHomeFolder)
+    std::string      GetDataFolder();
+    //Path to the running executable, empty if it cannot be found
+    std::string      GetExecutablePath();
     //Prompts user for a value (terminated by Enter) and stores it outValue
     bool             GetUserInput(std::string& outValue);
     //Check if given path is absolute
     bool             IsAbsolutePath(const std::string& path);
     //Check if given path is canonical
     bool             IsCanonicalPath(const std::string& path);
+    //Check if the string contains glob wildcards ('*', '?' or '[')
+    bool             IsGlobPattern(const std::string& str);
+    //Check if the TCP port on the loopback is free right now (it can be bound)
+    bool             IsTcpPortFree(int port);
     //Make absolute path from a given relative one
     bool             MakeAbsolutePath(const std::string& path, std::string& outPath);
-    //Load the global config file.
-    bool             LoadGlobalConfig(std::map<const std::string, const std::string>& outMap);
-    //Load given file into the outMap
-    //Expected format is key=value
-    //Comments (line starting with '#') and empty values are ignored
-    bool             LoadFileIntoMap(const std::string& filename, std::map<const std::string, const std::string>& outMap);
+    //Match the whole string against a glob pattern: '*' (any sequence), '?' (any character)
+    //and '[...]' (character set, ranges like 'a-z' and negation by '!' are supported)
+    bool             MatchGlob(const std::string& pattern, const std::string& str);
+    //Load the global config file into the global layer of the config
+    bool             LoadGlobalConfig(Config& outConfig);
     //Load given file into a string
     bool             LoadFileIntoString(const std::string& filename, std::string& output);
+    //Parse the whole string as a decimal integer
+    bool             ParseInt(const std::string& str, int& outValue);
+    bool             ParseInt(const std::string& str, long long& outValue);
     //Print specified fields from the given paramMap
     void             PrintParameters(const std::vector<std::string>& fields, const ParameterMapPtr paramMap);
+    //Check if an SSH server answers on the loopback port (its banner starts with 'SSH-') within timeoutMs.
+    //VirtualBox accepts forwarded connections before the guest is up, so a successful connect is not enough.
+    //The connect is non-blocking, so a port which does not answer takes at most timeoutMs
+    bool             ProbeSshPort(int port, int timeoutMs);
+    //Quote the argument for the shell (e.g. of popen or system)
+    std::string      QuoteArgument(const std::string& arg);
     //Set additional binary mask flags in the given string
     bool             SetFlagsInString(std::string& flagsStr, int additionalFlags);
+    //Run the program (args[0]) in the background, detached from this process. Its output is appended to logFile
+    bool             SpawnDetached(const std::vector<std::string>& args, const std::string& logFile);
 
     std::vector<std::string> SplitString(const std::string &str, const char delim,
                                          const unsigned max_chunks);
@@ -0,0 +1,40 @@
+/**
+ * Recording of per-phase timings (spans), written in the Chrome trace-event format,
+ * so they can be loaded into a trace viewer (chrome://tracing, Perfetto).
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <string>
+
+namespace Launch {
+namespace Trace {
+    //Start recording spans. They are written into the given file when the program exits
+    void Enable(const std::string& filename);
+    //Check if the spans are recorded
+    bool IsEnabled();
+    //Write all recorded spans into the trace file (called automatically on exit)
+    bool Flush();
+
+    //Records a span from its construction to its destruction (if tracing is enabled), it is also
+    //a phase of the operations recorded by Stats on the same thread.
+    //Spans can be nested and recorded from several threads
+    class Span {
+        public:
+            //name: phase name, detail: optional argument shown with the span (e.g. machine name)
+            explicit Span(const std::string& name, const std::string& detail="");
+            ~Span();
+
+        private:
+            Span(const Span&);
+            Span& operator=(const Span&);
+
+            std::string _name;
+            std::string _detail;
+            long long   _startUs;
+    };
+} //namespace Trace
+} //namespace Launch
+
+#endif //_TRACE_H
@@ -0,0 +1,30 @@
+/**
+ * Direct VBoxManage invocations, for the few operations libcernvm does not provide.
+ */
+
+#ifndef _VBOXMANAGE_H
+#define _VBOXMANAGE_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <CernVM/Hypervisor.h>
+
+namespace Launch {
+namespace VBoxManage {
+    typedef std::map<std::string, std::string> vmInfoType;
+
+    //Run VBoxManage of the given hypervisor. Standard output and error output are stored
+    //line by line in outLines (if given). Returns the exit code, -1 if VBoxManage cannot be run
+    int  Run(HVInstancePtr hv, const std::vector<std::string>& args, std::vector<std::string>* outLines=NULL);
+    //Get 'showvminfo --machinereadable' of a machine (name or UUID) as key/value pairs (unquoted).
+    //Returns false if the machine is not registered or VBoxManage failed, outNotFound (if given)
+    //tells the first case apart (VirtualBox does not know the machine)
+    bool GetVMInfo(HVInstancePtr hv, const std::string& machine, vmInfoType& outInfo, bool* outNotFound=NULL);
+    //Identifier of the session's machine in VirtualBox (its UUID, or the name if unknown)
+    std::string GetMachineId(HVSessionPtr session);
+} //namespace VBoxManage
+} //namespace Launch
+
+#endif //_VBOXMANAGE_H
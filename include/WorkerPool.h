@@ -0,0 +1,28 @@
+/**
+ * Bounded pool of worker threads for operations on several machines at once.
+ */
+
+#ifndef _WORKER_POOL_H
+#define _WORKER_POOL_H
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+namespace Launch {
+namespace WorkerPool {
+    //Used when no parallelism is given on the command line, nor in the global config
+    const unsigned DEFAULT_PARALLELISM = 4;
+
+    //Job of the pool, gets the index of the item to process. Returns true on success
+    typedef std::function<bool (size_t)> jobType;
+
+    //Get the parallelism from the global config ('parallelism' key), or the default one
+    unsigned DefaultParallelism();
+    //Run the job for every index in [0, jobCount) on at most 'parallelism' threads and wait for all of them.
+    //Returns the result of every job (a job throwing an exception failed)
+    std::vector<bool> Run(size_t jobCount, unsigned parallelism, const jobType& job);
+} //namespace WorkerPool
+} //namespace Launch
+
+#endif //_WORKER_POOL_H
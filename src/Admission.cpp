@@ -0,0 +1,315 @@
+/**
+ * Admission control of starting machines.
+ */
+
+#include <cerrno>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <signal.h>
+#include <unistd.h>
+#endif
+#ifdef __APPLE__
+#include <sys/sysctl.h>
+#endif
+
+#include <boost/filesystem.hpp>
+
+#include "Admission.h"
+#include "FileLock.h"
+#include "RetryPolicy.h"
+#include "Tools.h"
+#include "VBoxManage.h"
+
+
+namespace Launch {
+namespace Admission {
+
+//helper functions and definitions in an anonymous namespace (local)
+namespace {
+
+const std::string LOCK_FILENAME = "admission.lock";
+const std::string RESERVATION_EXTENSION = ".res";
+//Defaults of the waiting (admissionRetryInitialMs and admissionRetryMaxMs in the global config)
+const int RETRY_INITIAL_MS = 500;
+const int RETRY_MAX_MS = 5000;
+
+//Memory and CPUs used by machines
+struct Usage {
+    long long memoryMB;
+    long long cpus;
+};
+
+long long CurrentPid();
+bool IsProcessAlive(long long pid);
+//Sum the memory and CPUs of the running machines (except machineName)
+bool GetRunningUsage(HypervisorContext& ctx, const std::string& machineName, Usage& outUsage);
+//Sum the reservations of living processes, remove the other ones
+void GetReservedUsage(const boost::filesystem::path& folder, Usage& outUsage);
+//Get a positive number from the global config (validated when the config is loaded)
+int GetConfigInt(const std::string& key, int defaultValue);
+
+} //anonymous namespace
+
+
+Reservation::Reservation() {
+}
+
+
+Reservation::~Reservation() {
+    release();
+}
+
+
+void Reservation::release() {
+    if (_file.empty())
+        return;
+    boost::system::error_code ec;
+    boost::filesystem::remove(_file, ec);
+    _file.clear();
+}
+
+
+bool IsEnabled() {
+    Config* config = Tools::GetGlobalConfig();
+    return !config || config->getBool("admissionControl", true);
+}
+
+
+bool GetHostCapacity(HostCapacity& outCapacity) {
+    outCapacity.memoryMB = 0;
+    outCapacity.availableMemoryMB = -1;
+    outCapacity.cpus = std::thread::hardware_concurrency();
+
+#if defined(_WIN32)
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if (GlobalMemoryStatusEx(&status)) {
+        outCapacity.memoryMB = status.ullTotalPhys / (1024 * 1024);
+        outCapacity.availableMemoryMB = status.ullAvailPhys / (1024 * 1024);
+    }
+#elif defined(__APPLE__)
+    unsigned long long memSize = 0;
+    size_t len = sizeof(memSize);
+    if (sysctlbyname("hw.memsize", &memSize, &len, NULL, 0) == 0)
+        outCapacity.memoryMB = memSize / (1024 * 1024);
+#else
+    //e.g. 'MemTotal:       16318412 kB'
+    std::ifstream ifs("/proc/meminfo");
+    for (std::string line; std::getline(ifs, line); ) {
+        std::istringstream iss(line);
+        std::string key;
+        long long valueKB = 0;
+        if (!(iss >> key >> valueKB))
+            continue;
+        if (key == "MemTotal:")
+            outCapacity.memoryMB = valueKB / 1024;
+        else if (key == "MemAvailable:")
+            outCapacity.availableMemoryMB = valueKB / 1024;
+    }
+#endif
+
+    return outCapacity.memoryMB > 0 && outCapacity.cpus > 0;
+}
+
+
+bool Admit(HypervisorContext& ctx, const std::string& machineName, int memoryMB, int cpus,
+           Reservation& outReservation) {
+    if (!IsEnabled())
+        return true;
+
+    HostCapacity host;
+    if (!GetHostCapacity(host)) {
+        std::cerr << "Unable to get the host capacity, admission control is skipped\n";
+        return true;
+    }
+    int memoryPercent = GetConfigInt("memoryOvercommitPercent", DEFAULT_MEMORY_OVERCOMMIT_PERCENT);
+    int cpuPercent = GetConfigInt("cpuOvercommitPercent", DEFAULT_CPU_OVERCOMMIT_PERCENT);
+    long long memoryLimit = host.memoryMB * memoryPercent / 100;
+    long long cpuLimit = static_cast<long long>(host.cpus) * cpuPercent / 100;
+
+    if (memoryMB > memoryLimit || cpus > cpuLimit) {
+        std::cerr << machineName << ": not admitted, it needs " << memoryMB << " MB and " << cpus
+                  << " CPUs, the host limit is " << memoryLimit << " MB and " << cpuLimit << " CPUs\n";
+        return false;
+    }
+
+    boost::filesystem::path folder = boost::filesystem::path(Tools::GetDataFolder()) / ADMISSION_FOLDER;
+    boost::system::error_code ec;
+    boost::filesystem::create_directories(folder, ec);
+    if (ec) {
+        std::cerr << "Unable to create the admission folder: " << folder.string() << std::endl;
+        return false;
+    }
+
+    RetryPolicy policy = RetryPolicy::FromConfig("admission", RETRY_INITIAL_MS, RETRY_MAX_MS, DEFAULT_TIMEOUT_MS);
+    bool waiting = false;
+    while (true) {
+        std::ostringstream reason;
+        {
+            //the check and the reservation are atomic for all processes using the data folder
+            FileLock lock((folder / LOCK_FILENAME).string());
+            if (!lock.locked())
+                return false;
+
+            Usage running = {0, 0};
+            Usage reserved = {0, 0};
+            if (!GetRunningUsage(ctx, machineName, running))
+                return false;
+            GetReservedUsage(folder, reserved);
+            long long usedMemory = running.memoryMB + reserved.memoryMB;
+            long long usedCpus = running.cpus + reserved.cpus;
+
+            if (usedMemory + memoryMB > memoryLimit)
+                reason << usedMemory << " MB of " << memoryLimit << " MB used, " << memoryMB << " MB needed";
+            else if (usedCpus + cpus > cpuLimit)
+                reason << usedCpus << " of " << cpuLimit << " CPUs used, " << cpus << " needed";
+            //without overcommit, the memory must be free as well (other programs and users use it too)
+            else if (memoryPercent <= 100 && host.availableMemoryMB >= 0
+                     && reserved.memoryMB + memoryMB > host.availableMemoryMB)
+                reason << host.availableMemoryMB << " MB available, " << reserved.memoryMB + memoryMB << " MB needed";
+            else {
+                std::ostringstream filename;
+                filename << CurrentPid() << "-" << machineName << RESERVATION_EXTENSION;
+                std::string file = (folder / filename.str()).string();
+                std::ofstream ofs(file.c_str());
+                ofs << memoryMB << " " << cpus << std::endl;
+                if (ofs.good())
+                    outReservation._file = file;
+                else //the machine is admitted, but concurrent starts may not see it
+                    std::cerr << "Unable to write the reservation: " << file << std::endl;
+                return true;
+            }
+        }
+
+        if (!waiting) {
+            std::cout << machineName << ": waiting for host resources (" << reason.str() << ")\n";
+            waiting = true;
+        }
+        if (!policy.backoff()) {
+            std::cerr << machineName << ": not admitted after " << policy.elapsedMs() / 1000
+                      << " s, the host has not enough resources (" << reason.str() << ")\n";
+            return false;
+        }
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+// Local helper functions
+//-----------------------------------------------------------------------------
+namespace {
+
+#ifdef _WIN32
+long long CurrentPid() {
+    return GetCurrentProcessId();
+}
+
+
+bool IsProcessAlive(long long pid) {
+    HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, static_cast<DWORD>(pid));
+    if (!process)
+        return GetLastError() == ERROR_ACCESS_DENIED; //a process of another user
+    bool alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+    CloseHandle(process);
+    return alive;
+}
+#else
+long long CurrentPid() {
+    return getpid();
+}
+
+
+bool IsProcessAlive(long long pid) {
+    return kill(static_cast<pid_t>(pid), 0) == 0 || errno == EPERM;
+}
+#endif
+
+
+bool GetRunningUsage(HypervisorContext& ctx, const std::string& machineName, Usage& outUsage) {
+    HVInstancePtr hv = ctx.hypervisor();
+    if (!hv)
+        return false;
+
+    //machines may have been started or stopped by other processes while we were waiting
+    runningSetType running;
+    std::map<std::string, HVSessionPtr> sessions;
+    {
+        std::lock_guard<std::recursive_mutex> lock(ctx.mutex());
+        ctx.invalidateRunningMachines();
+        const runningSetType* runningVms = ctx.runningMachines();
+        if (!runningVms)
+            return false;
+        running = *runningVms;
+
+        sessionMapType allSessions = ctx.sessions();
+        for (sessionMapType::const_iterator it = allSessions.begin(); it != allSessions.end(); ++it)
+            sessions[it->second->parameters->get("name", "")] = it->second;
+    }
+
+    for (runningSetType::const_iterator it = running.begin(); it != running.end(); ++it) {
+        if (*it == machineName)
+            continue;
+
+        int memory = 0, cpus = 0;
+        std::map<std::string, HVSessionPtr>::const_iterator session = sessions.find(*it);
+        if (session != sessions.end()) {
+            Tools::ParseInt(session->second->parameters->get("memory", ""), memory);
+            Tools::ParseInt(session->second->parameters->get("cpus", ""), cpus);
+        }
+        else { //not our session (e.g. created by another process, or not by CernVM-Launch at all)
+            VBoxManage::vmInfoType info;
+            if (VBoxManage::GetVMInfo(hv, *it, info)) {
+                Tools::ParseInt(info["memory"], memory);
+                Tools::ParseInt(info["cpus"], cpus);
+            }
+        }
+        outUsage.memoryMB += memory;
+        outUsage.cpus += cpus;
+    }
+    return true;
+}
+
+
+void GetReservedUsage(const boost::filesystem::path& folder, Usage& outUsage) {
+    boost::system::error_code ec;
+    for (boost::filesystem::directory_iterator it(folder, ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->path().extension() != RESERVATION_EXTENSION)
+            continue;
+
+        //PID-MACHINE_NAME.res
+        long long pid = 0;
+        std::istringstream(it->path().filename().string()) >> pid;
+        if (pid <= 0 || !IsProcessAlive(pid)) { //left by a process which was killed
+            boost::system::error_code removeEc;
+            boost::filesystem::remove(it->path(), removeEc);
+            continue;
+        }
+
+        long long memory = 0, cpus = 0;
+        std::ifstream ifs(it->path().string().c_str());
+        if (ifs >> memory >> cpus) {
+            outUsage.memoryMB += memory;
+            outUsage.cpus += cpus;
+        }
+    }
+}
+
+
+int GetConfigInt(const std::string& key, int defaultValue) {
+    Config* config = Tools::GetGlobalConfig();
+    if (!config)
+        return defaultValue;
+    return config->getInt(key, defaultValue);
+}
+
+} //anonymous namespace
+
+} //namespace Admission
+} //namespace Launch
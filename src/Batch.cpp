@@ -0,0 +1,183 @@
+/**
+ * Batch mode: several commands (one per line of a script) handled by one process.
+ */
+
+#include <fstream>
+#include <iostream>
+#include <mutex>
+
+#include "Batch.h"
+#include "Trace.h"
+#include "WorkerPool.h"
+
+
+namespace Launch {
+namespace Batch {
+
+//helper functions and definitions in an anonymous namespace (local)
+namespace {
+
+//Program name passed as argv[0] to the dispatcher
+const std::string PROGRAM_NAME = "cernvm-launch";
+
+//Commands which cannot be nested in a batch (they run until stopped, or need the terminal)
+const std::vector<std::string> ForbiddenCommands = {
+    "batch",
+    "daemon",
+    "metrics",
+    "ssh",
+};
+
+//Command of a batch line
+struct BatchCommand {
+    unsigned lineNumber;
+    std::string line;
+    std::vector<std::string> words;
+};
+
+//Read the commands, print the parse errors and return false if there are any
+bool ReadCommands(std::istream& is, const std::string& origin, std::vector<BatchCommand>& outCommands);
+
+} //anonymous namespace
+
+
+bool SplitCommandLine(const std::string& line, std::vector<std::string>& outWords) {
+    std::string word;
+    bool inWord = false;
+    char quote = 0;
+
+    for (size_t i=0; i < line.size(); ++i) {
+        char c = line[i];
+        if (quote) {
+            if (c == quote)
+                quote = 0;
+            else if (c == '\\' && quote == '"' && i+1 < line.size())
+                word.push_back(line[++i]);
+            else
+                word.push_back(c);
+        }
+        else if (c == '\'' || c == '"') {
+            quote = c;
+            inWord = true;
+        }
+        else if (c == '\\' && i+1 < line.size()) {
+            word.push_back(line[++i]);
+            inWord = true;
+        }
+        else if (c == ' ' || c == '\t' || c == '\r') {
+            if (inWord)
+                outWords.push_back(word);
+            word.clear();
+            inWord = false;
+        }
+        else {
+            word.push_back(c);
+            inWord = true;
+        }
+    }
+
+    if (quote) {
+        std::cerr << "Unterminated quote: " << quote << std::endl;
+        return false;
+    }
+    if (inWord)
+        outWords.push_back(word);
+    return true;
+}
+
+
+bool Run(const std::string& filename, unsigned parallelism, HypervisorContext& ctx, RequestHandler& handler,
+         dispatchFuncType dispatch) {
+    std::vector<BatchCommand> commands;
+    if (filename == "-") {
+        if (!ReadCommands(std::cin, "stdin", commands))
+            return false;
+    }
+    else {
+        std::ifstream ifs(filename.c_str());
+        if (!ifs.good()) {
+            std::cerr << "Unable to open the batch file: " << filename << std::endl;
+            return false;
+        }
+        if (!ReadCommands(ifs, filename, commands))
+            return false;
+    }
+
+    std::mutex outputMutex;
+    std::vector<bool> results = WorkerPool::Run(commands.size(), parallelism, [&](size_t index) {
+        const BatchCommand& command = commands[index];
+        Trace::Span span("batch", command.line);
+
+        //the dispatcher gets its own copy of the words, as in main()
+        std::vector<std::string> words = command.words;
+        std::vector<char*> args;
+        for (size_t i=0; i < words.size(); ++i)
+            args.push_back(&words[i][0]);
+        args.push_back(NULL);
+
+        int exitCode = dispatch(args.size() - 1, &args[0], ctx, handler);
+
+        std::lock_guard<std::mutex> lock(outputMutex);
+        std::cout << "[" << command.lineNumber << "] ";
+        if (exitCode == 0)
+            std::cout << "OK: ";
+        else
+            std::cout << "FAILED (" << exitCode << "): ";
+        std::cout << command.line << std::endl;
+        return exitCode == 0;
+    });
+
+    size_t failed = 0;
+    for (size_t i=0; i < results.size(); ++i)
+        failed += results[i] ? 0 : 1;
+    if (failed) {
+        std::cerr << failed << " of " << commands.size() << " commands failed\n";
+        return false;
+    }
+    return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Local helper functions
+//-----------------------------------------------------------------------------
+namespace {
+
+bool ReadCommands(std::istream& is, const std::string& origin, std::vector<BatchCommand>& outCommands) {
+    bool success = true;
+    unsigned lineNumber = 0;
+
+    for (std::string line; std::getline(is, line); ) {
+        ++lineNumber;
+        BatchCommand command;
+        command.lineNumber = lineNumber;
+        command.words.push_back(PROGRAM_NAME);
+        if (!SplitCommandLine(line, command.words)) {
+            std::cerr << origin << ":" << lineNumber << ": invalid command\n";
+            success = false;
+            continue;
+        }
+        if (command.words.size() == 1 || command.words[1][0] == '#') //an empty line or a comment
+            continue;
+
+        for (size_t i=0; i < ForbiddenCommands.size(); ++i) {
+            if (command.words[1] == ForbiddenCommands[i]) {
+                std::cerr << origin << ":" << lineNumber << ": '" << command.words[1]
+                          << "' cannot be used in a batch\n";
+                success = false;
+            }
+        }
+
+        //the line as shown in the results, without the surrounding whitespace
+        size_t begin = line.find_first_not_of(" \t");
+        size_t end = line.find_last_not_of(" \t\r");
+        command.line = line.substr(begin, end - begin + 1);
+        outCommands.push_back(command);
+    }
+    return success;
+}
+
+} //anonymous namespace
+
+} //namespace Batch
+} //namespace Launch
@@ -0,0 +1,301 @@
+/**
+ * Layered configuration with validation of the known keys.
+ */
+
+#include <cctype>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "Config.h"
+#include "Tools.h"
+
+
+using namespace Launch;
+
+
+//helper functions and definitions in an anonymous namespace (local)
+namespace {
+
+enum ConfigValueType {
+    CONFIG_INT,
+    CONFIG_BOOL,
+    CONFIG_STRING, //free-form
+};
+
+//What the key configures
+enum ConfigScope {
+    CONFIG_MACHINE, //the machine, the value is stored in its session
+    CONFIG_LAUNCH,  //CernVM-Launch itself
+};
+
+//Known keys, with the type and the range of their values
+struct ConfigField {
+    const char* key;
+    ConfigValueType type;
+    int min;
+    int max;
+    ConfigScope scope;
+};
+
+const ConfigField ConfigFields[] = {
+    //machine parameters
+    {"apiPort",                  CONFIG_INT,     1, 65535,   CONFIG_MACHINE},
+    {"cpus",                     CONFIG_INT,     1, INT_MAX, CONFIG_MACHINE},
+    {"memory",                   CONFIG_INT,     1, INT_MAX, CONFIG_MACHINE},
+    {"disk",                     CONFIG_INT,     1, INT_MAX, CONFIG_MACHINE},
+    {"executionCap",             CONFIG_INT,     1, 100,     CONFIG_MACHINE},
+    {"flags",                    CONFIG_INT,     0, INT_MAX, CONFIG_MACHINE},
+    //bulk creation
+    {"count",                    CONFIG_INT,     1, INT_MAX, CONFIG_LAUNCH},
+    {"parallel",                 CONFIG_INT,     1, INT_MAX, CONFIG_LAUNCH},
+    //CernVM-Launch operations
+    {"launchHomeFolder",         CONFIG_STRING,  0, 0,       CONFIG_LAUNCH},
+    {"parallelism",              CONFIG_INT,     1, INT_MAX, CONFIG_LAUNCH},
+    {"destroyRetryInitialMs",    CONFIG_INT,     1, INT_MAX, CONFIG_LAUNCH},
+    {"destroyRetryMaxMs",        CONFIG_INT,     1, INT_MAX, CONFIG_LAUNCH},
+    {"destroyTimeoutMs",         CONFIG_INT,     1, INT_MAX, CONFIG_LAUNCH},
+    {"cacheSizeLimitMB",         CONFIG_INT,     0, INT_MAX, CONFIG_LAUNCH},
+    {"contextIsoCache",          CONFIG_BOOL,    0, 1,       CONFIG_LAUNCH},
+    {"admissionControl",         CONFIG_BOOL,    0, 1,       CONFIG_LAUNCH},
+    {"memoryOvercommitPercent",  CONFIG_INT,     1, INT_MAX, CONFIG_LAUNCH},
+    {"cpuOvercommitPercent",     CONFIG_INT,     1, INT_MAX, CONFIG_LAUNCH},
+    {"admissionRetryInitialMs",  CONFIG_INT,     1, INT_MAX, CONFIG_LAUNCH},
+    {"admissionRetryMaxMs",      CONFIG_INT,     1, INT_MAX, CONFIG_LAUNCH},
+    {"admissionTimeoutMs",       CONFIG_INT,     0, INT_MAX, CONFIG_LAUNCH},
+    {"poolBootRetryInitialMs",   CONFIG_INT,     1, INT_MAX, CONFIG_LAUNCH},
+    {"poolBootRetryMaxMs",       CONFIG_INT,     1, INT_MAX, CONFIG_LAUNCH},
+    {"poolBootTimeoutMs",        CONFIG_INT,     1, INT_MAX, CONFIG_LAUNCH},
+    {"readyRetryInitialMs",      CONFIG_INT,     1, INT_MAX, CONFIG_LAUNCH},
+    {"readyRetryMaxMs",          CONFIG_INT,     1, INT_MAX, CONFIG_LAUNCH},
+    {"readyTimeoutMs",           CONFIG_INT,     0, INT_MAX, CONFIG_LAUNCH},
+    {"sshUser",                  CONFIG_STRING,  0, 0,       CONFIG_LAUNCH},
+    {"sshControlPersistSeconds", CONFIG_INT,     0, INT_MAX, CONFIG_LAUNCH},
+    {"portRangeStart",           CONFIG_INT,     1, 65535,   CONFIG_LAUNCH},
+    {"portRangeEnd",             CONFIG_INT,     1, 65535,   CONFIG_LAUNCH},
+    {"statsLog",                 CONFIG_BOOL,    0, 1,       CONFIG_LAUNCH},
+    {"statsRegressionPercent",   CONFIG_INT,     1, INT_MAX, CONFIG_LAUNCH},
+};
+
+const ConfigField* FindField(const std::string& key);
+//1/0, true/false, yes/no, on/off (in any case)
+bool ParseBool(const std::string& str, bool& outValue);
+//Move the bounds of [begin, end) to skip whitespace on both sides
+void Trim(const char*& begin, const char*& end);
+
+} //anonymous namespace
+
+
+bool Config::loadFile(const std::string& filename, ConfigLayer layer) {
+    //read, not mapped: the file may be a pipe (e.g. 'create <(echo cpus=2) user.data') or be truncated meanwhile
+    std::string content;
+    if (!Tools::LoadFileIntoString(filename, content))
+        return false;
+    return loadBuffer(content.data(), content.size(), layer, filename);
+}
+
+
+bool Config::loadBuffer(const char* data, size_t size, ConfigLayer layer, const std::string& origin,
+                        unsigned firstLine) {
+    bool success = true;
+    const char* end = data + size;
+    unsigned lineNumber = firstLine - 1;
+
+    for (const char* line = data; line < end; ) {
+        const char* lineEnd = static_cast<const char*>(std::memchr(line, '\n', end - line));
+        if (!lineEnd)
+            lineEnd = end;
+        ++lineNumber;
+
+        //ignore comments and lines without the separator
+        const char* separator = line < lineEnd && *line != COMMENT_CHAR
+                                ? static_cast<const char*>(std::memchr(line, KEY_VALUE_SEPARATOR, lineEnd - line))
+                                : NULL;
+        if (separator) {
+            const char* keyBegin = line;
+            const char* keyEnd = separator;
+            const char* valueBegin = separator + 1;
+            const char* valueEnd = lineEnd;
+            Trim(keyBegin, keyEnd);
+            Trim(valueBegin, valueEnd);
+
+            //if the value is quoted, strip the quotes
+            if (valueEnd - valueBegin > 1 && (*valueBegin == '"' || *valueBegin == '\'') && *valueBegin == valueEnd[-1]) {
+                ++valueBegin;
+                --valueEnd;
+            }
+
+            //we do not store items with an empty key or value
+            if (keyBegin < keyEnd && valueBegin < valueEnd) {
+                std::string key(keyBegin, keyEnd);
+                std::string value(valueBegin, valueEnd);
+                std::string error;
+                if (validate(key, value, error))
+                    store(key, value, layer);
+                else {
+                    std::cerr << origin << ":" << lineNumber << ": " << error << std::endl;
+                    success = false;
+                }
+            }
+        }
+        line = lineEnd + 1;
+    }
+    return success;
+}
+
+
+bool Config::set(const std::string& key, const std::string& value, ConfigLayer layer) {
+    std::string error;
+    if (!validate(key, value, error)) {
+        std::cerr << error << std::endl;
+        return false;
+    }
+    store(key, value, layer);
+    return true;
+}
+
+
+void Config::merge(const Config& other) {
+    for (std::map<std::string, Value>::const_iterator it = other._values.begin(); it != other._values.end(); ++it)
+        store(it->first, it->second.value, it->second.layer);
+}
+
+
+void Config::erase(const std::string& key) {
+    _values.erase(key);
+}
+
+
+std::string Config::extract(const std::string& key) {
+    std::string value = get(key);
+    _values.erase(key);
+    return value;
+}
+
+
+bool Config::has(const std::string& key) const {
+    return _values.find(key) != _values.end();
+}
+
+
+std::string Config::get(const std::string& key, const std::string& defaultValue) const {
+    std::map<std::string, Value>::const_iterator it = _values.find(key);
+    return it == _values.end() ? defaultValue : it->second.value;
+}
+
+
+int Config::getInt(const std::string& key, int defaultValue) const {
+    int value = 0;
+    if (!has(key) || !Tools::ParseInt(get(key), value))
+        return defaultValue;
+    return value;
+}
+
+
+bool Config::getBool(const std::string& key, bool defaultValue) const {
+    bool value = false;
+    if (!has(key) || !ParseBool(get(key), value))
+        return defaultValue;
+    return value;
+}
+
+
+std::vector<std::string> Config::keys() const {
+    std::vector<std::string> result;
+    for (std::map<std::string, Value>::const_iterator it = _values.begin(); it != _values.end(); ++it)
+        result.push_back(it->first);
+    return result;
+}
+
+
+std::map<const std::string, const std::string> Config::toMap() const {
+    std::map<const std::string, const std::string> result;
+    for (std::map<std::string, Value>::const_iterator it = _values.begin(); it != _values.end(); ++it)
+        result.insert(result.end(), std::make_pair(it->first, it->second.value)); //sorted already, no lookups
+    return result;
+}
+
+
+bool Config::IsLaunchKey(const std::string& key) {
+    const ConfigField* field = FindField(key);
+    return field && field->scope == CONFIG_LAUNCH;
+}
+
+
+bool Config::validate(const std::string& key, const std::string& value, std::string& outError) {
+    const ConfigField* field = FindField(key);
+    if (!field || field->type == CONFIG_STRING)
+        return true; //free-form value
+
+    if (field->type == CONFIG_BOOL) {
+        bool parsed;
+        if (ParseBool(value, parsed))
+            return true;
+        outError = "Invalid value of '" + key + "': '" + value + "', expected 1/0, true/false, yes/no or on/off";
+        return false;
+    }
+
+    int parsed = 0;
+    if (Tools::ParseInt(value, parsed) && parsed >= field->min && parsed <= field->max)
+        return true;
+    outError = "Invalid value of '" + key + "': '" + value + "', expected a number";
+    if (field->max == INT_MAX)
+        outError += " >= " + std::to_string(field->min);
+    else
+        outError += " from " + std::to_string(field->min) + " to " + std::to_string(field->max);
+    return false;
+}
+
+
+void Config::store(const std::string& key, const std::string& value, ConfigLayer layer) {
+    //one lookup, the position is the hint for the insertion
+    std::map<std::string, Value>::iterator it = _values.lower_bound(key);
+    if (it == _values.end() || it->first != key) {
+        Value newValue = {value, layer};
+        _values.insert(it, std::make_pair(key, newValue));
+    }
+    else if (it->second.layer <= layer) { //the same layer: the later value wins
+        it->second.value = value;
+        it->second.layer = layer;
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+// Local helper functions
+//-----------------------------------------------------------------------------
+namespace {
+
+const ConfigField* FindField(const std::string& key) {
+    for (size_t i=0; i < sizeof(ConfigFields) / sizeof(ConfigFields[0]); ++i) {
+        if (key == ConfigFields[i].key)
+            return &ConfigFields[i];
+    }
+    return NULL;
+}
+
+
+bool ParseBool(const std::string& str, bool& outValue) {
+    std::string lower;
+    for (size_t i=0; i < str.size(); ++i)
+        lower.push_back(std::tolower(static_cast<unsigned char>(str[i])));
+
+    if (lower == "1" || lower == "true" || lower == "yes" || lower == "on")
+        outValue = true;
+    else if (lower == "0" || lower == "false" || lower == "no" || lower == "off")
+        outValue = false;
+    else
+        return false;
+    return true;
+}
+
+
+void Trim(const char*& begin, const char*& end) {
+    while (begin < end && std::isspace(static_cast<unsigned char>(*begin)))
+        ++begin;
+    while (end > begin && std::isspace(static_cast<unsigned char>(end[-1])))
+        --end;
+}
+
+} //anonymous namespace
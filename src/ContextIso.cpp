@@ -0,0 +1,220 @@
+/**
+ * Cache of the context (user data) ISOs.
+ */
+
+#include <iostream>
+#include <set>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+
+#include <CernVM/Utilities.h>
+
+#include "ContextIso.h"
+#include "IsoBuilder.h"
+#include "Tools.h"
+#include "Trace.h"
+#include "VBoxManage.h"
+
+
+namespace Launch {
+namespace ContextIso {
+
+//helper functions and definitions in an anonymous namespace (local)
+namespace {
+
+//Part of the cache key, bump it whenever the content of the generated ISO changes
+const std::string ISO_LAYOUT_VERSION = "launch-context-1";
+//Volume label of an OpenStack config drive, the layout follows it
+const std::string CONTEXT_VOLUME_ID = "config-2";
+const std::string CONTEXT_README =
+    "This is a CernVM context image. The user data are stored in ec2/latest/user-data\n"
+    "and in openstack/latest/user_data, in order to be found by all contextualization clients.\n";
+
+//Where libcernvm attaches the context CD-ROM
+const std::string CONTEXT_CONTROLLER = "IDE";
+const std::string CONTEXT_PORT = "1";
+const std::string CONTEXT_DEVICE = "0";
+
+//Locations of the DVD images VirtualBox knows about, inUse: those attached to a machine
+void GetDvdImages(HVInstancePtr hv, std::set<std::string>& outKnown, std::set<std::string>& outInUse);
+std::string CanonicalPath(const boost::filesystem::path& path);
+
+} //anonymous namespace
+
+
+bool IsCacheEnabled() {
+    Config* config = Tools::GetGlobalConfig();
+    return config && config->getBool("contextIsoCache", false);
+}
+
+
+bool ParseContextFile(const std::string& arg, ContextFile& outFile) {
+    boost::system::error_code ec;
+    size_t colon = arg.rfind(':');
+    //the whole argument may be a path with a colon (e.g. C:\file on Windows)
+    if (colon == std::string::npos || boost::filesystem::is_regular_file(arg, ec)) {
+        outFile.source = arg;
+        outFile.destination = boost::filesystem::path(arg).filename().string();
+    }
+    else {
+        outFile.source = arg.substr(0, colon);
+        outFile.destination = arg.substr(colon + 1);
+    }
+
+    if (!boost::filesystem::is_regular_file(outFile.source, ec)) {
+        std::cerr << "Context file does not exist: " << outFile.source << std::endl;
+        return false;
+    }
+    if (outFile.destination.empty() || outFile.destination[0] == '/') {
+        std::cerr << "Invalid destination of the context file, a relative path is expected: '"
+                  << outFile.destination << "'\n";
+        return false;
+    }
+    return true;
+}
+
+
+bool GetCachedIso(const std::string& userData, const std::vector<ContextFile>& files, std::string& outFile) {
+    //the key covers everything the ISO is built from, the extra files by their content
+    std::string keySource = ISO_LAYOUT_VERSION + "\n" + userData;
+    for (size_t i=0; i < files.size(); ++i) {
+        std::string checksum;
+        if (sha256_file(files[i].source, &checksum) != HVE_OK) {
+            std::cerr << "Unable to read the context file: " << files[i].source << std::endl;
+            return false;
+        }
+        keySource += std::string(1, '\0') + files[i].destination + std::string(1, '\0') + checksum;
+    }
+    std::string key;
+    if (sha256_buffer(keySource, &key) != HVE_OK)
+        return false;
+
+    boost::filesystem::path cacheFolder = Tools::GetDataFolder() + "/" + CONTEXT_ISO_FOLDER;
+    boost::filesystem::path isoFile = cacheFolder / (key + ".iso");
+    outFile = isoFile.string();
+
+    boost::system::error_code ec;
+    if (boost::filesystem::exists(isoFile, ec)) { //nothing to build
+        boost::filesystem::last_write_time(isoFile, std::time(NULL), ec); //used now, not to be evicted
+        return true;
+    }
+
+    Trace::Span span("buildContextISO", key.substr(0, 12));
+    boost::filesystem::create_directories(cacheFolder, ec);
+    if (ec) {
+        std::cerr << "Unable to create the context ISO folder: " << cacheFolder.string() << std::endl;
+        return false;
+    }
+
+    //user data under the names of all contextualization clients, as libcernvm does
+    IsoBuilder builder(CONTEXT_VOLUME_ID);
+    std::string metaData = "{\"uuid\": \"" + key.substr(0, 8) + "-" + key.substr(8, 4) + "-" + key.substr(12, 4) + "-"
+                           + key.substr(16, 4) + "-" + key.substr(20, 12) + "\"}\n";
+    bool success = builder.addData("ec2/latest/user-data", userData)
+                   && builder.addData("ec2/latest/meta-data.json", metaData)
+                   && builder.addData("openstack/latest/user_data", userData)
+                   && builder.addData("openstack/latest/meta_data.json", metaData)
+                   && builder.addData("readme", CONTEXT_README);
+    for (size_t i=0; success && i < files.size(); ++i)
+        success = builder.addFile(files[i].destination, files[i].source);
+
+    //write aside and move the result into place, so concurrent builds never see a partial ISO
+    boost::filesystem::path buildFile = cacheFolder / boost::filesystem::unique_path("build-%%%%%%%%.iso");
+    success = success && builder.write(buildFile.string());
+    if (success) {
+        boost::filesystem::permissions(buildFile, boost::filesystem::owner_read | boost::filesystem::group_read
+                                                  | boost::filesystem::others_read, ec);
+        boost::filesystem::rename(buildFile, isoFile, ec);
+        success = !ec;
+    }
+    if (!success) {
+        boost::filesystem::remove(buildFile, ec);
+        std::cerr << "Unable to build the context ISO\n";
+    }
+    return success;
+}
+
+
+bool Attach(HVInstancePtr hv, HVSessionPtr session, const std::string& isoFile) {
+    std::vector<std::string> lines;
+    std::vector<std::string> args = {"storageattach", VBoxManage::GetMachineId(session),
+                                     "--storagectl", CONTEXT_CONTROLLER, "--port", CONTEXT_PORT,
+                                     "--device", CONTEXT_DEVICE, "--type", "dvddrive", "--medium", isoFile};
+    if (VBoxManage::Run(hv, args, &lines) != 0) {
+        std::cerr << "Unable to attach the context ISO:\n" << boost::algorithm::join(lines, "\n") << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+int Evict(HVInstancePtr hv) {
+    boost::system::error_code ec;
+    boost::filesystem::path cacheFolder = Tools::GetDataFolder() + "/" + CONTEXT_ISO_FOLDER;
+    if (!boost::filesystem::is_directory(cacheFolder, ec)) //no ISO built yet
+        return 0;
+
+    std::set<std::string> known;
+    std::set<std::string> inUse;
+    GetDvdImages(hv, known, inUse);
+    std::time_t now = std::time(NULL);
+    int evicted = 0;
+    boost::filesystem::directory_iterator it(cacheFolder, ec), end;
+    for (; !ec && it != end; it.increment(ec)) {
+        boost::system::error_code fileEc;
+        if (it->path().extension() != ".iso" || !boost::filesystem::is_regular_file(it->path(), fileEc))
+            continue;
+        std::time_t used = boost::filesystem::last_write_time(it->path(), fileEc);
+        std::string path = CanonicalPath(it->path());
+        if (fileEc || now - used < CONTEXT_ISO_GRACE_S || inUse.count(path))
+            continue;
+
+        if (known.count(path)) { //registered, but detached: VirtualBox would report it as inaccessible
+            std::vector<std::string> args = {"closemedium", "dvd", path};
+            VBoxManage::Run(hv, args);
+        }
+        if (boost::filesystem::remove(it->path(), fileEc))
+            ++evicted;
+    }
+    return evicted;
+}
+
+
+//-----------------------------------------------------------------------------
+// Local helper functions
+//-----------------------------------------------------------------------------
+namespace {
+
+void GetDvdImages(HVInstancePtr hv, std::set<std::string>& outKnown, std::set<std::string>& outInUse) {
+    std::vector<std::string> lines;
+    std::vector<std::string> args = {"list", "dvds"};
+    if (VBoxManage::Run(hv, args, &lines) != 0)
+        return;
+
+    //blocks separated by empty lines: "Location:       /path/to/image.iso", "In use by VMs:  name (UUID: ...)"
+    std::string location;
+    for (size_t i=0; i < lines.size(); ++i) {
+        if (lines[i].compare(0, 9, "Location:") == 0) {
+            location = CanonicalPath(boost::algorithm::trim_copy(lines[i].substr(9)));
+            outKnown.insert(location);
+        }
+        else if (lines[i].compare(0, 14, "In use by VMs:") == 0 && !location.empty())
+            outInUse.insert(location);
+        else if (lines[i].compare(0, 5, "UUID:") == 0 || boost::algorithm::trim_copy(lines[i]).empty())
+            location.clear(); //next medium
+    }
+}
+
+
+std::string CanonicalPath(const boost::filesystem::path& path) {
+    boost::system::error_code ec;
+    boost::filesystem::path canonical = boost::filesystem::canonical(path, ec);
+    return ec ? path.string() : canonical.string();
+}
+
+} //anonymous namespace
+
+} //namespace ContextIso
+} //namespace Launch
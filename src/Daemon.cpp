@@ -0,0 +1,387 @@
+/**
+ * Optional daemon mode, which keeps the hypervisor and loaded sessions warm between commands.
+ */
+
+#include <ctime>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <vector>
+#ifndef _WIN32
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include <boost/filesystem.hpp>
+
+#include "Daemon.h"
+#include "Tools.h"
+
+
+namespace Launch {
+namespace Daemon {
+
+//helper functions and definitions in an anonymous namespace (local)
+namespace {
+
+const std::string SOCKET_FILENAME = "launchd.sock";
+//Request types (first word of the request)
+const std::string REQUEST_RUN = "run";
+const std::string REQUEST_STOP = "stop";
+
+//Commands which never prompt the user, so they can run inside the daemon
+const std::vector<std::string> ForwardableCommands = {
+    "list",
+    "pause",
+    "start",
+    "stop",
+};
+
+//Buffer for the captured output of a command. Bulk operations write into it from several threads,
+//so it has no put area (every write goes through the locked virtual methods)
+class LockedStringBuf : public std::streambuf {
+    public:
+        std::string str() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _data;
+        }
+
+    protected:
+        virtual int_type overflow(int_type c) {
+            if (traits_type::eq_int_type(c, traits_type::eof()))
+                return traits_type::not_eof(c);
+            std::lock_guard<std::mutex> lock(_mutex);
+            _data.push_back(traits_type::to_char_type(c));
+            return c;
+        }
+        virtual std::streamsize xsputn(const char* s, std::streamsize n) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _data.append(s, n);
+            return n;
+        }
+
+    private:
+        std::mutex  _mutex;
+        std::string _data;
+};
+
+#ifndef _WIN32
+//Connect to the daemon socket, returns -1 if no daemon is listening
+int  ConnectToDaemon();
+//Latest modification time of the run directory and the files in it
+std::time_t GetRunFolderStamp();
+bool ReadAll(int fd, std::string& outData);
+bool SendRequest(const std::vector<std::string>& words, std::string& outResponse);
+bool WriteAll(int fd, const std::string& data);
+#endif
+
+} //anonymous namespace
+
+
+std::string GetSocketPath() {
+    return systemPath(Tools::GetDataFolder() + "/" + SOCKET_FILENAME);
+}
+
+
+bool IsForwardable(int argc, char** argv) {
+    if (argc < 2)
+        return false;
+    for (size_t i=0; i < ForwardableCommands.size(); ++i) {
+        if (ForwardableCommands[i] == argv[1])
+            return true;
+    }
+    return false;
+}
+
+
+#ifdef _WIN32
+
+bool ForwardRequest(int argc, char** argv, int& outExitCode) {
+    return false; //no daemon on Windows, always handle in-process
+}
+
+
+bool Serve(HypervisorContext& ctx, RequestHandler& handler, dispatchFuncType dispatch) {
+    std::cerr << "Daemon mode is not supported on Windows\n";
+    return false;
+}
+
+
+bool StopDaemon() {
+    std::cerr << "Daemon mode is not supported on Windows\n";
+    return false;
+}
+
+#else // linux or mac
+
+bool ForwardRequest(int argc, char** argv, int& outExitCode) {
+    std::vector<std::string> words;
+    words.push_back(REQUEST_RUN);
+    for (int i=0; i < argc; ++i)
+        words.push_back(argv[i]);
+
+    std::string response;
+    if (!SendRequest(words, response))
+        return false; //no daemon running
+
+    //response format: "EXIT_CODE OUT_LEN ERR_LEN\n" followed by stdout and stderr contents
+    std::istringstream header(response.substr(0, response.find('\n')));
+    size_t outLen = 0, errLen = 0;
+    if (response.find('\n') == std::string::npos || !(header >> outExitCode >> outLen >> errLen)) {
+        std::cerr << "Invalid response from the daemon\n";
+        outExitCode = -1;
+        return true; //the daemon might have run the command, do not run it again
+    }
+    size_t offset = response.find('\n') + 1;
+    std::cout << response.substr(offset, outLen);
+    std::cerr << response.substr(offset + outLen, errLen);
+
+    return true;
+}
+
+
+bool Serve(HypervisorContext& ctx, RequestHandler& handler, dispatchFuncType dispatch) {
+    std::string socketPath = GetSocketPath();
+    if (socketPath.size() >= sizeof(sockaddr_un().sun_path)) {
+        std::cerr << "Daemon socket path is too long: " << socketPath << std::endl;
+        return false;
+    }
+
+    int fd = ConnectToDaemon();
+    if (fd != -1) {
+        close(fd);
+        std::cerr << "Daemon is already running: " << socketPath << std::endl;
+        return false;
+    }
+    unlink(socketPath.c_str()); //remove a stale socket
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd == -1) {
+        std::cerr << "Unable to create the daemon socket: " << strerror(errno) << std::endl;
+        return false;
+    }
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+    mode_t oldMask = umask(077); //only the owner can talk to the daemon
+    int ret = bind(listenFd, (sockaddr*) &addr, sizeof(addr));
+    umask(oldMask);
+    if (ret == -1 || listen(listenFd, 16) == -1) {
+        std::cerr << "Unable to listen on the daemon socket " << socketPath << ": " << strerror(errno) << std::endl;
+        close(listenFd);
+        return false;
+    }
+    signal(SIGPIPE, SIG_IGN); //a client disconnecting must not kill the daemon
+
+    std::cout << "CernVM-Launch daemon listening on: " << socketPath << std::endl;
+
+    std::time_t runFolderStamp = GetRunFolderStamp();
+    std::time_t stampTakenAt = std::time(NULL);
+    bool running = true;
+
+    while (running) {
+        int clientFd = accept(listenFd, NULL, NULL);
+        if (clientFd == -1) {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "Unable to accept a connection: " << strerror(errno) << std::endl;
+            break;
+        }
+
+        std::string request;
+        if (!ReadAll(clientFd, request)) {
+            close(clientFd);
+            continue;
+        }
+
+        //split the request into words ('\0' separated)
+        std::vector<std::string> words;
+        size_t start = 0, end;
+        while ((end = request.find('\0', start)) != std::string::npos) {
+            words.push_back(request.substr(start, end - start));
+            start = end + 1;
+        }
+
+        int exitCode = -1;
+        LockedStringBuf outBuf, errBuf;
+
+        if (!words.empty() && words[0] == REQUEST_STOP) {
+            running = false;
+            exitCode = 0;
+        }
+        else if (words.size() > 1 && words[0] == REQUEST_RUN) {
+            //sessions were changed by another process, load them again
+            //the stamps have one second resolution, a change in the same second when the stamp
+            //was taken would go unnoticed, so such a stamp is not trusted (as by SessionIndex)
+            std::time_t currentStamp = GetRunFolderStamp();
+            if (currentStamp != runFolderStamp || runFolderStamp >= stampTakenAt) {
+                ctx.invalidate();
+                runFolderStamp = currentStamp;
+                stampTakenAt = std::time(NULL);
+            }
+            //machines powered off from the guest or by VBoxManage do not touch the run folder,
+            //one 'list runningvms' per request is cheap compared to loading the sessions
+            ctx.invalidateRunningMachines();
+
+            std::vector<char*> args;
+            for (size_t i=1; i < words.size(); ++i)
+                args.push_back(&words[i][0]);
+            args.push_back(NULL);
+
+            std::streambuf* oldOut = std::cout.rdbuf(&outBuf);
+            std::streambuf* oldErr = std::cerr.rdbuf(&errBuf);
+            if (IsForwardable(args.size() - 1, &args[0]))
+                exitCode = dispatch(args.size() - 1, &args[0], ctx, handler);
+            else
+                std::cerr << "Command cannot be handled by the daemon\n";
+            std::cout.rdbuf(oldOut);
+            std::cerr.rdbuf(oldErr);
+
+            //our own commands (e.g. start/stop) touch the session files as well
+            runFolderStamp = GetRunFolderStamp();
+            stampTakenAt = std::time(NULL);
+        }
+
+        std::string out = outBuf.str();
+        std::string err = errBuf.str();
+        std::ostringstream response;
+        response << exitCode << " " << out.size() << " " << err.size() << "\n" << out << err;
+        WriteAll(clientFd, response.str());
+        close(clientFd);
+    }
+
+    close(listenFd);
+    unlink(socketPath.c_str());
+    std::cout << "CernVM-Launch daemon stopped\n";
+
+    return true;
+}
+
+
+bool StopDaemon() {
+    std::vector<std::string> words;
+    words.push_back(REQUEST_STOP);
+
+    std::string response;
+    if (!SendRequest(words, response)) {
+        std::cerr << "No daemon is running\n";
+        return false;
+    }
+    return true;
+}
+
+#endif // linux or mac
+
+
+//-----------------------------------------------------------------------------
+// Local helper functions
+//-----------------------------------------------------------------------------
+namespace {
+
+#ifndef _WIN32
+
+int ConnectToDaemon() {
+    std::string socketPath = GetSocketPath();
+    if (socketPath.size() >= sizeof(sockaddr_un().sun_path))
+        return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1)
+        return -1;
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+    if (connect(fd, (sockaddr*) &addr, sizeof(addr)) == -1) { //no daemon or a stale socket
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+std::time_t GetRunFolderStamp() {
+    std::time_t stamp = 0;
+    boost::filesystem::path runFolder(Tools::GetDataFolder() + "/run");
+    boost::system::error_code ec;
+
+    stamp = boost::filesystem::last_write_time(runFolder, ec);
+    if (ec)
+        return 0;
+
+    boost::filesystem::directory_iterator it(runFolder, ec), end;
+    for (; !ec && it != end; it.increment(ec)) {
+        std::time_t fileStamp = boost::filesystem::last_write_time(it->path(), ec);
+        if (!ec && fileStamp > stamp)
+            stamp = fileStamp;
+        ec.clear();
+    }
+    return stamp;
+}
+
+
+bool ReadAll(int fd, std::string& outData) {
+    char buffer[4096];
+    ssize_t count;
+    while ((count = read(fd, buffer, sizeof(buffer))) != 0) {
+        if (count == -1) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        outData.append(buffer, count);
+    }
+    return true;
+}
+
+
+//Send the request words ('\0' terminated) and read the whole response
+bool SendRequest(const std::vector<std::string>& words, std::string& outResponse) {
+    int fd = ConnectToDaemon();
+    if (fd == -1)
+        return false;
+
+    std::string request;
+    for (size_t i=0; i < words.size(); ++i) {
+        request += words[i];
+        request.push_back('\0');
+    }
+
+    bool success = WriteAll(fd, request);
+    shutdown(fd, SHUT_WR); //end of the request
+    success = success && ReadAll(fd, outResponse);
+    close(fd);
+
+    return success;
+}
+
+
+bool WriteAll(int fd, const std::string& data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t count = write(fd, data.data() + written, data.size() - written);
+        if (count == -1) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        written += count;
+    }
+    return true;
+}
+
+#endif // linux or mac
+
+} //anonymous namespace
+
+} //namespace Daemon
+} //namespace Launch
@@ -0,0 +1,70 @@
+/**
+ * Exclusive advisory lock of a file.
+ */
+
+#include <cstring>
+#include <iostream>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+#include "FileLock.h"
+
+
+using namespace Launch;
+
+
+#ifdef _WIN32
+FileLock::FileLock(const std::string& filename) : _file(INVALID_HANDLE_VALUE), _locked(false) {
+    _file = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                        NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (_file == INVALID_HANDLE_VALUE) {
+        std::cerr << "Unable to open the lock file: " << filename << std::endl;
+        return;
+    }
+    OVERLAPPED overlapped = {0};
+    _locked = LockFileEx(_file, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped) != 0;
+    if (!_locked)
+        std::cerr << "Unable to lock the file: " << filename << std::endl;
+}
+
+
+FileLock::~FileLock() {
+    if (_locked) {
+        OVERLAPPED overlapped = {0};
+        UnlockFileEx(_file, 0, 1, 0, &overlapped);
+    }
+    if (_file != INVALID_HANDLE_VALUE)
+        CloseHandle(_file);
+}
+#else
+FileLock::FileLock(const std::string& filename) : _fd(-1), _locked(false) {
+    _fd = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+    if (_fd == -1) {
+        std::cerr << "Unable to open the lock file: " << filename << ": " << strerror(errno) << std::endl;
+        return;
+    }
+    //flock locks belong to the open file description, so threads of one process exclude each other as well
+    int res;
+    while ((res = flock(_fd, LOCK_EX)) == -1 && errno == EINTR)
+        ;
+    _locked = res == 0;
+    if (!_locked)
+        std::cerr << "Unable to lock the file: " << filename << ": " << strerror(errno) << std::endl;
+}
+
+
+FileLock::~FileLock() {
+    if (_fd != -1)
+        close(_fd); //releases the lock
+}
+#endif
+
+
+bool FileLock::locked() const {
+    return _locked;
+}
@@ -0,0 +1,310 @@
+/**
+ * Declarative fleet of machines, reconciled with the existing sessions by 'apply'.
+ */
+
+#include <iostream>
+#include <map>
+#include <set>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+
+#include <CernVM/Utilities.h>
+
+#include "Fleet.h"
+#include "Tools.h"
+#include "Trace.h"
+
+
+namespace Launch {
+namespace Fleet {
+
+//helper functions and definitions in an anonymous namespace (local)
+namespace {
+
+//Manifest keys which are not creation parameters
+const std::string STATE_KEY = "state";
+const std::string USER_DATA_FILE_KEY = "userDataFile";
+const std::string STATE_RUNNING = "running";
+const std::string STATE_STOPPED = "stopped";
+
+//Keys which cannot be used in a manifest (every machine has its own section)
+const std::vector<std::string> ForbiddenKeys = {
+    "count",
+    "linkedFrom",
+    "name",
+    "namePrefix",
+    "parallel",
+    "userData", //use userDataFile, so changes of the file are detected
+};
+
+const char* const ActionNames[] = {
+    "create",
+    "recreate",
+    "start",
+    "stop",
+    "destroy",
+};
+
+//Section of the manifest, [begin, end) of its body
+struct ManifestSection {
+    std::string name;
+    unsigned firstLine;
+    size_t begin;
+    size_t end;
+};
+
+//Check the keys, take the state and the user data file out of the params, add the user data hash
+bool FinishMachine(const std::string& manifestFolder, const std::string& origin, FleetMachine& machine);
+//Describe the differences of the creation parameters, empty if there are none
+std::string DiffParameters(const FleetMachine& machine, HVSessionPtr session);
+
+} //anonymous namespace
+
+
+bool LoadManifest(const std::string& filename, std::vector<FleetMachine>& outMachines) {
+    std::string data;
+    if (!Tools::LoadFileIntoString(filename, data)) {
+        std::cerr << "Unable to read the manifest: " << filename << std::endl;
+        return false;
+    }
+
+    //split the file into the defaults and the sections of the machines
+    std::vector<ManifestSection> sections;
+    ManifestSection defaults = {"", 1, 0, data.size()};
+    unsigned lineNumber = 0;
+    bool success = true;
+    for (size_t line = 0; line < data.size(); ) {
+        size_t lineEnd = data.find('\n', line);
+        if (lineEnd == std::string::npos)
+            lineEnd = data.size();
+        ++lineNumber;
+
+        std::string text = boost::trim_copy(data.substr(line, lineEnd - line));
+        if (data[line] == '[' && text.size() > 1 && text[text.size()-1] == ']') {
+            if (sections.empty())
+                defaults.end = line;
+            else
+                sections.back().end = line;
+
+            ManifestSection section = {boost::trim_copy(text.substr(1, text.size() - 2)), lineNumber + 1,
+                                       lineEnd + 1, data.size()};
+            for (size_t i=0; i < sections.size(); ++i) {
+                if (sections[i].name == section.name) {
+                    std::cerr << filename << ":" << lineNumber << ": duplicate machine: " << section.name << std::endl;
+                    success = false;
+                }
+            }
+            if (section.name.empty()) {
+                std::cerr << filename << ":" << lineNumber << ": empty machine name\n";
+                success = false;
+            }
+            sections.push_back(section);
+        }
+        line = lineEnd + 1;
+    }
+    if (sections.empty()) {
+        std::cerr << "The manifest has no machines ('[NAME]' sections): " << filename << std::endl;
+        return false;
+    }
+
+    Config defaultParams;
+    success = defaultParams.loadBuffer(data.data() + defaults.begin, defaults.end - defaults.begin,
+                                       CONFIG_LAYER_FILE, filename, defaults.firstLine) && success;
+
+    std::string manifestFolder = boost::filesystem::path(filename).parent_path().string();
+    for (size_t i=0; i < sections.size(); ++i) {
+        const ManifestSection& section = sections[i];
+        FleetMachine machine;
+        machine.name = section.name;
+        machine.params = defaultParams; //values of the section (the same layer, loaded later) win
+        if (!machine.params.loadBuffer(data.data() + section.begin, section.end - section.begin,
+                                       CONFIG_LAYER_FILE, filename, section.firstLine)
+            || !FinishMachine(manifestFolder, filename + " [" + section.name + "]", machine)) {
+            success = false;
+            continue;
+        }
+        outMachines.push_back(machine);
+    }
+
+    return success;
+}
+
+
+bool LoadMachineFile(const std::string& filename, const std::string& name, FleetMachine& outMachine) {
+    outMachine.name = name;
+    if (!outMachine.params.loadFile(filename, CONFIG_LAYER_FILE)) {
+        std::cerr << "Error while processing file: " << filename << std::endl;
+        return false;
+    }
+    return FinishMachine(boost::filesystem::path(filename).parent_path().string(), filename, outMachine);
+}
+
+
+bool Plan(HypervisorContext& ctx, const std::vector<FleetMachine>& machines, bool prune,
+          std::vector<Action>& outPlan) {
+    if (!ctx.hypervisor())
+        return false;
+
+    //existing machines by name
+    std::map<std::string, HVSessionPtr> existing;
+    sessionMapType sessions = ctx.sessions();
+    for (sessionMapType::const_iterator it = sessions.begin(); it != sessions.end(); ++it) {
+        std::string name = it->second->parameters->get("name", "");
+        if (!name.empty())
+            existing[name] = it->second;
+    }
+    const runningSetType* runningVms = ctx.runningMachines();
+    if (!runningVms)
+        return false;
+
+    std::set<std::string> wanted;
+    for (size_t i=0; i < machines.size(); ++i) {
+        const FleetMachine& machine = machines[i];
+        wanted.insert(machine.name);
+        Action action = {ACTION_CREATE, machine.name, "", i};
+
+        std::map<std::string, HVSessionPtr>::const_iterator it = existing.find(machine.name);
+        if (it == existing.end())
+            action.reason = "missing";
+        else if (!(action.reason = DiffParameters(machine, it->second)).empty())
+            action.type = ACTION_RECREATE;
+        else if (machine.running != (runningVms->count(machine.name) > 0))
+            action.type = machine.running ? ACTION_START : ACTION_STOP;
+        else
+            continue; //up to date
+
+        outPlan.push_back(action);
+    }
+
+    if (prune) {
+        for (std::map<std::string, HVSessionPtr>::const_iterator it = existing.begin(); it != existing.end(); ++it) {
+            if (!wanted.count(it->first)) {
+                Action action = {ACTION_DESTROY, it->first, "not in the manifest", machines.size()};
+                outPlan.push_back(action);
+            }
+        }
+    }
+
+    return true;
+}
+
+
+void PrintPlan(const std::vector<Action>& plan) {
+    if (plan.empty()) {
+        std::cout << "Nothing to do, the machines match the manifest\n";
+        return;
+    }
+    for (size_t i=0; i < plan.size(); ++i) {
+        std::cout << ActionNames[plan[i].type] << "\t" << plan[i].machineName;
+        if (!plan[i].reason.empty())
+            std::cout << "\t(" << plan[i].reason << ")";
+        std::cout << std::endl;
+    }
+}
+
+
+bool Apply(HypervisorContext& ctx, RequestHandler& handler, const std::vector<FleetMachine>& machines,
+           const std::vector<Action>& plan, unsigned parallelism) {
+    //there is at most one action per machine, actions of different machines are independent
+    std::vector<std::string> names;
+    std::map<std::string, const Action*> actions;
+    for (size_t i=0; i < plan.size(); ++i) {
+        names.push_back(plan[i].machineName);
+        actions[plan[i].machineName] = &plan[i];
+    }
+
+    return handler.forEachMachine(names, [&](const std::string& machineName) {
+        const Action& action = *actions[machineName];
+        Trace::Span span(ActionNames[action.type], machineName);
+
+        switch (action.type) {
+            case ACTION_START:
+                return handler.startMachine(ctx, machineName);
+            case ACTION_STOP:
+                return handler.stopMachine(ctx, machineName);
+            case ACTION_DESTROY:
+                return handler.destroyMachine(ctx, machineName, true);
+            case ACTION_RECREATE:
+                if (!handler.destroyMachine(ctx, machineName, true))
+                    return false;
+                //fall through
+            case ACTION_CREATE: {
+                const FleetMachine& machine = machines[action.machineIndex];
+                Config params = machine.params; //createMachine adds the defaults into it
+                return handler.createMachine(ctx, machine.userDataFile, machine.running, params);
+            }
+        }
+        return false;
+    }, parallelism);
+}
+
+
+//-----------------------------------------------------------------------------
+// Local helper functions
+//-----------------------------------------------------------------------------
+namespace {
+
+bool FinishMachine(const std::string& manifestFolder, const std::string& origin, FleetMachine& machine) {
+    bool success = true;
+    for (size_t i=0; i < ForbiddenKeys.size(); ++i) {
+        if (machine.params.has(ForbiddenKeys[i])) {
+            std::cerr << origin << ": '" << ForbiddenKeys[i] << "' cannot be used in a manifest\n";
+            success = false;
+        }
+    }
+
+    std::string state = machine.params.extract(STATE_KEY);
+    machine.running = state.empty() || state == STATE_RUNNING;
+    if (!machine.running && state != STATE_STOPPED) {
+        std::cerr << origin << ": invalid state: '" << state << "', expected "
+                  << STATE_RUNNING << " or " << STATE_STOPPED << std::endl;
+        success = false;
+    }
+
+    //the user data file is required, otherwise 'create' would ask about the default user data
+    std::string userDataFile = machine.params.extract(USER_DATA_FILE_KEY);
+    if (userDataFile.empty()) {
+        std::cerr << origin << ": '" << USER_DATA_FILE_KEY << "' is missing\n";
+        return false;
+    }
+    boost::filesystem::path userDataPath(userDataFile);
+    if (userDataPath.is_relative() && !manifestFolder.empty())
+        userDataPath = boost::filesystem::path(manifestFolder) / userDataPath;
+    machine.userDataFile = userDataPath.string();
+
+    std::string hash;
+    if (sha256_file(machine.userDataFile, &hash) != HVE_OK) {
+        std::cerr << origin << ": unable to read the user data file: " << machine.userDataFile << std::endl;
+        return false;
+    }
+    machine.params.set(USER_DATA_HASH_PARAM, hash, CONFIG_LAYER_COMMAND_LINE);
+    machine.params.set("name", machine.name, CONFIG_LAYER_COMMAND_LINE);
+
+    return success;
+}
+
+
+std::string DiffParameters(const FleetMachine& machine, HVSessionPtr session) {
+    std::vector<std::string> diffs;
+    std::vector<std::string> keys = machine.params.keys();
+    for (size_t i=0; i < keys.size(); ++i) {
+        std::string current = session->parameters->get(keys[i], "");
+        std::string wanted = machine.params.get(keys[i]);
+        if (current == wanted)
+            continue;
+
+        if (keys[i] == USER_DATA_HASH_PARAM) {
+            if (!current.empty()) //user data of machines not created by apply are not compared
+                diffs.push_back("user data");
+        }
+        else
+            diffs.push_back(keys[i] + ": " + (current.empty() ? "-" : current) + " -> " + wanted);
+    }
+    return boost::algorithm::join(diffs, ", ");
+}
+
+} //anonymous namespace
+
+} //namespace Fleet
+} //namespace Launch
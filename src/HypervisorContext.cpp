@@ -0,0 +1,223 @@
+/**
+ * Per-command hypervisor context, memoizing the hypervisor instance, the loaded sessions
+ * and the running machines.
+ */
+
+#include <cstdlib>
+#include <iostream>
+
+#include <boost/filesystem.hpp>
+
+#include <CernVM/ProgressFeedback.h>
+#include <CernVM/Hypervisor/Virtualbox/VBoxInstance.h>
+
+#include "HypervisorContext.h"
+#include "Tools.h"
+#include "Trace.h"
+
+
+using namespace Launch;
+
+
+//helper functions and definitions in an anonymous namespace (local)
+namespace {
+
+//Environment variable with a VBoxManage binary to use instead of the detected one
+//(e.g. the stand-in from ci/fake-vbox for testing without VirtualBox)
+const char* VBOXMANAGE_OVERRIDE_ENV = "CERNVM_LAUNCH_VBOXMANAGE";
+
+} //anonymous namespace
+
+
+HypervisorContext::HypervisorContext()
+    : _sessionsLoaded(false), _indexLoaded(false), _runningLoaded(false),
+      _sessionIndex(Tools::GetDataFolder() + "/run", Tools::GetDataFolder() + "/" + SESSION_INDEX_FILENAME) {
+}
+
+
+HypervisorContext::~HypervisorContext() {
+}
+
+
+HVInstancePtr HypervisorContext::hypervisor() {
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+    if (_hypervisor)
+        return _hypervisor;
+
+    Trace::Span span("detectHypervisor");
+    const char* vboxManage = std::getenv(VBOXMANAGE_OVERRIDE_ENV);
+    if (vboxManage && *vboxManage) {
+        if (!file_exists(vboxManage)) {
+            std::cerr << VBOXMANAGE_OVERRIDE_ENV << " points to a non-existent file: " << vboxManage << std::endl;
+            return _hypervisor;
+        }
+        std::string vboxRoot = boost::filesystem::path(vboxManage).parent_path().string();
+        _hypervisor = boost::make_shared<VBoxInstance>(vboxRoot, vboxManage, ""); //no guest additions ISO
+    }
+    else
+        _hypervisor = detectHypervisor();
+
+    if (!_hypervisor)
+        std::cerr << "Unable to detect hypervisor\n";
+
+    return _hypervisor;
+}
+
+
+sessionMapType HypervisorContext::sessions() {
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+    HVInstancePtr hv = this->hypervisor();
+    if (!hv)
+        return sessionMapType();
+
+    if (!_sessionsLoaded) {
+        Trace::Span span("loadSessions");
+        hv->loadSessions();
+        _sessionsLoaded = true;
+    }
+    //hv->sessions is changed by sessionOpen and sessionDelete, so it is copied while we hold the lock
+    return hv->sessions;
+}
+
+
+HVSessionPtr HypervisorContext::sessionByName(const std::string& machineName) {
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+    this->sessions(); //make sure the sessions are loaded
+    HVInstancePtr hv = this->hypervisor();
+    if (!hv)
+        return HVSessionPtr();
+    return hv->sessionByName(machineName);
+}
+
+
+const std::vector<SessionIndexEntry>* HypervisorContext::indexedSessions() {
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+    if (_indexLoaded)
+        return &_sessionIndex.entries();
+
+    //if we have the sessions loaded already, the index would not save anything
+    Trace::Span span("sessionIndex");
+    if (!_sessionsLoaded && _sessionIndex.load()) {
+        _indexLoaded = true;
+        return &_sessionIndex.entries();
+    }
+
+    //the index is stale, rebuild it from the sessions
+    if (!this->hypervisor())
+        return NULL;
+
+    sessionMapType sessions = this->sessions();
+    std::vector<SessionIndexEntry> entries;
+    entries.reserve(sessions.size());
+    for (sessionMapType::const_iterator it = sessions.begin(); it != sessions.end(); ++it) {
+        HVSessionPtr session = it->second;
+        SessionIndexEntry entry;
+        entry.name = session->parameters->get("name", "");
+        entry.cernvmVersion = session->parameters->get("cernvmVersion", "");
+        entry.apiPort = session->local->get("apiPort", "");
+        entry.baseFolder = session->local->get("baseFolder", "");
+        entries.push_back(entry);
+    }
+    _sessionIndex.store(entries); //not fatal if we cannot store it, we just rebuild it the next time
+    _indexLoaded = true;
+
+    return &_sessionIndex.entries();
+}
+
+
+const runningSetType* HypervisorContext::runningMachines() {
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+    if (_runningLoaded)
+        return &_runningMachines;
+
+    HVInstancePtr hv = this->hypervisor();
+    if (!hv)
+        return NULL;
+
+    //build the set once, so every lookup is O(1)
+    Trace::Span span("getRunningMachines");
+    std::vector<std::string> running = hv->getRunningMachines();
+    _runningMachines.clear();
+    _runningMachines.insert(running.begin(), running.end());
+    _runningLoaded = true;
+
+    return &_runningMachines;
+}
+
+
+bool HypervisorContext::isRunning(const std::string& machineName) {
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+    const runningSetType* running = this->runningMachines();
+    return running && running->count(machineName) != 0;
+}
+
+
+//Find and opens a session with the corresponding machineName
+HVSessionPtr HypervisorContext::openSession(const std::string& machineName) {
+    Trace::Span span("sessionOpen", machineName);
+    HVSessionPtr session;
+    {
+        std::unique_lock<std::recursive_mutex> lock(_mutex);
+        //another thread is opening the same session, use its result
+        _sessionOpened.wait(lock, [&]() { return _openingSessions.count(machineName) == 0; });
+        std::map<std::string, HVSessionPtr>::iterator it = _openedSessions.find(machineName);
+        if (it != _openedSessions.end())
+            return it->second;
+
+        this->sessions(); //make sure the sessions are loaded
+        HVInstancePtr hv = this->hypervisor();
+        if (!hv)
+            return HVSessionPtr();
+
+        session = hv->sessionByName(machineName);
+        if (!session)
+            return HVSessionPtr();
+
+        //we found our session, try to open it, i.e. start the FSM thread.
+        //It changes the sessions of the hypervisor, so it is done under the lock
+        ParameterMapPtr sessParamMap = session->parameters;
+        FiniteTaskPtr pOpen = boost::make_shared<FiniteTask>();
+        pOpen->setMax(1);
+        session = hv->sessionOpen(sessParamMap, pOpen, false); //bypass verification, we're locals
+        if (!session)
+            return HVSessionPtr();
+        _openingSessions.insert(machineName);
+    }
+
+    //waiting for the FSM is the slow part, other sessions are opened meanwhile
+    session->wait();
+
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+    _openingSessions.erase(machineName);
+    _openedSessions[machineName] = session;
+    _sessionOpened.notify_all();
+    return session;
+}
+
+
+void HypervisorContext::invalidate() {
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+    _sessionsLoaded = false;
+    _indexLoaded = false;
+    _openedSessions.clear();
+    this->invalidateRunningMachines();
+}
+
+
+void HypervisorContext::invalidateRunningMachines() {
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+    _runningLoaded = false;
+    _runningMachines.clear();
+}
+
+
+void HypervisorContext::forgetSession(const std::string& machineName) {
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+    _openedSessions.erase(machineName);
+    this->invalidateRunningMachines();
+}
+
+
+std::recursive_mutex& HypervisorContext::mutex() {
+    return _mutex;
+}
@@ -0,0 +1,369 @@
+/**
+ * Content-addressed cache of the downloaded CernVM images.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/make_shared.hpp>
+
+#include <CernVM/ProgressFeedback.h>
+#include <CernVM/Utilities.h>
+
+#include "FileLock.h"
+#include "ImageCache.h"
+#include "Tools.h"
+#include "Trace.h"
+#include "VBoxManage.h"
+
+
+using namespace Launch;
+
+
+//helper functions and definitions in an anonymous namespace (local)
+namespace {
+
+//Bump the version whenever the file format changes, old index files are then ignored
+const std::string INDEX_HEADER = "launch-image-cache";
+const int INDEX_VERSION = 1;
+//The index is locked by processes changing it (fetch and evict), in a separate file, as it is replaced by a rename
+const std::string LOCK_EXTENSION = ".lock";
+
+const unsigned long long BYTES_IN_MB = 1024 * 1024;
+
+//Images stored in the same object, evicted together
+struct ImageGroup {
+    std::vector<std::string> filenames;
+    unsigned long long size;
+    std::time_t lastUsed;
+};
+
+//Paths of the disk images (ISOs) VirtualBox knows about, they must not be evicted
+std::set<std::string> GetAttachedImages(HVInstancePtr hv);
+std::string CanonicalPath(const boost::filesystem::path& path);
+
+} //anonymous namespace
+
+
+ImageCache::ImageCache(const std::string& cacheFolder)
+    : _cacheFolder(cacheFolder), _indexFile(cacheFolder + "/" + IMAGE_CACHE_INDEX_FILENAME) {
+}
+
+
+bool ImageCache::fetch(HVInstancePtr hv, const std::string& version, const std::string& flavor,
+                       const std::string& arch, std::string& outFile) {
+    int ret;
+    {
+        Trace::Span span("cernVMDownload", version);
+        FiniteTaskPtr pf = boost::make_shared<FiniteTask>();
+        ret = hv->cernVMDownload(version, &outFile, pf, flavor, arch);
+    }
+    if (ret != HVE_OK) {
+        std::cerr << "Unable to download CernVM image version: " << version << std::endl;
+        return false;
+    }
+
+    boost::filesystem::path file(outFile);
+    boost::system::error_code ec;
+    if (!boost::filesystem::equivalent(file.parent_path(), _cacheFolder, ec) || ec)
+        return true; //not in our cache folder, nothing to manage
+
+    //other processes fetch and evict meanwhile, the index is read only once it is locked
+    FileLock lock(_indexFile + LOCK_EXTENSION);
+    if (!lock.locked())
+        return false;
+    this->load(); //a missing index is fine, it is created now
+
+    std::string filename = file.filename().string();
+    if (!this->addFile(filename)) //the image is usable, it just takes extra space
+        std::cerr << "Unable to store the image by its checksum: " << outFile << std::endl;
+    _entries[filename].lastUsed = std::time(NULL);
+
+    return this->store();
+}
+
+
+bool ImageCache::evict(HVInstancePtr hv, unsigned long long limitBytes, const std::string& keepFile) {
+    boost::system::error_code ec;
+    if (limitBytes == 0 || !boost::filesystem::is_directory(_cacheFolder, ec)) //unlimited or nothing downloaded yet
+        return true;
+    FileLock lock(_indexFile + LOCK_EXTENSION);
+    if (!lock.locked())
+        return false;
+    this->load();
+    this->scanCacheFolder();
+
+    std::map<std::string, ImageGroup> groups; //keyed by the checksum (or by the file name if not linked)
+    unsigned long long totalSize = 0;
+    for (entriesType::iterator it = _entries.begin(); it != _entries.end(); ) {
+        if (!boost::filesystem::exists(_cacheFolder + "/" + it->first, ec)) { //removed by someone else
+            _entries.erase(it++);
+            continue;
+        }
+        std::string key = it->second.checksum.empty() ? "file:" + it->first : it->second.checksum;
+        std::map<std::string, ImageGroup>::iterator group = groups.find(key);
+        if (group == groups.end()) {
+            ImageGroup newGroup;
+            newGroup.size = this->entrySize(it->first);
+            newGroup.lastUsed = it->second.lastUsed;
+            group = groups.insert(std::make_pair(key, newGroup)).first;
+            totalSize += newGroup.size;
+        }
+        group->second.filenames.push_back(it->first);
+        group->second.lastUsed = std::max(group->second.lastUsed, it->second.lastUsed);
+        ++it;
+    }
+    if (totalSize <= limitBytes)
+        return this->store();
+
+    //least recently used first
+    std::vector<std::pair<std::time_t, std::string> > order;
+    for (std::map<std::string, ImageGroup>::const_iterator it = groups.begin(); it != groups.end(); ++it)
+        order.push_back(std::make_pair(it->second.lastUsed, it->first));
+    std::sort(order.begin(), order.end());
+
+    std::set<std::string> attached = GetAttachedImages(hv);
+    std::string keepPath = keepFile.empty() ? "" : CanonicalPath(keepFile);
+
+    for (size_t i=0; i < order.size() && totalSize > limitBytes; ++i) {
+        const std::string& key = order[i].second;
+        const ImageGroup& group = groups[key];
+
+        bool inUse = false;
+        for (size_t j=0; j < group.filenames.size(); ++j) {
+            std::string path = CanonicalPath(_cacheFolder + "/" + group.filenames[j]);
+            inUse = inUse || path == keepPath || attached.count(path);
+        }
+        if (inUse)
+            continue;
+
+        for (size_t j=0; j < group.filenames.size(); ++j) {
+            boost::filesystem::remove(_cacheFolder + "/" + group.filenames[j], ec);
+            _entries.erase(group.filenames[j]);
+        }
+        if (key.compare(0, 5, "file:") != 0)
+            boost::filesystem::remove(this->objectPath(key), ec);
+        totalSize -= group.size;
+        std::cout << "Evicted image: " << boost::algorithm::join(group.filenames, ", ")
+                  << " (" << group.size / BYTES_IN_MB << " MB)\n";
+    }
+    if (totalSize > limitBytes)
+        std::cerr << "The image cache is over its limit, the remaining images are in use\n";
+
+    //objects nobody links to anymore (their images were removed by libcernvm or by the user)
+    boost::filesystem::directory_iterator it(_cacheFolder + "/" + IMAGE_CACHE_OBJECTS_FOLDER, ec), end;
+    for (; !ec && it != end; it.increment(ec)) {
+        boost::system::error_code linkEc;
+        if (boost::filesystem::hard_link_count(it->path(), linkEc) == 1 && !linkEc)
+            boost::filesystem::remove(it->path(), linkEc);
+    }
+
+    return this->store();
+}
+
+
+void ImageCache::print() {
+    unsigned long long totalSize = this->totalSize(); //loads the entries
+    for (entriesType::const_iterator it = _entries.begin(); it != _entries.end(); ++it) {
+        unsigned long long size = this->entrySize(it->first);
+        char lastUsed[32];
+        std::strftime(lastUsed, sizeof(lastUsed), "%Y-%m-%d %H:%M", std::localtime(&it->second.lastUsed));
+        std::cout << it->first << ":\tsha256: " << (it->second.checksum.empty() ? "-" : it->second.checksum.substr(0, 12))
+                  << "\tsize: " << size / BYTES_IN_MB << " MB\tlast used: " << lastUsed << std::endl;
+    }
+
+    unsigned long long limit = SizeLimit();
+    std::cout << "Total: " << totalSize / BYTES_IN_MB << " MB";
+    if (limit)
+        std::cout << " of " << limit / BYTES_IN_MB << " MB";
+    std::cout << std::endl;
+}
+
+
+unsigned long long ImageCache::totalSize() {
+    this->load();
+    this->scanCacheFolder();
+
+    unsigned long long totalSize = 0;
+    std::set<std::string> counted;
+    for (entriesType::const_iterator it = _entries.begin(); it != _entries.end(); ++it) {
+        if (it->second.checksum.empty() || counted.insert(it->second.checksum).second)
+            totalSize += this->entrySize(it->first);
+    }
+    return totalSize;
+}
+
+
+unsigned long long ImageCache::SizeLimit() {
+    Config* config = Tools::GetGlobalConfig();
+    if (!config)
+        return 0;
+    return config->getInt("cacheSizeLimitMB", 0) * BYTES_IN_MB;
+}
+
+
+//Index file layout:
+//  header line: launch-image-cache VERSION
+//  one line per image file: filename  checksum  lastUsed (tab separated)
+bool ImageCache::load() {
+    _entries.clear();
+    std::ifstream ifs(_indexFile.c_str());
+    if (!ifs.good())
+        return false;
+
+    std::string line;
+    if (!std::getline(ifs, line))
+        return false;
+    std::istringstream header(line);
+    std::string headerName;
+    int version = 0;
+    if (!(header >> headerName >> version) || headerName != INDEX_HEADER || version != INDEX_VERSION)
+        return false;
+
+    entriesType entries;
+    while (std::getline(ifs, line)) {
+        std::vector<std::string> fields = Tools::SplitString(line, '\t', 3);
+        std::istringstream stamp(fields.size() == 3 ? fields[2] : "");
+        ImageCacheEntry entry;
+        if (!(stamp >> entry.lastUsed))
+            return false; //corrupted index
+        entry.checksum = fields[1];
+        entries[fields[0]] = entry;
+    }
+
+    _entries.swap(entries);
+    return true;
+}
+
+
+bool ImageCache::store() {
+    std::ostringstream content;
+    content << INDEX_HEADER << " " << INDEX_VERSION << "\n";
+    for (entriesType::const_iterator it = _entries.begin(); it != _entries.end(); ++it)
+        content << it->first << "\t" << it->second.checksum << "\t" << it->second.lastUsed << "\n";
+
+    //write a temporary file and rename it, so readers never see a partial index (writers hold the index lock)
+    std::string tmpFile = _indexFile + ".tmp";
+    {
+        std::ofstream ofs(tmpFile.c_str(), std::ios::out | std::ios::trunc);
+        if (!ofs.good())
+            return false;
+        ofs << content.str();
+        if (!ofs.good())
+            return false;
+    }
+
+    boost::system::error_code ec;
+    boost::filesystem::rename(tmpFile, _indexFile, ec);
+    if (ec) {
+        boost::filesystem::remove(tmpFile, ec);
+        return false;
+    }
+    return true;
+}
+
+
+bool ImageCache::addFile(const std::string& filename) {
+    boost::filesystem::path file = _cacheFolder + "/" + filename;
+    boost::system::error_code ec;
+
+    entriesType::iterator it = _entries.find(filename);
+    if (it != _entries.end() && !it->second.checksum.empty()
+            && boost::filesystem::equivalent(file, this->objectPath(it->second.checksum), ec) && !ec)
+        return true; //already linked, no need to compute the checksum again
+
+    std::string checksum;
+    {
+        Trace::Span span("sha256", filename);
+        if (sha256_file(file.string(), &checksum) != HVE_OK)
+            return false;
+    }
+
+    _entries[filename].checksum = "";
+    boost::filesystem::create_directories(_cacheFolder + "/" + IMAGE_CACHE_OBJECTS_FOLDER, ec);
+    boost::filesystem::path object = this->objectPath(checksum);
+    if (!boost::filesystem::exists(object, ec))
+        boost::filesystem::create_hard_link(file, object, ec);
+    else if (!boost::filesystem::equivalent(file, object, ec)) {
+        //the same content is stored already (e.g. under another version name), link the file to it
+        boost::filesystem::path tmpFile = file.string() + ".tmp";
+        boost::filesystem::create_hard_link(object, tmpFile, ec);
+        if (!ec)
+            boost::filesystem::rename(tmpFile, file, ec);
+        if (ec)
+            boost::filesystem::remove(tmpFile);
+    }
+    if (ec) //e.g. the filesystem does not support hardlinks
+        return false;
+
+    _entries[filename].checksum = checksum;
+    return true;
+}
+
+
+void ImageCache::scanCacheFolder() {
+    boost::system::error_code ec;
+    boost::filesystem::directory_iterator it(_cacheFolder, ec), end;
+    for (; !ec && it != end; it.increment(ec)) {
+        std::string filename = it->path().filename().string();
+        if (!boost::filesystem::is_regular_file(it->status()) || it->path().extension() != ".iso"
+                || _entries.count(filename))
+            continue;
+        //downloaded before the cache was managed, the best guess of its last use is its modification time
+        boost::system::error_code stampEc;
+        ImageCacheEntry entry;
+        entry.lastUsed = boost::filesystem::last_write_time(it->path(), stampEc);
+        if (!stampEc)
+            _entries[filename] = entry;
+    }
+}
+
+
+unsigned long long ImageCache::entrySize(const std::string& filename) const {
+    boost::system::error_code ec;
+    boost::uintmax_t size = boost::filesystem::file_size(_cacheFolder + "/" + filename, ec);
+    return ec ? 0 : size;
+}
+
+
+std::string ImageCache::objectPath(const std::string& checksum) const {
+    return _cacheFolder + "/" + IMAGE_CACHE_OBJECTS_FOLDER + "/" + checksum;
+}
+
+
+//-----------------------------------------------------------------------------
+// Local helper functions
+//-----------------------------------------------------------------------------
+namespace {
+
+std::set<std::string> GetAttachedImages(HVInstancePtr hv) {
+    std::set<std::string> images;
+    std::vector<std::string> lines;
+    std::vector<std::string> args = {"list", "dvds"};
+    if (VBoxManage::Run(hv, args, &lines) != 0)
+        return images;
+
+    //"Location:       /path/to/image.iso"
+    for (size_t i=0; i < lines.size(); ++i) {
+        if (lines[i].compare(0, 9, "Location:") != 0)
+            continue;
+        std::string location = boost::algorithm::trim_copy(lines[i].substr(9));
+        images.insert(CanonicalPath(location));
+    }
+    return images;
+}
+
+
+std::string CanonicalPath(const boost::filesystem::path& path) {
+    boost::system::error_code ec;
+    boost::filesystem::path canonical = boost::filesystem::canonical(path, ec);
+    return ec ? path.string() : canonical.string();
+}
+
+} //anonymous namespace
@@ -0,0 +1,543 @@
+/**
+ * Builder of small ISO9660 images with Joliet names (used for the context ISOs).
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <set>
+
+#include <boost/filesystem.hpp>
+
+#include "IsoBuilder.h"
+
+
+using namespace Launch;
+
+
+//helper functions and definitions in an anonymous namespace (local)
+namespace {
+
+const uint32_t SECTOR_SIZE = 2048;
+//System area, then the primary, Joliet and terminating volume descriptors
+const uint32_t FIRST_DESCRIPTOR_SECTOR = 16;
+const uint32_t FIRST_FREE_SECTOR = FIRST_DESCRIPTOR_SECTOR + 3;
+//Longest identifiers: ISO9660 level 2 (without the version) and Joliet (in characters)
+const size_t MAX_ISO_NAME = 30;
+const size_t MAX_JOLIET_NAME = 64;
+
+uint32_t SectorsFor(uint64_t bytes);
+void Put16Both(std::string& buf, size_t offset, uint16_t value);
+void Put32Both(std::string& buf, size_t offset, uint32_t value);
+void Put16(std::string& buf, size_t offset, uint16_t value, bool bigEndian);
+void Put32(std::string& buf, size_t offset, uint32_t value, bool bigEndian);
+//Write the text padded by spaces (UCS-2BE spaces for Joliet)
+void PutText(std::string& buf, size_t offset, size_t length, const std::string& text, bool joliet);
+//Size of a directory with the given records, a record must not cross a sector boundary
+uint32_t DirectorySize(const std::vector<size_t>& recordLengths);
+size_t RecordLength(size_t identifierLength);
+//Convert to a d-characters identifier (uppercase letters, digits and '_')
+std::string ToDCharacters(const std::string& str);
+//Convert UTF-8 to UCS-2BE, characters outside the BMP are replaced by '_'
+std::string ToUcs2(const std::string& utf8);
+void PadToSector(std::ostream& out);
+
+} //anonymous namespace
+
+
+IsoBuilder::IsoBuilder(const std::string& volumeId) : _volumeId(volumeId), _pathTableExtent(0),
+    _jolietPathTableExtent(0), _pathTableSectors(0), _jolietPathTableSectors(0) {
+    Node root;
+    root.isDirectory = true;
+    root.parent = 0;
+    root.size = 0;
+    _nodes.push_back(root);
+
+    //all records carry the build time
+    std::time_t now = std::time(NULL);
+    std::tm utc = *std::gmtime(&now);
+    _recordDate[0] = utc.tm_year;
+    _recordDate[1] = utc.tm_mon + 1;
+    _recordDate[2] = utc.tm_mday;
+    _recordDate[3] = utc.tm_hour;
+    _recordDate[4] = utc.tm_min;
+    _recordDate[5] = utc.tm_sec;
+    _recordDate[6] = 0; //GMT
+    char date[17];
+    std::strftime(date, sizeof(date), "%Y%m%d%H%M%S", &utc);
+    _volumeDate = std::string(date) + "00";
+    _volumeDate.push_back('\0');
+}
+
+
+bool IsoBuilder::addFile(const std::string& destination, const std::string& sourceFile) {
+    boost::system::error_code ec;
+    if (!boost::filesystem::is_regular_file(sourceFile, ec)) {
+        std::cerr << "Not a regular file: " << sourceFile << std::endl;
+        return false;
+    }
+
+    Node node;
+    node.isDirectory = false;
+    node.sourceFile = sourceFile;
+    node.size = boost::filesystem::file_size(sourceFile, ec);
+    if (ec || node.size > 0xFFFFFFFFull) {
+        std::cerr << "Unable to add the file into the ISO (files over 4 GB are not supported): " << sourceFile << std::endl;
+        return false;
+    }
+    return addNode(destination, node);
+}
+
+
+bool IsoBuilder::addData(const std::string& destination, const std::string& content) {
+    Node node;
+    node.isDirectory = false;
+    node.data = content;
+    node.size = content.size();
+    return addNode(destination, node);
+}
+
+
+bool IsoBuilder::write(const std::string& isoFile) {
+    assignNames();
+    uint32_t totalSectors = layout();
+
+    std::ofstream out(isoFile, std::ios::binary | std::ios::trunc);
+    if (!out.good()) {
+        std::cerr << "Unable to write the ISO image: " << isoFile << std::endl;
+        return false;
+    }
+
+    out << std::string(FIRST_DESCRIPTOR_SECTOR * SECTOR_SIZE, '\0');
+    writeVolumeDescriptor(out, false, totalSectors);
+    writeVolumeDescriptor(out, true, totalSectors);
+    std::string terminator(SECTOR_SIZE, '\0');
+    terminator.replace(0, 7, "\xff" "CD001" "\x01", 7);
+    out << terminator;
+
+    writePathTable(out, false, false);
+    writePathTable(out, false, true);
+    writePathTable(out, true, false);
+    writePathTable(out, true, true);
+    for (size_t i=0; i < _directories.size(); ++i)
+        writeDirectory(out, _directories[i], false);
+    for (size_t i=0; i < _jolietDirectories.size(); ++i)
+        writeDirectory(out, _jolietDirectories[i], true);
+    for (size_t i=0; i < _files.size(); ++i) {
+        if (!writeFileContent(out, _nodes[_files[i]]))
+            return false;
+    }
+
+    out.flush();
+    if (!out.good()) {
+        std::cerr << "Unable to write the ISO image: " << isoFile << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+bool IsoBuilder::addNode(const std::string& destination, Node& node) {
+    std::vector<std::string> components;
+    size_t start = 0;
+    while (start <= destination.size()) {
+        size_t end = destination.find('/', start);
+        if (end == std::string::npos)
+            end = destination.size();
+        components.push_back(destination.substr(start, end - start));
+        start = end + 1;
+    }
+
+    for (size_t i=0; i < components.size(); ++i) {
+        const std::string& component = components[i];
+        if (component.empty() || component == "." || component == ".." || ToUcs2(component).size() / 2 > MAX_JOLIET_NAME - 2) {
+            std::cerr << "Invalid path in the ISO: '" << destination << "'\n";
+            return false;
+        }
+    }
+
+    size_t directory = 0;
+    for (size_t i=0; i < components.size(); ++i) {
+        bool last = i + 1 == components.size();
+        size_t found = _nodes.size();
+        for (size_t c=0; c < _nodes[directory].children.size(); ++c) {
+            if (_nodes[_nodes[directory].children[c]].name == components[i])
+                found = _nodes[directory].children[c];
+        }
+
+        if (found != _nodes.size()) {
+            if (last || !_nodes[found].isDirectory) {
+                std::cerr << "Path in the ISO is already used: '" << destination << "'\n";
+                return false;
+            }
+            directory = found;
+            continue;
+        }
+
+        Node child;
+        if (last)
+            child = node;
+        else {
+            child.isDirectory = true;
+            child.size = 0;
+        }
+        child.name = components[i];
+        child.parent = directory;
+        _nodes.push_back(child);
+        _nodes[directory].children.push_back(_nodes.size() - 1);
+        directory = _nodes.size() - 1;
+    }
+    return true;
+}
+
+
+void IsoBuilder::assignNames() {
+    _nodes[0].isoName = std::string(1, '\0');
+    _nodes[0].jolietName = std::string(1, '\0');
+
+    for (size_t d=0; d < _nodes.size(); ++d) {
+        if (!_nodes[d].isDirectory)
+            continue;
+        std::set<std::string> used; //mangled names may collide, e.g. "a-b" and "a_b"
+        for (size_t c=0; c < _nodes[d].children.size(); ++c) {
+            Node& node = _nodes[_nodes[d].children[c]];
+
+            std::string base = node.name, extension;
+            size_t dot = node.name.rfind('.');
+            if (!node.isDirectory && dot != std::string::npos && dot > 0) {
+                base = node.name.substr(0, dot);
+                extension = ToDCharacters(node.name.substr(dot + 1)).substr(0, 8);
+            }
+            base = ToDCharacters(base);
+
+            std::string name;
+            for (unsigned n=0; name.empty() || used.count(name); ++n) {
+                std::string suffix = n == 0 ? "" : "_" + std::to_string(n);
+                size_t baseLength = MAX_ISO_NAME - suffix.size() - (node.isDirectory ? 0 : extension.size() + 1);
+                name = base.substr(0, baseLength) + suffix;
+                if (!node.isDirectory)
+                    name += "." + extension;
+            }
+            used.insert(name);
+
+            node.isoName = node.isDirectory ? name : name + ";1";
+            node.jolietName = ToUcs2(node.isDirectory ? node.name : node.name + ";1");
+        }
+    }
+}
+
+
+std::vector<size_t> IsoBuilder::directoryOrder(bool joliet) {
+    //breadth-first with sorted children gives the order by level, parent and name
+    std::vector<size_t> order(1, 0);
+    for (size_t i=0; i < order.size(); ++i) {
+        std::vector<size_t> children = sortedChildren(order[i], joliet);
+        for (size_t c=0; c < children.size(); ++c) {
+            if (_nodes[children[c]].isDirectory)
+                order.push_back(children[c]);
+        }
+    }
+    for (size_t i=0; i < order.size(); ++i) {
+        if (joliet)
+            _nodes[order[i]].jolietNumber = i + 1;
+        else
+            _nodes[order[i]].number = i + 1;
+    }
+    return order;
+}
+
+
+uint32_t IsoBuilder::layout() {
+    _directories = directoryOrder(false);
+    _jolietDirectories = directoryOrder(true);
+
+    _pathTableSectors = SectorsFor(pathTableSize(false));
+    _jolietPathTableSectors = SectorsFor(pathTableSize(true));
+    _pathTableExtent = FIRST_FREE_SECTOR;
+    _jolietPathTableExtent = _pathTableExtent + 2 * _pathTableSectors; //L and M tables
+    uint32_t sector = _jolietPathTableExtent + 2 * _jolietPathTableSectors;
+
+    for (int joliet=0; joliet < 2; ++joliet) {
+        const std::vector<size_t>& directories = joliet ? _jolietDirectories : _directories;
+        for (size_t i=0; i < directories.size(); ++i) {
+            Node& directory = _nodes[directories[i]];
+            std::vector<size_t> recordLengths(2, RecordLength(1)); //"." and ".."
+            for (size_t c=0; c < directory.children.size(); ++c) {
+                const Node& child = _nodes[directory.children[c]];
+                recordLengths.push_back(RecordLength(joliet ? child.jolietName.size() : child.isoName.size()));
+            }
+            uint32_t size = DirectorySize(recordLengths);
+            if (joliet) {
+                directory.jolietExtent = sector;
+                directory.jolietSize = size;
+            }
+            else {
+                directory.extent = sector;
+                directory.size = size;
+            }
+            sector += size / SECTOR_SIZE;
+        }
+    }
+
+    _files.clear();
+    for (size_t i=0; i < _directories.size(); ++i) {
+        std::vector<size_t> children = sortedChildren(_directories[i], false);
+        for (size_t c=0; c < children.size(); ++c) {
+            Node& node = _nodes[children[c]];
+            if (node.isDirectory)
+                continue;
+            node.extent = sector;
+            node.jolietExtent = sector;
+            sector += SectorsFor(node.size);
+            _files.push_back(children[c]);
+        }
+    }
+    return sector;
+}
+
+
+void IsoBuilder::writeVolumeDescriptor(std::ostream& out, bool joliet, uint32_t totalSectors) {
+    std::string descriptor(SECTOR_SIZE, '\0');
+    descriptor[0] = joliet ? 2 : 1; //supplementary or primary
+    descriptor.replace(1, 5, "CD001");
+    descriptor[6] = 1;
+
+    PutText(descriptor, 8, 32, "", joliet); //system identifier
+    PutText(descriptor, 40, 32, _volumeId, joliet);
+    Put32Both(descriptor, 80, totalSectors);
+    if (joliet)
+        descriptor.replace(88, 3, "%/E"); //UCS-2 level 3
+    Put16Both(descriptor, 120, 1); //volume set size
+    Put16Both(descriptor, 124, 1); //volume sequence number
+    Put16Both(descriptor, 128, SECTOR_SIZE);
+    Put32Both(descriptor, 132, pathTableSize(joliet));
+    uint32_t pathTableExtent = joliet ? _jolietPathTableExtent : _pathTableExtent;
+    uint32_t pathTableSectors = joliet ? _jolietPathTableSectors : _pathTableSectors;
+    Put32(descriptor, 140, pathTableExtent, false);
+    Put32(descriptor, 148, pathTableExtent + pathTableSectors, true);
+
+    std::string root = directoryRecord(_nodes[0], joliet, std::string(1, '\0'));
+    descriptor.replace(156, root.size(), root);
+
+    PutText(descriptor, 190, 128, "", joliet); //volume set
+    PutText(descriptor, 318, 128, "", joliet); //publisher
+    PutText(descriptor, 446, 128, "", joliet); //data preparer
+    PutText(descriptor, 574, 128, "CERNVM-LAUNCH", joliet); //application
+    PutText(descriptor, 702, 37, "", joliet); //copyright file
+    PutText(descriptor, 739, 37, "", joliet); //abstract file
+    PutText(descriptor, 776, 37, "", joliet); //bibliographic file
+    descriptor.replace(813, 17, _volumeDate); //creation
+    descriptor.replace(830, 17, _volumeDate); //modification
+    descriptor.replace(847, 16, std::string(16, '0')); //no expiration
+    descriptor.replace(864, 16, std::string(16, '0')); //effective immediately
+    descriptor[881] = 1; //file structure version
+
+    out << descriptor;
+}
+
+
+void IsoBuilder::writePathTable(std::ostream& out, bool joliet, bool bigEndian) {
+    const std::vector<size_t>& directories = joliet ? _jolietDirectories : _directories;
+    std::string table;
+    for (size_t i=0; i < directories.size(); ++i) {
+        const Node& directory = _nodes[directories[i]];
+        const std::string& identifier = joliet ? directory.jolietName : directory.isoName;
+        const Node& parent = _nodes[directory.parent];
+
+        std::string record(8 + identifier.size() + identifier.size() % 2, '\0');
+        record[0] = identifier.size();
+        Put32(record, 2, joliet ? directory.jolietExtent : directory.extent, bigEndian);
+        Put16(record, 6, joliet ? parent.jolietNumber : parent.number, bigEndian);
+        record.replace(8, identifier.size(), identifier);
+        table += record;
+    }
+    table.resize((joliet ? _jolietPathTableSectors : _pathTableSectors) * SECTOR_SIZE, '\0');
+    out << table;
+}
+
+
+void IsoBuilder::writeDirectory(std::ostream& out, size_t directory, bool joliet) {
+    const Node& node = _nodes[directory];
+    std::vector<std::string> records;
+    records.push_back(directoryRecord(node, joliet, std::string(1, '\0')));
+    records.push_back(directoryRecord(_nodes[node.parent], joliet, std::string(1, '\1')));
+    std::vector<size_t> children = sortedChildren(directory, joliet);
+    for (size_t c=0; c < children.size(); ++c) {
+        const Node& child = _nodes[children[c]];
+        records.push_back(directoryRecord(child, joliet, joliet ? child.jolietName : child.isoName));
+    }
+
+    std::string content;
+    for (size_t i=0; i < records.size(); ++i) {
+        if (content.size() % SECTOR_SIZE + records[i].size() > SECTOR_SIZE) //the rest of the sector stays zero
+            content.resize(SectorsFor(content.size()) * SECTOR_SIZE, '\0');
+        content += records[i];
+    }
+    content.resize(joliet ? node.jolietSize : node.size, '\0');
+    out << content;
+}
+
+
+bool IsoBuilder::writeFileContent(std::ostream& out, const Node& node) {
+    if (node.sourceFile.empty())
+        out << node.data;
+    else {
+        std::ifstream in(node.sourceFile, std::ios::binary);
+        char buffer[64 * 1024];
+        uint64_t copied = 0;
+        while (in.good() && copied < node.size) {
+            in.read(buffer, std::min<uint64_t>(sizeof(buffer), node.size - copied));
+            out.write(buffer, in.gcount());
+            copied += in.gcount();
+        }
+        if (copied != node.size || in.peek() != std::char_traits<char>::eof()) {
+            std::cerr << "The file changed while building the ISO: " << node.sourceFile << std::endl;
+            return false;
+        }
+    }
+    PadToSector(out);
+    return out.good();
+}
+
+
+std::string IsoBuilder::directoryRecord(const Node& node, bool joliet, const std::string& identifier) const {
+    std::string record(RecordLength(identifier.size()), '\0');
+    record[0] = record.size();
+    Put32Both(record, 2, joliet && node.isDirectory ? node.jolietExtent : node.extent);
+    Put32Both(record, 10, joliet && node.isDirectory ? node.jolietSize : node.size);
+    record.replace(18, 7, reinterpret_cast<const char*>(_recordDate), 7);
+    record[25] = node.isDirectory ? 2 : 0;
+    Put16Both(record, 28, 1); //volume sequence number
+    record[32] = identifier.size();
+    record.replace(33, identifier.size(), identifier);
+    return record;
+}
+
+
+std::vector<size_t> IsoBuilder::sortedChildren(size_t directory, bool joliet) const {
+    std::vector<size_t> children = _nodes[directory].children;
+    std::sort(children.begin(), children.end(), [&](size_t a, size_t b) {
+        return joliet ? _nodes[a].jolietName < _nodes[b].jolietName : _nodes[a].isoName < _nodes[b].isoName;
+    });
+    return children;
+}
+
+
+uint32_t IsoBuilder::pathTableSize(bool joliet) const {
+    uint32_t size = 0;
+    for (size_t i=0; i < _nodes.size(); ++i) {
+        if (!_nodes[i].isDirectory)
+            continue;
+        size_t length = (joliet ? _nodes[i].jolietName : _nodes[i].isoName).size();
+        size += 8 + length + length % 2;
+    }
+    return size;
+}
+
+
+//-----------------------------------------------------------------------------
+// Local helper functions
+//-----------------------------------------------------------------------------
+namespace {
+
+uint32_t SectorsFor(uint64_t bytes) {
+    return (bytes + SECTOR_SIZE - 1) / SECTOR_SIZE;
+}
+
+
+void Put16(std::string& buf, size_t offset, uint16_t value, bool bigEndian) {
+    for (int i=0; i < 2; ++i)
+        buf[offset + (bigEndian ? 1 - i : i)] = (value >> (8 * i)) & 0xff;
+}
+
+
+void Put32(std::string& buf, size_t offset, uint32_t value, bool bigEndian) {
+    for (int i=0; i < 4; ++i)
+        buf[offset + (bigEndian ? 3 - i : i)] = (value >> (8 * i)) & 0xff;
+}
+
+
+void Put16Both(std::string& buf, size_t offset, uint16_t value) {
+    Put16(buf, offset, value, false);
+    Put16(buf, offset + 2, value, true);
+}
+
+
+void Put32Both(std::string& buf, size_t offset, uint32_t value) {
+    Put32(buf, offset, value, false);
+    Put32(buf, offset + 4, value, true);
+}
+
+
+void PutText(std::string& buf, size_t offset, size_t length, const std::string& text, bool joliet) {
+    std::string padded = joliet ? ToUcs2(text) : text;
+    while (padded.size() + (joliet ? 2 : 1) <= length)
+        padded += joliet ? std::string("\0 ", 2) : std::string(" ");
+    padded.resize(length, ' '); //odd Joliet fields end by a single byte
+    buf.replace(offset, length, padded);
+}
+
+
+uint32_t DirectorySize(const std::vector<size_t>& recordLengths) {
+    uint32_t size = 0;
+    for (size_t i=0; i < recordLengths.size(); ++i) {
+        if (size % SECTOR_SIZE + recordLengths[i] > SECTOR_SIZE)
+            size = SectorsFor(size) * SECTOR_SIZE;
+        size += recordLengths[i];
+    }
+    return SectorsFor(size) * SECTOR_SIZE;
+}
+
+
+size_t RecordLength(size_t identifierLength) {
+    return 33 + identifierLength + (identifierLength % 2 == 0 ? 1 : 0); //padded to an even length
+}
+
+
+std::string ToDCharacters(const std::string& str) {
+    std::string result;
+    for (size_t i=0; i < str.size(); ++i) {
+        unsigned char c = str[i];
+        result += std::isalnum(c) && c < 0x80 ? static_cast<char>(std::toupper(c)) : '_';
+    }
+    return result.empty() ? "_" : result;
+}
+
+
+std::string ToUcs2(const std::string& utf8) {
+    std::string result;
+    for (size_t i=0; i < utf8.size(); ) {
+        unsigned char c = utf8[i];
+        uint32_t code = c;
+        size_t length = 1;
+        if (c >= 0xf0)
+            length = 4;
+        else if (c >= 0xe0) {
+            length = 3;
+            code = c & 0x0f;
+        }
+        else if (c >= 0xc0) {
+            length = 2;
+            code = c & 0x1f;
+        }
+        for (size_t j=1; j < length && i + j < utf8.size(); ++j)
+            code = (code << 6) | (static_cast<unsigned char>(utf8[i + j]) & 0x3f);
+        if (length == 4 || code > 0xffff)
+            code = '_';
+        result.push_back(static_cast<char>(code >> 8));
+        result.push_back(static_cast<char>(code & 0xff));
+        i += length;
+    }
+    return result;
+}
+
+
+void PadToSector(std::ostream& out) {
+    std::streamoff position = out.tellp();
+    if (position % SECTOR_SIZE)
+        out << std::string(SECTOR_SIZE - position % SECTOR_SIZE, '\0');
+}
+
+} //anonymous namespace
@@ -0,0 +1,236 @@
+/**
+ * Metrics of the machines in the Prometheus text format.
+ */
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "ImageCache.h"
+#include "Metrics.h"
+#include "Stats.h"
+#include "Tools.h"
+#include "VBoxManage.h"
+#include "WorkerPool.h"
+
+
+namespace Launch {
+namespace Metrics {
+
+//helper functions and definitions in an anonymous namespace (local)
+namespace {
+
+const unsigned long long BYTES_IN_MB = 1024 * 1024;
+//Upper bounds of the buckets of the operation time histograms, in seconds: from a resume to a creation with a download
+const double DURATION_BUCKETS_S[] = {0.5, 1, 2, 5, 10, 20, 30, 60, 120, 300, 600};
+//States always exported, so the series do not disappear when no machine is in them
+const char* const BASE_STATES[] = {"running", "paused", "saved", "poweroff"};
+
+//Machine with its state (VMState of VirtualBox) and resources from the session parameters
+struct Machine {
+    std::string name;
+    std::string state;
+    int cpus;
+    int memoryMB;
+    int diskMB;
+};
+
+//Get the machines of the sessions, their states are queried concurrently (one showvminfo per machine)
+bool CollectMachines(HypervisorContext& ctx, std::vector<Machine>& outMachines);
+//Write the HELP and TYPE lines of a metric
+void WriteHeader(std::ostream& out, const std::string& name, const std::string& type, const std::string& help);
+//Write a histogram of the successful runs and a counter of the failed runs of every operation in the stats log
+void WriteOperationMetrics(std::ostream& out);
+//Escape a label value (backslash, double quote and newline)
+std::string EscapeLabel(const std::string& value);
+
+} //anonymous namespace
+
+
+bool WriteTextfile(HypervisorContext& ctx, const std::string& filename) {
+    std::vector<Machine> machines;
+    if (!CollectMachines(ctx, machines))
+        return false;
+
+    std::ostringstream out;
+    WriteHeader(out, "sessions", "gauge", "Machines (sessions) managed by CernVM-Launch.");
+    out << METRIC_PREFIX << "sessions " << machines.size() << "\n";
+
+    std::map<std::string, int> states;
+    for (size_t i=0; i < sizeof(BASE_STATES) / sizeof(BASE_STATES[0]); ++i)
+        states[BASE_STATES[i]] = 0;
+    for (size_t i=0; i < machines.size(); ++i)
+        ++states[machines[i].state];
+    WriteHeader(out, "machines", "gauge", "Machines by their VirtualBox state.");
+    for (std::map<std::string, int>::const_iterator it = states.begin(); it != states.end(); ++it)
+        out << METRIC_PREFIX << "machines{state=\"" << EscapeLabel(it->first) << "\"} " << it->second << "\n";
+
+    WriteHeader(out, "machine_cpus", "gauge", "Configured CPUs of the machine.");
+    for (size_t i=0; i < machines.size(); ++i)
+        out << METRIC_PREFIX << "machine_cpus{machine=\"" << EscapeLabel(machines[i].name) << "\"} "
+            << machines[i].cpus << "\n";
+    WriteHeader(out, "machine_memory_bytes", "gauge", "Configured memory of the machine.");
+    for (size_t i=0; i < machines.size(); ++i)
+        out << METRIC_PREFIX << "machine_memory_bytes{machine=\"" << EscapeLabel(machines[i].name) << "\"} "
+            << machines[i].memoryMB * BYTES_IN_MB << "\n";
+    WriteHeader(out, "machine_disk_bytes", "gauge", "Configured disk size of the machine.");
+    for (size_t i=0; i < machines.size(); ++i)
+        out << METRIC_PREFIX << "machine_disk_bytes{machine=\"" << EscapeLabel(machines[i].name) << "\"} "
+            << machines[i].diskMB * BYTES_IN_MB << "\n";
+
+    ImageCache cache(Tools::GetDataFolder() + "/" + IMAGE_CACHE_FOLDER);
+    WriteHeader(out, "image_cache_bytes", "gauge", "Size of the CernVM image cache.");
+    out << METRIC_PREFIX << "image_cache_bytes " << cache.totalSize() << "\n";
+    WriteHeader(out, "image_cache_limit_bytes", "gauge", "Size limit of the CernVM image cache, 0 is unlimited.");
+    out << METRIC_PREFIX << "image_cache_limit_bytes " << ImageCache::SizeLimit() << "\n";
+
+    WriteOperationMetrics(out);
+
+    //node_exporter reads only *.prom files, the temporary one is not read
+    std::string tmpFile = filename + ".tmp";
+    bool written;
+    {
+        std::ofstream ofs(tmpFile.c_str(), std::ios::out | std::ios::trunc);
+        ofs << out.str();
+        written = ofs.good();
+    }
+    boost::system::error_code ec;
+    if (written)
+        boost::filesystem::rename(tmpFile, filename, ec);
+    if (!written || ec) {
+        boost::filesystem::remove(tmpFile, ec);
+        std::cerr << "Unable to write the metrics file " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+bool Export(HypervisorContext& ctx, const std::string& filename, int intervalS) {
+    if (intervalS == 0)
+        return WriteTextfile(ctx, filename);
+
+    while (true) {
+        std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now() + std::chrono::seconds(intervalS);
+        //a failed write is retried next time, the file keeps the last metrics meanwhile
+        WriteTextfile(ctx, filename);
+        std::this_thread::sleep_until(next);
+        ctx.invalidate(); //machines were created, started or stopped by other processes meanwhile
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+// Local helper functions
+//-----------------------------------------------------------------------------
+namespace {
+
+bool CollectMachines(HypervisorContext& ctx, std::vector<Machine>& outMachines) {
+    HVInstancePtr hv = ctx.hypervisor();
+    if (!hv)
+        return false;
+
+    std::vector<std::string> ids;
+    sessionMapType sessions = ctx.sessions();
+    for (sessionMapType::const_iterator it = sessions.begin(); it != sessions.end(); ++it) {
+        Machine machine;
+        machine.name = it->second->parameters->get("name", "");
+        if (machine.name.empty())
+            continue;
+        machine.state = "unknown";
+        machine.cpus = it->second->parameters->getNum<int>("cpus", 0);
+        machine.memoryMB = it->second->parameters->getNum<int>("memory", 0);
+        machine.diskMB = it->second->parameters->getNum<int>("disk", 0);
+        outMachines.push_back(machine);
+        ids.push_back(VBoxManage::GetMachineId(it->second));
+    }
+
+    WorkerPool::Run(outMachines.size(), WorkerPool::DefaultParallelism(), [&](size_t i) {
+        VBoxManage::vmInfoType info;
+        if (!VBoxManage::GetVMInfo(hv, ids[i], info)) //e.g. destroyed meanwhile
+            return false;
+        outMachines[i].state = info["VMState"];
+        return true;
+    });
+    return true;
+}
+
+
+void WriteHeader(std::ostream& out, const std::string& name, const std::string& type, const std::string& help) {
+    out << "# HELP " << METRIC_PREFIX << name << " " << help << "\n"
+        << "# TYPE " << METRIC_PREFIX << name << " " << type << "\n";
+}
+
+
+void WriteOperationMetrics(std::ostream& out) {
+    std::vector<Stats::Record> records;
+    if (!Stats::LoadRecords(records))
+        return;
+
+    const size_t bucketCount = sizeof(DURATION_BUCKETS_S) / sizeof(DURATION_BUCKETS_S[0]);
+    std::map<std::string, std::vector<long long> > durations; //operation -> successful runs, in ms
+    std::map<std::string, int> failures;
+    for (size_t i=0; i < records.size(); ++i) {
+        if (records[i].success)
+            durations[records[i].operation].push_back(records[i].durationMs);
+        else {
+            ++failures[records[i].operation];
+            durations[records[i].operation]; //exported with an empty histogram
+        }
+    }
+
+    //the counts grow with the log, they are reset (as after a restart) when the log is rotated
+    WriteHeader(out, "operation_duration_seconds", "histogram",
+                "Time of the successful operations on machines (from the stats log).");
+    for (std::map<std::string, std::vector<long long> >::const_iterator it = durations.begin(); it != durations.end(); ++it) {
+        std::string label = "operation=\"" + EscapeLabel(it->first) + "\"";
+        std::vector<size_t> buckets(bucketCount, 0);
+        long long sumMs = 0;
+        for (size_t i=0; i < it->second.size(); ++i) {
+            sumMs += it->second[i];
+            for (size_t b=0; b < bucketCount; ++b) {
+                if (it->second[i] <= DURATION_BUCKETS_S[b] * 1000)
+                    ++buckets[b];
+            }
+        }
+        for (size_t b=0; b < bucketCount; ++b)
+            out << METRIC_PREFIX << "operation_duration_seconds_bucket{" << label << ",le=\"" << DURATION_BUCKETS_S[b]
+                << "\"} " << buckets[b] << "\n";
+        out << METRIC_PREFIX << "operation_duration_seconds_bucket{" << label << ",le=\"+Inf\"} "
+            << it->second.size() << "\n"
+            << METRIC_PREFIX << "operation_duration_seconds_sum{" << label << "} " << sumMs / 1000 << "."
+            << std::setw(3) << std::setfill('0') << sumMs % 1000 << std::setfill(' ') << "\n"
+            << METRIC_PREFIX << "operation_duration_seconds_count{" << label << "} " << it->second.size() << "\n";
+    }
+
+    WriteHeader(out, "operation_failures_total", "counter", "Failed operations on machines (from the stats log).");
+    for (std::map<std::string, std::vector<long long> >::const_iterator it = durations.begin(); it != durations.end(); ++it)
+        out << METRIC_PREFIX << "operation_failures_total{operation=\"" << EscapeLabel(it->first) << "\"} "
+            << failures[it->first] << "\n";
+}
+
+
+std::string EscapeLabel(const std::string& value) {
+    std::string escaped;
+    for (size_t i=0; i < value.size(); ++i) {
+        if (value[i] == '\\' || value[i] == '"')
+            escaped += '\\';
+        if (value[i] == '\n')
+            escaped += "\\n";
+        else
+            escaped += value[i];
+    }
+    return escaped;
+}
+
+} //anonymous namespace
+
+} //namespace Metrics
+} //namespace Launch
@@ -0,0 +1,361 @@
+/**
+ * Pools of pre-warmed machines.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+
+#include <CernVM/Utilities.h>
+
+#include "FileLock.h"
+#include "Fleet.h"
+#include "Pool.h"
+#include "PortAllocator.h"
+#include "RetryPolicy.h"
+#include "Tools.h"
+#include "Trace.h"
+#include "VBoxManage.h"
+#include "WorkerPool.h"
+
+
+namespace Launch {
+namespace Pool {
+
+//helper functions and definitions in an anonymous namespace (local)
+namespace {
+
+const std::string PROFILE_EXTENSION = ".pool";
+const std::string FILL_LOCK_EXTENSION = ".fill.lock";
+const std::string CLAIM_LOCK_EXTENSION = ".lock";
+const std::string LOG_EXTENSION = ".log";
+//Waiting for the boot of a new pool machine (poolBootRetryInitialMs, poolBootRetryMaxMs
+//and poolBootTimeoutMs in the global config), and a timeout of one SSH probe
+const int BOOT_RETRY_INITIAL_MS = 2000;
+const int BOOT_RETRY_MAX_MS = 10000;
+const int BOOT_TIMEOUT_MS = 600000;
+const int SSH_PROBE_TIMEOUT_MS = 3000;
+
+//Registered profile: PROFILE.pool in the pool folder
+struct ProfileInfo {
+    std::string name;
+    std::string file;
+    int size;
+};
+
+boost::filesystem::path GetPoolFolder();
+//Find the registered profile, or register the profile file. count: new size of the pool, 0 to keep it
+bool ResolveProfile(const std::string& profile, unsigned count, ProfileInfo& outInfo);
+bool LoadProfileInfo(const std::string& name, ProfileInfo& outInfo);
+bool StoreProfileInfo(const ProfileInfo& info);
+//Names of the ready machines of the profile, and of the ones which are not ready (yet)
+void CollectPoolMachines(HypervisorContext& ctx, const std::string& profileName,
+                         std::vector<std::string>& outReady, std::vector<std::string>& outUnfinished);
+//Wait until a new pool machine is booted (its SSH server answers), then save it
+bool WarmUpMachine(HypervisorContext& ctx, RequestHandler& handler, const std::string& machineName);
+//Rename a ready machine of the profile to machineName, returns the former name (empty if there is none)
+std::string ClaimMachine(HypervisorContext& ctx, const std::string& profileName, const std::string& machineName);
+//Run 'pool fill PROFILE' in the background
+void StartRefill(const std::string& profileName);
+
+} //anonymous namespace
+
+
+bool Fill(HypervisorContext& ctx, RequestHandler& handler, const std::string& profile, unsigned count,
+          unsigned parallelism) {
+    ProfileInfo info;
+    if (!ResolveProfile(profile, count, info))
+        return false;
+    Fleet::FleetMachine machine;
+    if (!Fleet::LoadMachineFile(info.file, info.name, machine))
+        return false;
+    if (!ctx.hypervisor())
+        return false;
+
+    //one filling process per profile, claims are not blocked by it
+    FileLock fillLock((GetPoolFolder() / (info.name + FILL_LOCK_EXTENSION)).string());
+    if (!fillLock.locked())
+        return false;
+
+    std::vector<std::string> ready, unfinished;
+    CollectPoolMachines(ctx, info.name, ready, unfinished);
+    //machines left by an interrupted fill (nobody else is filling now)
+    for (size_t i=0; i < unfinished.size(); ++i) {
+        std::cout << "Removing the unfinished pool machine: " << unfinished[i] << std::endl;
+        handler.destroyMachine(ctx, unfinished[i], true);
+    }
+
+    if (ready.size() >= static_cast<size_t>(info.size)) {
+        std::cout << "The pool '" << info.name << "' is full: " << ready.size() << " ready machines\n";
+        return true;
+    }
+    unsigned missing = info.size - ready.size();
+    std::cout << "Filling the pool '" << info.name << "': " << ready.size() << " ready, creating " << missing
+              << " machines\n";
+
+    //the machines are named pool-PROFILE-1, pool-PROFILE-2, ... and tagged by the profile
+    Config params = machine.params;
+    params.erase("name");
+    params.set(POOL_PROFILE_PARAM, info.name, CONFIG_LAYER_COMMAND_LINE);
+    bool success = handler.createMachines(ctx, machine.userDataFile, true, params, missing, "pool-" + info.name,
+                                          parallelism);
+
+    std::vector<std::string> created;
+    ready.clear();
+    CollectPoolMachines(ctx, info.name, ready, created);
+    std::vector<bool> results = WorkerPool::Run(created.size(), parallelism, [&](size_t i) {
+        return WarmUpMachine(ctx, handler, created[i]);
+    });
+
+    size_t warmedUp = 0;
+    for (size_t i=0; i < created.size(); ++i) {
+        std::cout << "\t" << created[i] << ": " << (results[i] ? "ready" : "FAILED") << std::endl;
+        if (results[i])
+            ++warmedUp;
+    }
+    std::cout << "The pool '" << info.name << "' has " << ready.size() + warmedUp << " of " << info.size
+              << " ready machines\n";
+
+    return success && warmedUp == created.size();
+}
+
+
+bool Status(HypervisorContext& ctx) {
+    boost::filesystem::path folder = GetPoolFolder();
+    std::vector<std::string> names;
+    boost::system::error_code ec;
+    for (boost::filesystem::directory_iterator it(folder, ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->path().extension() == PROFILE_EXTENSION)
+            names.push_back(it->path().stem().string());
+    }
+    if (names.empty()) {
+        std::cout << "No pools, fill one by: cernvm-launch pool fill PROFILE_FILE NUM\n";
+        return true;
+    }
+    if (!ctx.hypervisor())
+        return false;
+
+    std::sort(names.begin(), names.end());
+    for (size_t i=0; i < names.size(); ++i) {
+        ProfileInfo info;
+        if (!LoadProfileInfo(names[i], info))
+            continue;
+        std::vector<std::string> ready, unfinished;
+        CollectPoolMachines(ctx, info.name, ready, unfinished);
+        std::cout << info.name << ":\tready: " << ready.size() << "/" << info.size
+                  << "\tfilling: " << unfinished.size() << "\tprofile: " << info.file << std::endl;
+    }
+    return true;
+}
+
+
+bool CreateFromPool(HypervisorContext& ctx, RequestHandler& handler, const std::string& profile,
+                    const std::string& machineName, bool startMachine) {
+    ProfileInfo info;
+    if (!ResolveProfile(profile, 0, info) || !ctx.hypervisor())
+        return false;
+
+    std::string name = machineName;
+    if (!isSanitized(&name, SAFE_ALNUM_CHARS)) {
+        std::cerr << "Machine name contains illegal characters, use only following: " << SAFE_ALNUM_CHARS << std::endl;
+        return false;
+    }
+    if (ctx.openSession(machineName)) {
+        std::cerr << "The machine already exists\n";
+        return false;
+    }
+
+    std::string claimed;
+    {
+        //concurrent claims must not take the same machine
+        FileLock claimLock((GetPoolFolder() / (info.name + CLAIM_LOCK_EXTENSION)).string());
+        if (!claimLock.locked())
+            return false;
+        claimed = ClaimMachine(ctx, info.name, machineName);
+    }
+
+    bool success;
+    if (claimed.empty()) {
+        std::cout << "The pool '" << info.name << "' has no ready machine, creating '" << machineName
+                  << "' from the profile\n";
+        Fleet::FleetMachine machine;
+        if (!Fleet::LoadMachineFile(info.file, machineName, machine))
+            return false;
+        success = handler.createMachine(ctx, machine.userDataFile, startMachine, machine.params);
+    }
+    else {
+        std::cout << "Claimed '" << claimed << "' from the pool '" << info.name << "' as '" << machineName << "'\n";
+        success = !startMachine || handler.startMachine(ctx, machineName);
+    }
+
+    StartRefill(info.name);
+    return success;
+}
+
+
+//-----------------------------------------------------------------------------
+// Local helper functions
+//-----------------------------------------------------------------------------
+namespace {
+
+boost::filesystem::path GetPoolFolder() {
+    boost::filesystem::path folder = boost::filesystem::path(Tools::GetDataFolder()) / POOL_FOLDER;
+    boost::system::error_code ec;
+    boost::filesystem::create_directories(folder, ec);
+    return folder;
+}
+
+
+bool ResolveProfile(const std::string& profile, unsigned count, ProfileInfo& outInfo) {
+    boost::system::error_code ec;
+    if (boost::filesystem::is_regular_file(profile, ec)) { //a profile file, register it
+        boost::filesystem::path file = boost::filesystem::absolute(profile);
+        outInfo.name = file.stem().string();
+        bool registered = LoadProfileInfo(outInfo.name, outInfo);
+        if (!registered && count == 0) {
+            std::cerr << "Give the size of the new pool: " << outInfo.name << std::endl;
+            return false;
+        }
+        outInfo.file = file.string();
+    }
+    else if (!LoadProfileInfo(profile, outInfo)) {
+        std::cerr << "Unknown pool: " << profile << ", fill it from a profile file first\n";
+        return false;
+    }
+
+    std::string name = outInfo.name;
+    if (!isSanitized(&name, SAFE_ALNUM_CHARS)) {
+        std::cerr << "Pool name contains illegal characters, use only following: " << SAFE_ALNUM_CHARS << std::endl;
+        return false;
+    }
+    if (count > 0)
+        outInfo.size = count;
+    return StoreProfileInfo(outInfo);
+}
+
+
+bool LoadProfileInfo(const std::string& name, ProfileInfo& outInfo) {
+    boost::filesystem::path file = GetPoolFolder() / (name + PROFILE_EXTENSION);
+    boost::system::error_code ec;
+    if (!boost::filesystem::exists(file, ec))
+        return false;
+
+    Config config;
+    if (!config.loadFile(file.string(), CONFIG_LAYER_FILE))
+        return false;
+    outInfo.name = name;
+    outInfo.file = config.get("profileFile");
+    outInfo.size = config.getInt("size", 0);
+    return !outInfo.file.empty() && outInfo.size > 0;
+}
+
+
+bool StoreProfileInfo(const ProfileInfo& info) {
+    std::string file = (GetPoolFolder() / (info.name + PROFILE_EXTENSION)).string();
+    std::ofstream ofs(file.c_str());
+    ofs << "profileFile=" << info.file << "\n"
+        << "size=" << info.size << "\n";
+    if (!ofs.good()) {
+        std::cerr << "Unable to store the pool: " << file << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+void CollectPoolMachines(HypervisorContext& ctx, const std::string& profileName,
+                         std::vector<std::string>& outReady, std::vector<std::string>& outUnfinished) {
+    sessionMapType sessions = ctx.sessions();
+    for (sessionMapType::const_iterator it = sessions.begin(); it != sessions.end(); ++it) {
+        ParameterMapPtr parameters = it->second->parameters;
+        if (parameters->get(POOL_PROFILE_PARAM, "") != profileName)
+            continue;
+        if (parameters->get(POOL_READY_PARAM, "") == "1")
+            outReady.push_back(parameters->get("name", ""));
+        else
+            outUnfinished.push_back(parameters->get("name", ""));
+    }
+}
+
+
+bool WarmUpMachine(HypervisorContext& ctx, RequestHandler& handler, const std::string& machineName) {
+    HVSessionPtr session = ctx.openSession(machineName);
+    int port = 0;
+    if (!session || !Tools::ParseInt(session->local->get("apiPort", ""), port)) {
+        std::cerr << machineName << ": unable to find the forwarded API port\n";
+        return false;
+    }
+
+    {
+        //the contextualization is done once the SSH server runs
+        Trace::Span span("wait:boot", machineName);
+        RetryPolicy policy = RetryPolicy::FromConfig("poolBoot", BOOT_RETRY_INITIAL_MS, BOOT_RETRY_MAX_MS,
+                                                     BOOT_TIMEOUT_MS);
+        while (!Tools::ProbeSshPort(port, SSH_PROBE_TIMEOUT_MS)) {
+            if (!policy.backoff()) {
+                std::cerr << machineName << ": no SSH server answered on port " << port
+                          << ", the machine did not boot in time (apiPort of the profile must be 22)\n";
+                return false;
+            }
+        }
+    }
+
+    if (!handler.stopMachine(ctx, machineName))
+        return false;
+    session->parameters->set(POOL_READY_PARAM, "1");
+    return true;
+}
+
+
+std::string ClaimMachine(HypervisorContext& ctx, const std::string& profileName, const std::string& machineName) {
+    HVInstancePtr hv = ctx.hypervisor();
+    std::vector<std::string> ready, unfinished;
+    CollectPoolMachines(ctx, profileName, ready, unfinished);
+    ctx.invalidateRunningMachines(); //a machine resumed by someone else is not ready anymore
+
+    for (size_t i=0; i < ready.size(); ++i) {
+        if (ctx.isRunning(ready[i]))
+            continue;
+        HVSessionPtr session = ctx.openSession(ready[i]);
+        if (!session)
+            continue;
+
+        //a saved machine can be renamed, the session follows the machine by its UUID
+        std::vector<std::string> lines;
+        std::vector<std::string> renameArgs = {"modifyvm", VBoxManage::GetMachineId(session), "--name", machineName};
+        if (VBoxManage::Run(hv, renameArgs, &lines) != 0) {
+            std::cerr << "Unable to rename the pool machine '" << ready[i] << "':\n"
+                      << boost::algorithm::join(lines, "\n") << std::endl;
+            continue;
+        }
+        session->parameters->set("name", machineName);
+        session->parameters->erase(POOL_PROFILE_PARAM);
+        session->parameters->erase(POOL_READY_PARAM);
+        ctx.forgetSession(ready[i]);
+        ctx.invalidateRunningMachines();
+        PortAllocator::Rename(ready[i], machineName);
+        return ready[i];
+    }
+    return "";
+}
+
+
+void StartRefill(const std::string& profileName) {
+    std::string executable = Tools::GetExecutablePath();
+    std::vector<std::string> args = {executable, "pool", "fill", profileName};
+    std::string logFile = (GetPoolFolder() / (profileName + LOG_EXTENSION)).string();
+    if (executable.empty() || !Tools::SpawnDetached(args, logFile)) {
+        std::cerr << "Unable to refill the pool in the background, run: cernvm-launch pool fill "
+                  << profileName << std::endl;
+        return;
+    }
+    std::cout << "Refilling the pool '" << profileName << "' in the background (log: " << logFile << ")\n";
+}
+
+} //anonymous namespace
+
+} //namespace Pool
+} //namespace Launch
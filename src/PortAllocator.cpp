@@ -0,0 +1,254 @@
+/**
+ * Host ports forwarded to the API ports of the machines.
+ */
+
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
+#include "FileLock.h"
+#include "PortAllocator.h"
+#include "Tools.h"
+
+
+namespace Launch {
+namespace PortAllocator {
+
+//helper functions and definitions in an anonymous namespace (local)
+namespace {
+
+//Bump the version whenever the file format changes
+const std::string TABLE_HEADER = "launch-port-table";
+const int TABLE_VERSION = 1;
+const std::string LOCK_EXTENSION = ".lock";
+
+//Allocated ports (by the port and by the machine) and the port where the search for a free one
+//continues, so an allocation does not check the ports before the last allocated one again
+struct PortTable {
+    std::map<int, std::string> owners;
+    std::map<std::string, int> ports;
+    int next;
+};
+
+std::string GetTableFile();
+void GetRange(int& outStart, int& outEnd);
+//Load the table (the caller holds the lock). If it does not exist, it is created from the sessions of ctx
+//(or empty without ctx). Returns false if the table is corrupted
+bool LoadTable(HypervisorContext* ctx, PortTable& outTable);
+//Replace the table by a new file (the caller holds the lock)
+bool StoreTable(const PortTable& table);
+//Allocate the port to the machine, or release it (empty machineName)
+void SetOwner(PortTable& table, int port, const std::string& machineName);
+
+} //anonymous namespace
+
+
+bool Allocate(HypervisorContext& ctx, const std::string& machineName, int& outPort) {
+    int rangeStart, rangeEnd;
+    GetRange(rangeStart, rangeEnd);
+    if (rangeStart > rangeEnd) {
+        std::cerr << "Invalid port range: portRangeStart " << rangeStart << " is above portRangeEnd " << rangeEnd
+                  << std::endl;
+        return false;
+    }
+
+    FileLock lock(GetTableFile() + LOCK_EXTENSION);
+    PortTable table;
+    if (!lock.locked() || !LoadTable(&ctx, table))
+        return false;
+
+    std::map<std::string, int>::const_iterator it = table.ports.find(machineName);
+    if (it != table.ports.end()) {
+        outPort = it->second;
+        return true;
+    }
+
+    int port = table.next < rangeStart || table.next > rangeEnd ? rangeStart : table.next;
+    for (int checked=0; checked <= rangeEnd - rangeStart; ++checked, port = port == rangeEnd ? rangeStart : port + 1) {
+        //ports of other programs are only skipped, they may be free next time
+        if (table.owners.count(port) || !Tools::IsTcpPortFree(port))
+            continue;
+        SetOwner(table, port, machineName);
+        table.next = port == rangeEnd ? rangeStart : port + 1;
+        outPort = port;
+        return StoreTable(table);
+    }
+
+    std::cerr << "No free port in the range " << rangeStart << "-" << rangeEnd << ", destroy unused machines "
+              << "or change portRangeStart and portRangeEnd in the global config\n";
+    return false;
+}
+
+
+bool Release(const std::string& machineName) {
+    FileLock lock(GetTableFile() + LOCK_EXTENSION);
+    PortTable table;
+    if (!lock.locked() || !LoadTable(NULL, table))
+        return false;
+
+    std::map<std::string, int>::const_iterator it = table.ports.find(machineName);
+    if (it == table.ports.end())
+        return true;
+    SetOwner(table, it->second, "");
+    return StoreTable(table);
+}
+
+
+bool Rename(const std::string& oldName, const std::string& newName) {
+    FileLock lock(GetTableFile() + LOCK_EXTENSION);
+    PortTable table;
+    if (!lock.locked() || !LoadTable(NULL, table))
+        return false;
+
+    std::map<std::string, int>::const_iterator it = table.ports.find(oldName);
+    if (it == table.ports.end())
+        return true;
+    SetOwner(table, it->second, newName);
+    return StoreTable(table);
+}
+
+
+bool List(HypervisorContext& ctx, std::vector<Allocation>& outAllocations, int& outRangeStart, int& outRangeEnd) {
+    GetRange(outRangeStart, outRangeEnd);
+
+    FileLock lock(GetTableFile() + LOCK_EXTENSION);
+    PortTable table;
+    if (!lock.locked() || !LoadTable(&ctx, table))
+        return false;
+
+    for (std::map<int, std::string>::const_iterator it = table.owners.begin(); it != table.owners.end(); ++it) {
+        Allocation allocation = {it->first, it->second};
+        outAllocations.push_back(allocation);
+    }
+    return true;
+}
+
+
+ReleaseGuard::ReleaseGuard(const std::string& machineName) : _machineName(machineName), _keep(false) {
+}
+
+
+ReleaseGuard::~ReleaseGuard() {
+    if (!_keep)
+        Release(_machineName);
+}
+
+
+void ReleaseGuard::keep() {
+    _keep = true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Local helper functions
+//-----------------------------------------------------------------------------
+namespace {
+
+std::string GetTableFile() {
+    return (boost::filesystem::path(Tools::GetDataFolder()) / PORTS_FILE).string();
+}
+
+
+void GetRange(int& outStart, int& outEnd) {
+    Config* config = Tools::GetGlobalConfig();
+    outStart = config ? config->getInt("portRangeStart", DEFAULT_RANGE_START) : DEFAULT_RANGE_START;
+    outEnd = config ? config->getInt("portRangeEnd", DEFAULT_RANGE_END) : DEFAULT_RANGE_END;
+}
+
+
+//Table file layout:
+//  header line: launch-port-table VERSION NEXT_PORT
+//  one line per allocation: PORT<tab>MACHINE_NAME
+bool LoadTable(HypervisorContext* ctx, PortTable& outTable) {
+    outTable.owners.clear();
+    outTable.ports.clear();
+    outTable.next = 0;
+
+    std::string file = GetTableFile();
+    std::ifstream ifs(file.c_str());
+    if (!ifs.good()) {
+        if (!ctx)
+            return true;
+        //the first allocation, take over the ports the existing machines got from libcernvm
+        sessionMapType sessions = ctx->sessions();
+        for (sessionMapType::const_iterator it = sessions.begin(); it != sessions.end(); ++it) {
+            int port = 0;
+            std::string name = it->second->parameters->get("name", "");
+            if (!name.empty() && Tools::ParseInt(it->second->local->get("apiPort", ""), port)
+                    && !outTable.owners.count(port)) //the first machine keeps a shared port
+                SetOwner(outTable, port, name);
+        }
+        return true;
+    }
+
+    std::string line;
+    std::string headerName;
+    int version = 0;
+    std::istringstream header(std::getline(ifs, line) ? line : "");
+    if (!(header >> headerName >> version >> outTable.next) || headerName != TABLE_HEADER || version != TABLE_VERSION) {
+        std::cerr << "Corrupted port table " << file << ", remove it to rebuild it from the machines\n";
+        return false;
+    }
+    while (std::getline(ifs, line)) {
+        std::vector<std::string> fields = Tools::SplitString(line, '\t', 2);
+        int port = 0;
+        if (fields.size() != 2 || !Tools::ParseInt(fields[0], port)) {
+            std::cerr << "Corrupted port table " << file << ", remove it to rebuild it from the machines\n";
+            return false;
+        }
+        SetOwner(outTable, port, fields[1]);
+    }
+    return true;
+}
+
+
+bool StoreTable(const PortTable& table) {
+    std::string file = GetTableFile();
+    std::ostringstream content;
+    content << TABLE_HEADER << " " << TABLE_VERSION << " " << table.next << "\n";
+    for (std::map<int, std::string>::const_iterator it = table.owners.begin(); it != table.owners.end(); ++it)
+        content << it->first << "\t" << it->second << "\n";
+
+    //write a temporary file and rename it, so the table is never left half written
+    std::string tmpFile = file + ".tmp";
+    bool written;
+    {
+        std::ofstream ofs(tmpFile.c_str(), std::ios::out | std::ios::trunc);
+        ofs << content.str();
+        written = ofs.good();
+    }
+    boost::system::error_code ec;
+    if (written)
+        boost::filesystem::rename(tmpFile, file, ec);
+    if (!written || ec) {
+        boost::filesystem::remove(tmpFile, ec);
+        std::cerr << "Unable to store the port table " << file << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+void SetOwner(PortTable& table, int port, const std::string& machineName) {
+    std::map<int, std::string>::iterator owner = table.owners.find(port);
+    if (owner != table.owners.end()) {
+        table.ports.erase(owner->second);
+        table.owners.erase(owner);
+    }
+    if (machineName.empty())
+        return;
+    //a machine has one port, an older allocation of the same name (e.g. a hand edited table) is dropped
+    std::map<std::string, int>::iterator old = table.ports.find(machineName);
+    if (old != table.ports.end())
+        table.owners.erase(old->second);
+    table.owners[port] = machineName;
+    table.ports[machineName] = port;
+}
+
+} //anonymous namespace
+
+} //namespace PortAllocator
+} //namespace Launch
@@ -0,0 +1,186 @@
+/**
+ * Running a command on several machines over multiplexed SSH connections.
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+
+#include <CernVM/Utilities.h>
+
+#include "RemoteExec.h"
+#include "Tools.h"
+#include "Trace.h"
+#include "WorkerPool.h"
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+
+namespace Launch {
+namespace RemoteExec {
+
+#ifndef _WIN32
+//helper functions and definitions in an anonymous namespace (local)
+namespace {
+
+//A unix socket path has at most 104 characters on Mac (108 on Linux), the control sockets
+//are named by the 40 characters long hash of the connection (%C)
+const size_t MAX_CONTROL_FOLDER_LENGTH = 104 - 42;
+
+//Running machine the command is run on
+struct Target {
+    std::string name;
+    std::string port;
+    int exitCode;
+};
+
+//Get the folder for the control sockets (accessible only by the user), create it if needed
+bool GetControlFolder(std::string& outFolder);
+//Run ssh with the options to the target, its output (and error output) is written into outputFile.
+//Returns the exit code of ssh (255 if it cannot connect), -1 if it cannot be run
+int RunSsh(const std::string& sshBin, const std::vector<std::string>& options, const Target& target,
+           const std::string& user, const std::string& remoteCommand, const std::string& outputFile);
+
+} //anonymous namespace
+#endif
+
+
+bool Run(HypervisorContext& ctx, const std::vector<std::string>& machineNames, const std::string& user,
+         const std::vector<std::string>& command, unsigned parallelism) {
+#ifdef _WIN32
+    std::cerr << "Exec is not supported on Windows\n";
+    return false;
+#else // linux or mac
+    if (!ctx.hypervisor())
+        return false;
+    std::string sshBin = which("ssh"); // goes through PATH env
+    if (sshBin.empty()) {
+        std::cerr << "Unable to locate the SSH binary\n";
+        return false;
+    }
+    std::string controlFolder;
+    if (!GetControlFolder(controlFolder))
+        return false;
+
+    Config* config = Tools::GetGlobalConfig();
+    int persistSeconds = config ? config->getInt("sshControlPersistSeconds", DEFAULT_CONTROL_PERSIST_S)
+                                : DEFAULT_CONTROL_PERSIST_S;
+    std::vector<std::string> options = {
+        "-n", //the commands run concurrently, none of them gets stdin
+        "-o", "BatchMode=yes", //nobody would answer a password prompt
+        "-o", "ControlMaster=auto",
+        "-o", "ControlPath=" + controlFolder + "/%C",
+        "-o", "ControlPersist=" + (persistSeconds > 0 ? std::to_string(persistSeconds) : std::string("no")),
+        //the machines are on localhost ports, which are reused by new machines with new host keys
+        "-o", "StrictHostKeyChecking=no",
+        "-o", "UserKnownHostsFile=/dev/null",
+        "-o", "LogLevel=ERROR",
+    };
+
+    //sessions are opened before the threads are started
+    bool success = true;
+    std::vector<Target> targets;
+    for (size_t i=0; i < machineNames.size(); ++i) {
+        HVSessionPtr session = ctx.openSession(machineNames[i]);
+        Target target = {machineNames[i], session ? session->local->get("apiPort", "") : "", -1};
+        if (!session)
+            std::cerr << "Unable to find the machine: " << target.name << std::endl;
+        else if (target.port.empty())
+            std::cerr << "No ssh port found for the machine: " << target.name << std::endl;
+        else if (!ctx.isRunning(target.name))
+            std::cerr << "Machine '" << target.name << "' is not running\n";
+        else {
+            targets.push_back(target);
+            continue;
+        }
+        success = false;
+    }
+
+    std::string remoteCommand = boost::algorithm::join(command, " ");
+    std::mutex outputMutex;
+    std::vector<bool> results = WorkerPool::Run(targets.size(), parallelism, [&](size_t i) {
+        Target& target = targets[i];
+        std::string outputFile = controlFolder + "/" + target.name + "-" + std::to_string(getpid()) + ".out";
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        {
+            Trace::Span span("exec", target.name);
+            target.exitCode = RunSsh(sshBin, options, target, user, remoteCommand, outputFile);
+        }
+        double seconds = std::chrono::duration_cast<std::chrono::milliseconds>(
+                             std::chrono::steady_clock::now() - start).count() / 1000.0;
+        std::string output;
+        Tools::LoadFileIntoString(outputFile, output);
+        boost::system::error_code ec;
+        boost::filesystem::remove(outputFile, ec);
+
+        //one block per machine, not interleaved with the others
+        std::lock_guard<std::mutex> lock(outputMutex);
+        std::cout << "=== " << target.name << ": exit code " << target.exitCode << " (" << seconds << " s) ===\n"
+                  << output;
+        if (!output.empty() && output[output.size()-1] != '\n')
+            std::cout << '\n';
+        std::cout.flush();
+        return target.exitCode == 0;
+    });
+
+    for (size_t i=0; i < targets.size(); ++i) {
+        if (targets.size() > 1)
+            std::cout << targets[i].name << ": " << (results[i] ? "OK" : "FAILED") << std::endl;
+        success = success && results[i];
+    }
+    return success;
+#endif
+}
+
+
+#ifndef _WIN32
+//-----------------------------------------------------------------------------
+// Local helper functions
+//-----------------------------------------------------------------------------
+namespace {
+
+bool GetControlFolder(std::string& outFolder) {
+    boost::filesystem::path folder = boost::filesystem::path(Tools::GetDataFolder()) / SSH_FOLDER;
+    if (folder.string().size() > MAX_CONTROL_FOLDER_LENGTH) //a deep data folder, use a short path instead
+        folder = boost::filesystem::temp_directory_path() / ("cernvm-launch-" + std::to_string(getuid()));
+
+    boost::system::error_code ec;
+    boost::filesystem::create_directories(folder, ec);
+    if (!ec) //other users must not connect to the machines through the sockets
+        boost::filesystem::permissions(folder, boost::filesystem::owner_all, ec);
+    if (ec) {
+        std::cerr << "Unable to create the folder for SSH control sockets " << folder.string() << ": "
+                  << ec.message() << std::endl;
+        return false;
+    }
+    outFolder = folder.string();
+    return true;
+}
+
+
+int RunSsh(const std::string& sshBin, const std::vector<std::string>& options, const Target& target,
+           const std::string& user, const std::string& remoteCommand, const std::string& outputFile) {
+    std::string command = Tools::QuoteArgument(sshBin);
+    for (size_t i=0; i < options.size(); ++i)
+        command += " " + Tools::QuoteArgument(options[i]);
+    command += " -p " + Tools::QuoteArgument(target.port) + " " + Tools::QuoteArgument(user + "@127.0.0.1")
+               + " " + Tools::QuoteArgument(remoteCommand);
+    //not a pipe: a new master goes to the background and could keep the pipe open until it exits
+    command += " > " + Tools::QuoteArgument(outputFile) + " 2>&1";
+
+    int status = std::system(command.c_str());
+    return (status != -1 && WIFEXITED(status)) ? WEXITSTATUS(status) : -1;
+}
+
+} //anonymous namespace
+#endif
+
+} //namespace RemoteExec
+} //namespace Launch
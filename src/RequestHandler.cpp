@@ -4,9 +4,14 @@
  */
 
 #include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
 #include <iostream>
 #include <utility>
 #include <map>
+#include <mutex>
+#include <set>
 #include <vector>
 #ifndef _WIN32
 #include <unistd.h> // for exec
@@ -22,7 +27,16 @@
 #include <CernVM/Hypervisor/Virtualbox/VBoxCommon.h>
 #include <CernVM/Hypervisor/Virtualbox/VBoxSession.h>
 
+#include "Admission.h"
+#include "ContextIso.h"
+#include "ImageCache.h"
+#include "PortAllocator.h"
 #include "RequestHandler.h"
+#include "RetryPolicy.h"
+#include "Stats.h"
+#include "Trace.h"
+#include "VBoxManage.h"
+#include "WorkerPool.h"
 
 
 using namespace Launch;
@@ -32,10 +46,25 @@ using namespace Launch;
 namespace {
 
 typedef Tools::configMapType                paramMapType;
-typedef std::map<std::string, HVSessionPtr> sessionMapType;
 
-//How many times we try to destroy the VM (must be positive)
-const int DESTROY_TRIES = 2;
+//Defaults of the destroy retry policy (destroyRetryInitialMs, destroyRetryMaxMs and destroyTimeoutMs in the global config)
+const int DESTROY_RETRY_INITIAL_MS = 250;
+const int DESTROY_RETRY_MAX_MS = 4000;
+const int DESTROY_TIMEOUT_MS = 60000;
+
+//Defaults of the wait for a booted machine (readyRetryInitialMs, readyRetryMaxMs and readyTimeoutMs in the global config)
+const int READY_RETRY_INITIAL_MS = 50;
+const int READY_RETRY_MAX_MS = 500;
+const int READY_TIMEOUT_MS = 300000;
+//Deadline of a single probe of the SSH port
+const int READY_PROBE_TIMEOUT_MS = 1000;
+
+//State of a machine in VirtualBox, as seen while waiting for destroy
+enum MachineLockState {
+    MACHINE_LOCKED,       //a session holds the machine, or it is changing its state
+    MACHINE_RELEASED,     //the machine can be unregistered
+    MACHINE_UNREGISTERED, //VirtualBox does not know the machine anymore
+};
 
 //If no parameters are provided (either via user param file or global config), these are used
 const paramMapType DefaultCreationParams = {
@@ -59,10 +88,53 @@ const std::vector<std::string> CreationInfoFields = {
 };
 
 
+//Parameters not listed by 'list --format json': the user data may contain credentials
+const std::vector<std::string> HiddenListParameters = {
+    "secret",
+    "userData",
+};
+
 //Check if the params have all the required params, print error message and return false if not
 bool CheckCreationParameters(ParameterMapPtr params);
+//Check if the showvminfo output lists a snapshot with the given name
+bool HasSnapshot(const VBoxManage::vmInfoType& info, const std::string& snapshotName);
+//Position of a snapshot in the tree from its key in the showvminfo output, e.g. {1, 10} for SnapshotName-1-10
+std::vector<int> SnapshotPath(const std::string& key);
+//Get the UUIDs of all snapshots with the name, from the showvminfo output
+std::vector<std::string> GetSnapshotUUIDs(const VBoxManage::vmInfoType& info, const std::string& snapshotName);
+//Wait until VirtualBox releases the machine (e.g. after a power off), until the deadline of the policy
+bool WaitForRelease(HVInstancePtr hv, const std::string& machineId, const std::string& machineName, RetryPolicy& retry);
+//Milliseconds since the last state change of the machine (e.g. its start), from VMStateChangeTime
+//of the showvminfo output. Returns -1 if the time is not known
+long long MsSinceStateChange(const VBoxManage::vmInfoType& info);
+//State of the machine from the showvminfo output (running, paused, saved, poweroff, ...),
+//empty if VirtualBox does not know the machine
+std::string GetVMState(HVInstancePtr hv, HVSessionPtr session);
+//Query VirtualBox whether the machine (UUID or name) can be unregistered now
+MachineLockState GetMachineLockState(HVInstancePtr hv, const std::string& machineId);
+//Make a libcernvm session for a freshly cloned machine, so it can be managed as any other machine.
+//Moves the API port forwarding of the clone to a free host port and applies cpus and memory from params
+bool AdoptLinkedClone(HypervisorContext& ctx, HVSessionPtr base, const std::string& machineName,
+                      const Config& params);
+//Create a machine from checked parameters (including the name).
+//bulk: the machine is a part of a bulk creation, messages are prefixed by the machine name
+//and the used parameters are not printed
+//contextIso: cached context ISO to attach instead of letting libcernvm build one, empty to disable
+bool CreatePreparedMachine(HypervisorContext& ctx, ParameterMapPtr parameters, bool startMachine, bool bulk,
+                           const std::string& contextIso);
+//Download the CernVM image required by the parameters (if not cached yet)
+bool PrefetchCernVMImage(HVInstancePtr hv, ParameterMapPtr parameters);
+//Get the cached context ISO for the user data in the parameters and the extra files.
+//outIso is empty if libcernvm builds the ISO (no user data, or the cache is disabled and there are no extra files)
+bool PrepareContextIso(ParameterMapPtr parameters, const std::vector<ContextIso::ContextFile>& contextFiles,
+                       std::string& outIso);
+//Add the user data, the global config and the default values to the creation parameters
+bool PrepareCreationParameters(const std::string& userDataFile, Config& params);
 std::string  PromptForMachineName(const std::string& defaultValue);
-HVSessionPtr FindSessionByName(const std::string& machineName, HVInstancePtr& hypervisor, bool loadSessions=false);
+//Print the parameter map as a JSON object, except the hidden keys
+void PrintParametersJson(ParameterMapPtr paramMap, const std::vector<std::string>& hiddenKeys);
+//Print one machine of 'list --format json'
+void PrintMachineJson(const std::string& name, bool running, HVSessionPtr session);
 
 } //anonymous namespace
 
@@ -71,59 +143,39 @@ HVSessionPtr FindSessionByName(const std::string& machineName, HVInstancePtr& hy
 // RequestHandler class
 //-----------------------------------------------------------------------------
 
-bool RequestHandler::listCvmMachines() {
-    HVInstancePtr hv = detectHypervisor();
-    if (!hv) {
-        std::cerr << "Unable to detect hypervisor\n";
+bool RequestHandler::listCvmMachines(HypervisorContext& ctx) {
+    //basic information about stored sessions, without parsing every session file
+    const std::vector<SessionIndexEntry>* entries = ctx.indexedSessions();
+    if (!entries)
         return false;
-    }
-
-    //load previously stored sessions
-    hv->loadSessions();
-    sessionMapType sessions = hv->sessions;
-
-    for(sessionMapType::iterator it=sessions.begin(); it != sessions.end(); ++it) {
-        HVSessionPtr session = it->second;
-
-        std::string name = session->parameters->get("name", "");
-        std::string cvmVersion = session->parameters->get("cernvmVersion", "");
-        std::string apiPort = session->local->get("apiPort", "");
 
-        if (!name.empty() && !cvmVersion.empty())
-            std::cout << name << ":\tCVM: " << cvmVersion << "\tport: " << apiPort << std::endl;
+    std::vector<SessionIndexEntry>::const_iterator it = entries->begin();
+    for (; it != entries->end(); ++it) {
+        if (!it->name.empty() && !it->cernvmVersion.empty())
+            std::cout << it->name << ":\tCVM: " << it->cernvmVersion << "\tport: " << it->apiPort << std::endl;
     }
 
     return true;
 }
 
 
-bool RequestHandler::listRunningCvmMachines() {
-    HVInstancePtr hv = detectHypervisor();
-    if (!hv) {
-        std::cerr << "Unable to detect hypervisor\n";
+bool RequestHandler::listRunningCvmMachines(HypervisorContext& ctx) {
+    //basic information about stored sessions, without parsing every session file
+    const std::vector<SessionIndexEntry>* entries = ctx.indexedSessions();
+    if (!entries)
         return false;
-    }
-
-    //load previously stored sessions
-    hv->loadSessions();
-
-    sessionMapType sessions = hv->sessions;
-    if (sessions.size() == 0) //we have no our sessions
+    if (entries->size() == 0) //we have no our sessions
         return true;
 
-    std::vector<std::string> runningVms = hv->getRunningMachines();
-
-    for(sessionMapType::iterator it=sessions.begin(); it != sessions.end(); ++it) {
-        HVSessionPtr session = it->second;
-
-        std::string name = session->parameters->get("name", "");
-        std::string cvmVersion = session->parameters->get("cernvmVersion", "");
-        std::string apiPort = session->local->get("apiPort", "");
+    const runningSetType* runningVms = ctx.runningMachines();
+    if (!runningVms)
+        return false;
 
-        if (!name.empty() && !cvmVersion.empty()
-                && std::find(runningVms.begin(), runningVms.end(), name) != runningVms.end()) {
+    std::vector<SessionIndexEntry>::const_iterator it = entries->begin();
+    for (; it != entries->end(); ++it) {
+        if (!it->name.empty() && !it->cernvmVersion.empty() && runningVms->count(it->name)) {
             //we've got a CVM machine, which is running
-            std::cout << name << ":\tCVM: " << cvmVersion << "\tport: " << apiPort << std::endl;
+            std::cout << it->name << ":\tCVM: " << it->cernvmVersion << "\tport: " << it->apiPort << std::endl;
         }
     }
 
@@ -131,22 +183,16 @@ bool RequestHandler::listRunningCvmMachines() {
 }
 
 
-bool RequestHandler::isMachineRunning(const std::string& machineName) {
-    HVInstancePtr hv = detectHypervisor();
-    if (!hv) {
-        std::cerr << "Unable to detect hypervisor\n";
+bool RequestHandler::isMachineRunning(HypervisorContext& ctx, const std::string& machineName) {
+    if (!ctx.hypervisor())
         return false;
-    }
-
-    //load previously stored sessions
-    hv->loadSessions();
 
-    sessionMapType sessions = hv->sessions;
+    //load previously stored sessions (a copy, other threads may be deleting sessions meanwhile)
+    sessionMapType sessions = ctx.sessions();
     if (sessions.size() == 0) //we have no our sessions
         return false;
 
-    std::vector<std::string> runningVms = hv->getRunningMachines();
-    for(sessionMapType::iterator it=sessions.begin(); it != sessions.end(); ++it) {
+    for(sessionMapType::const_iterator it=sessions.begin(); it != sessions.end(); ++it) {
         HVSessionPtr session = it->second;
 
         std::string name = session->parameters->get("name", "");
@@ -154,7 +200,7 @@ bool RequestHandler::isMachineRunning(const std::string& machineName) {
             continue;
 
         //we got our machine
-        if (std::find(runningVms.begin(), runningVms.end(), name) != runningVms.end())
+        if (ctx.isRunning(name))
             return true;
     }
 
@@ -162,16 +208,12 @@ bool RequestHandler::isMachineRunning(const std::string& machineName) {
 }
 
 
-bool RequestHandler::listMachineDetail(const std::string& machineName) {
-    HVInstancePtr hv = detectHypervisor();
-    if (!hv) {
-        std::cerr << "Unable to detect hypervisor\n";
+bool RequestHandler::listMachineDetail(HypervisorContext& ctx, const std::string& machineName) {
+    HVInstancePtr hv = ctx.hypervisor();
+    if (!hv)
         return false;
-    }
-
-    hv->loadSessions();
 
-    HVSessionPtr session = hv->sessionByName(machineName);
+    HVSessionPtr session = ctx.sessionByName(machineName);
     if (!session) {
         std::cerr << "Unable to find the machine: " << machineName << std::endl;
         return false; //we didn't match the name
@@ -208,93 +250,84 @@ bool RequestHandler::listMachineDetail(const std::string& machineName) {
 }
 
 
-bool RequestHandler::createMachine(const std::string& userDataFile, bool startMachine, Tools::configMapType& paramMap) {
-    HVInstancePtr hv = detectHypervisor();
-    if (!hv) {
-        std::cerr << "Unable to detect hypervisor\n";
+bool RequestHandler::listMachinesJson(HypervisorContext& ctx, bool runningOnly, const std::string& machineName) {
+    if (!ctx.hypervisor())
         return false;
-    }
 
-    Tools::configMapType::iterator it;
+    //one libcernvm initialisation and one VBoxManage call for all the machines
+    sessionMapType sessions = ctx.sessions();
+    const runningSetType* runningVms = ctx.runningMachines();
+    if (!runningVms)
+        return false;
 
-    if (userDataFile.empty()) { // no user data provided, ask to use the default
-        std::string decision;
-        std::cout << "You have not provided a user data file, do you want to use a default one?\n";
-        std::cout << "Default user data:\n\n" << DEFAULT_USER_DATA << std::endl;
-        std::cout << "Continue with default context? [Y/n]: "; //default is yes
-        bool gotInput = Tools::GetUserInput(decision);
-        boost::algorithm::to_lower(decision);
+    bool found = false;
+    std::cout << "[";
+    for (sessionMapType::const_iterator it = sessions.begin(); it != sessions.end(); ++it) {
+        std::string name = it->second->parameters->get("name", "");
+        if (name.empty() || (!machineName.empty() && name != machineName))
+            continue;
+        bool running = runningVms->count(name) > 0;
+        if (runningOnly && !running)
+            continue;
 
-        if (gotInput && decision != "y" && decision != "yes") { //something else than yes
-            std::cout << "Aborting, no context provided\n";
-            return false;
-        }
-        //Save user data
-        paramMap.insert(std::make_pair<const std::string, const std::string>("userData", static_cast<const std::string>(DEFAULT_USER_DATA)));
+        std::cout << (found ? ",\n" : "\n");
+        PrintMachineJson(name, running, it->second);
+        std::cout << std::flush; //consumers can process the machines while the rest is listed
+        found = true;
     }
-    else { //user wants to provide the user data
-        std::string userData;
-        bool res = Tools::LoadFileIntoString(userDataFile, userData);
+    std::cout << (found ? "\n]\n" : "]\n");
 
-        if (!res) {
-            std::cerr << "Error while processing file: " << userDataFile << std::endl;
-            return false;
-        }
-        //if user accidentally specified userData in parameter map file, we overwrite it
-        it = paramMap.find("userData");
-        if (it != paramMap.end()) {
-            std::cout << "Ignoring the userData specified in the parameter file, using userData file instead\n";
-            paramMap.erase(it);
-        }
-        //Save user data
-        paramMap.insert(std::make_pair<const std::string, const std::string>("userData", static_cast<const std::string>(userData)));
+    if (!machineName.empty() && !found) {
+        std::cerr << "Unable to find the machine: " << machineName << std::endl;
+        return false;
     }
+    return true;
+}
 
-    //Load missing values from the global config file
-    Tools::configMapTypePtr configMap = Tools::GetGlobalConfig();
-    if (configMap)
-        Tools::AddMissingValuesToMap(paramMap, *configMap);
 
-    //Load missing values from the hardcoded config
-    Tools::AddMissingValuesToMap(paramMap, DefaultCreationParams);
+bool RequestHandler::listPortAllocations(HypervisorContext& ctx, bool runningOnly, const std::string& machineName) {
+    if (!ctx.hypervisor())
+        return false;
 
-    //If user wants to create the machine from his own ISO, we need to let libcernvm know
-    if (paramMap.find("isoPath") != paramMap.end()) {
-        std::string isoPath = paramMap.at("isoPath");
-        if (! file_exists(isoPath)) {
-            std::cerr << "Provided ISO path '" << isoPath << "' does not exist or is not readable\n";
-            return false;
-        }
+    std::vector<PortAllocator::Allocation> allocations;
+    int rangeStart, rangeEnd;
+    if (!PortAllocator::List(ctx, allocations, rangeStart, rangeEnd))
+        return false;
 
-        //Set the import flag
-        std::string flags;
-        it = paramMap.find("flags");
-        if (it == paramMap.end())
-            flags = "49";
-        else {
-            flags = it->second;
-            paramMap.erase(it);
-        }
+    std::cout << "Port range: " << rangeStart << "-" << rangeEnd << std::endl;
+    for (size_t i=0; i < allocations.size(); ++i) {
+        const std::string& name = allocations[i].machineName;
+        if ((!machineName.empty() && name != machineName) || (runningOnly && !ctx.isRunning(name)))
+            continue;
+        std::cout << allocations[i].port << "\t" << name;
+        if (!ctx.sessionByName(name)) //a lookup only, opening every session would start its FSM
+            std::cout << "\t(no such machine)";
+        else if (allocations[i].port < rangeStart || allocations[i].port > rangeEnd)
+            std::cout << "\t(out of the range)";
+        std::cout << std::endl;
+    }
 
-        Tools::SetFlagsInString(flags, HVF_DEPLOYMENT_ISO_LOCAL);
-        paramMap.insert(std::make_pair("flags", flags));
+    return true;
+}
 
-        //We don't know what CernVM ISO version user provided, so we just set the cernvmVersion to the given path
-        paramMap.erase(paramMap.find("cernvmVersion"));
-        paramMap.insert(std::make_pair("cernvmVersion", isoPath));
-    }
 
-    //Convert the parameter map from std::map
+bool RequestHandler::createMachine(HypervisorContext& ctx, const std::string& userDataFile, bool startMachine,
+                                   Config& params,
+                                   const std::vector<ContextIso::ContextFile>& contextFiles) {
+    if (!ctx.hypervisor())
+        return false;
+
+    if (!PrepareCreationParameters(userDataFile, params))
+        return false;
+
+    //Convert the resolved parameters into the libcernvm parameter map
     ParameterMapPtr parameters = ParameterMap::instance();
+    paramMapType paramMap = params.toMap();
     parameters->fromMap(&paramMap);
 
     if (!CheckCreationParameters(parameters))
         return false; // user forgot to specify some parameters
 
-    //The same machine can already have a session, check it
-    hv->loadSessions();
-    sessionMapType sessions = hv->sessions;
-
     std::string machineName = parameters->get("name", "");
 
     //VM name missing, prompt the user
@@ -309,51 +342,267 @@ bool RequestHandler::createMachine(const std::string& userDataFile, bool startMa
         parameters->set("name", machineName);
     }
 
+    //through the image cache, so the image is stored once and its use is recorded
+    if (!PrefetchCernVMImage(ctx.hypervisor(), parameters))
+        return false;
+
+    std::string contextIso;
+    if (!PrepareContextIso(parameters, contextFiles, contextIso))
+        return false;
+
+    return CreatePreparedMachine(ctx, parameters, startMachine, false, contextIso);
+}
+
+
+bool RequestHandler::createMachines(HypervisorContext& ctx, const std::string& userDataFile, bool startMachine,
+                                    Config& params, unsigned count, const std::string& namePrefix,
+                                    unsigned parallelism, const std::vector<ContextIso::ContextFile>& contextFiles) {
+    HVInstancePtr hv = ctx.hypervisor();
+    if (!hv)
+        return false;
+
+    std::string prefix = namePrefix;
+    if (prefix.empty() || ! isSanitized(&prefix, SAFE_ALNUM_CHARS)) {
+        std::cerr << "Name prefix must not be empty and can contain only following characters: "
+                  << SAFE_ALNUM_CHARS << std::endl;
+        return false;
+    }
+
+    //user data, config and default values are processed only once, they are the same for all machines
+    if (!PrepareCreationParameters(userDataFile, params))
+        return false;
+
+    ParameterMapPtr parameters = ParameterMap::instance();
+    paramMapType paramMap = params.toMap();
+    parameters->fromMap(&paramMap);
+    if (!CheckCreationParameters(parameters))
+        return false;
+
+    //auto-suffixed names: prefix-1, prefix-2, ..., skipping names of the existing machines
+    const std::vector<SessionIndexEntry>* entries = ctx.indexedSessions();
+    if (!entries)
+        return false;
+    std::set<std::string> existingNames;
+    for (std::vector<SessionIndexEntry>::const_iterator it = entries->begin(); it != entries->end(); ++it)
+        existingNames.insert(it->name);
+
+    std::vector<std::string> names;
+    std::vector<ParameterMapPtr> machineParameters;
+    for (unsigned suffix = 1; names.size() < count; ++suffix) {
+        std::string name = prefix + "-" + std::to_string(suffix);
+        if (existingNames.count(name))
+            continue;
+        //every machine gets its own copy, so nothing is shared between the worker threads
+        ParameterMapPtr machineParams = ParameterMap::instance();
+        machineParams->fromParameters(parameters, false, true);
+        machineParams->set("name", name);
+        names.push_back(name);
+        machineParameters.push_back(machineParams);
+    }
+
+    std::cout << "Creating " << count << " machines (" << parallelism << " at once) with parameters:\n";
+    Tools::PrintParameters(CreationInfoFields, parameters);
+
+    //all machines would download the same image at once, so download it before creating them
+    if (!PrefetchCernVMImage(hv, parameters))
+        return false;
+
+    //all machines share the user data and so the context ISO
+    std::string contextIso;
+    if (!PrepareContextIso(parameters, contextFiles, contextIso))
+        return false;
+
+    std::vector<bool> results = WorkerPool::Run(names.size(), parallelism, [&](size_t i) {
+        Trace::Span span("createMachine", names[i]);
+        return CreatePreparedMachine(ctx, machineParameters[i], startMachine, true, contextIso);
+    });
+
+    std::cout << "Summary:\n";
+    size_t created = 0;
+    for (size_t i=0; i < names.size(); ++i) {
+        std::cout << "\t" << names[i] << ": " << (results[i] ? "created" : "FAILED") << std::endl;
+        if (results[i])
+            ++created;
+    }
+    std::cout << "Created " << created << " of " << names.size() << " machines\n";
+
+    return created == names.size();
+}
+
+
+bool RequestHandler::createLinkedClone(HypervisorContext& ctx, const std::string& baseName, bool startMachine,
+                                       Config& params) {
+    HVInstancePtr hv = ctx.hypervisor();
+    if (!hv)
+        return false;
+
+    std::vector<std::string> keys = params.keys();
+    for (std::vector<std::string>::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+        if (*it != "name" && *it != "cpus" && *it != "memory") {
+            std::cerr << "Parameter '" << *it << "' cannot be used for a linked clone, "
+                      << "only name, cpus and memory can be changed\n";
+            return false;
+        }
+    }
+
+    HVSessionPtr base = ctx.openSession(baseName);
+    if (!base) {
+        std::cerr << "Unable to find the machine: " << baseName << std::endl;
+        return false;
+    }
+    std::string baseId = VBoxManage::GetMachineId(base);
+    VBoxManage::vmInfoType baseInfo;
+    if (!VBoxManage::GetVMInfo(hv, baseId, baseInfo) || !HasSnapshot(baseInfo, GOLDEN_SNAPSHOT)) {
+        std::cerr << "The machine '" << baseName << "' has no golden snapshot, prepare it with: "
+                  << "cernvm-launch golden " << baseName << std::endl;
+        return false;
+    }
+
+    std::string machineName = params.has("name") ? params.get("name") : PromptForMachineName(baseName + "-clone");
     if (! isSanitized(&machineName, SAFE_ALNUM_CHARS)) {
         std::cerr << "Machine name contains illegal characters, use only following: " << SAFE_ALNUM_CHARS << std::endl;
         return false;
     }
-
-    if (FindSessionByName(machineName, hv)) { //we already have this session
+    if (ctx.openSession(machineName)) {
         std::cerr << "The machine already exists\n";
         return false;
     }
 
-    //allocate a new session
-    HVSessionPtr session = hv->allocateSession();
+    Stats::Operation operation(ctx, "clone", machineName);
+    operation.setCernVMVersion(base->parameters->get("cernvmVersion", ""));
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
-    //load our parameters into the newly created session
-    session->parameters->fromParameters(parameters, false, true); //don't clear defaults, but overwrite local keys
-    session->wait();
+    //the reservation is held until the clone is running, as in CreatePreparedMachine
+    Admission::Reservation reservation;
+    if (startMachine) {
+        Trace::Span span("admission", machineName);
+        if (!Admission::Admit(ctx, machineName, params.getInt("memory", base->parameters->getNum<int>("memory", 0)),
+                              params.getInt("cpus", base->parameters->getNum<int>("cpus", 0)), reservation))
+            return false;
+    }
+    std::vector<std::string> lines;
+    std::vector<std::string> cloneArgs = {"clonevm", baseId, "--snapshot", GOLDEN_SNAPSHOT, "--options", "link",
+                                          "--name", machineName, "--register"};
+    std::string baseFolder = base->local->get("baseFolder", "");
+    if (!baseFolder.empty()) { //keep the clone next to the base, VirtualBox creates a subfolder for it
+        cloneArgs.push_back("--basefolder");
+        cloneArgs.push_back(boost::filesystem::path(baseFolder).parent_path().string());
+    }
+    if (VBoxManage::Run(hv, cloneArgs, &lines) != 0) {
+        std::cerr << "Unable to clone the machine '" << baseName << "':\n" << boost::algorithm::join(lines, "\n") << std::endl;
+        return false;
+    }
 
-    //get our newly allocated session and open it (i.e. start the FSM => initiate the creation)
-    session = FindSessionByName(machineName, hv);
+    bool success = AdoptLinkedClone(ctx, base, machineName, params);
+    if (!success) {
+        std::cerr << "Removing the unfinished clone\n";
+        std::vector<std::string> removeArgs = {"unregistervm", machineName, "--delete"};
+        VBoxManage::Run(hv, removeArgs);
+        return false;
+    }
+
+    HVSessionPtr session = ctx.openSession(machineName);
     if (!session) {
         std::cerr << "Could not open the session\n";
         return false;
     }
+    if (startMachine) {
+        Trace::Span span("wait:start", machineName);
+        session->start(ParameterMap::instance());
+        session->wait();
+    }
+    ctx.invalidateRunningMachines();
+    if (startMachine && !ctx.isRunning(machineName)) {
+        std::cerr << "The linked clone '" << machineName << "' was created, but it did not start\n";
+        return false;
+    }
 
-    //we need to start the session, so the creation process gets initiated
-    ParameterMapPtr emptyMap = ParameterMap::instance(); //we don't want to specify additional parameters
-    session->start(emptyMap); //start scheduled
-    session->wait(); //wait for the session until it finishes all tasks
-
-    std::cout << "Parameters used for the machine creation:\n";
+    double seconds = std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::steady_clock::now() - start).count() / 1000.0;
+    std::cout << "Linked clone of '" << baseName << "' created in " << seconds << " s:\n";
     Tools::PrintParameters(CreationInfoFields, session->parameters);
+    std::cout << "\tapiPort (localhost): " << session->local->get("apiPort", "") << std::endl;
 
-    if (!startMachine) { //stop the session if required
-        session->stop();
-        session->wait();
+    operation.succeeded();
+    return true;
+}
+
+
+bool RequestHandler::goldenMachine(HypervisorContext& ctx, const std::string& machineName) {
+    HVInstancePtr hv = ctx.hypervisor();
+    if (!hv)
+        return false;
+
+    HVSessionPtr session = ctx.openSession(machineName);
+    if (!session) {
+        std::cerr << "Unable to find the machine: " << machineName << std::endl;
+        return false;
+    }
+    if (ctx.isRunning(machineName)) {
+        std::cerr << "The machine '" << machineName << "' is running, stop it first\n";
+        return false;
+    }
+
+    std::string machineId = VBoxManage::GetMachineId(session);
+    VBoxManage::vmInfoType info;
+    if (!VBoxManage::GetVMInfo(hv, machineId, info)) {
+        std::cerr << "Unable to get information about the machine: " << machineName << std::endl;
+        return false;
+    }
+
+    if (HasSnapshot(info, GOLDEN_SNAPSHOT))
+        std::cout << "The machine '" << machineName << "' already has the golden snapshot\n";
+    else {
+        std::vector<std::string> lines;
+        std::vector<std::string> args = {"snapshot", machineId, "take", GOLDEN_SNAPSHOT,
+                                         "--description", "Base of CernVM-Launch linked clones"};
+        if (VBoxManage::Run(hv, args, &lines) != 0) {
+            std::cerr << "Unable to take the snapshot:\n" << boost::algorithm::join(lines, "\n") << std::endl;
+            return false;
+        }
+        std::cout << "Golden snapshot of '" << machineName << "' taken\n";
     }
+    std::cout << "Create linked clones with: cernvm-launch create --linked-from " << machineName << " --name NAME\n";
 
     return true;
 }
 
 
-bool RequestHandler::importMachine(const std::string& imageFilename, bool startMachine, Tools::configMapType& paramMap) {
+bool RequestHandler::prefetchImages(HypervisorContext& ctx, const std::vector<std::string>& versions,
+                                    const std::string& flavor, const std::string& arch) {
+    HVInstancePtr hv = ctx.hypervisor();
+    if (!hv)
+        return false;
+
+    ImageCache cache(Tools::GetDataFolder() + "/" + IMAGE_CACHE_FOLDER);
+    bool success = true;
+    for (size_t i=0; i < versions.size(); ++i) {
+        std::cout << "Fetching CernVM " << versions[i] << " (" << flavor << ", " << arch << ")...\n";
+        std::string imageFile;
+        if (cache.fetch(hv, versions[i], flavor, arch, imageFile))
+            std::cout << "\t" << imageFile << std::endl;
+        else
+            success = false;
+    }
+    cache.evict(hv, ImageCache::SizeLimit());
+    cache.print();
+
+    return success;
+}
+
+
+bool RequestHandler::listCachedImages() {
+    ImageCache cache(Tools::GetDataFolder() + "/" + IMAGE_CACHE_FOLDER);
+    cache.print();
+    return true;
+}
+
+
+bool RequestHandler::importMachine(HypervisorContext& ctx, const std::string& imageFilename, bool startMachine,
+                                   Config& params) {
     //set all the required information for the libcernvm
     //set the ovaImport flag, so libcernvm knows we're making OVA import
-    paramMap.insert(std::make_pair("ovaImport", "true"));
+    params.set("ovaImport", "true", CONFIG_LAYER_COMMAND_LINE);
 
     //made path canonical and save it
     boost::filesystem::path imageFilePath;
@@ -366,37 +615,23 @@ bool RequestHandler::importMachine(const std::string& imageFilename, bool startM
         return false;
     }
 
-    Tools::configMapType::iterator it = paramMap.find("ovaPath");
-    if (it != paramMap.end())
-        paramMap.erase(it);
-    paramMap.insert(std::make_pair("ovaPath", imageFilePath.string()));
+    params.set("ovaPath", imageFilePath.string(), CONFIG_LAYER_COMMAND_LINE);
 
     //set the import flag
-    std::string flags;
-    it = paramMap.find("flags");
-    if (it == paramMap.end())
-        flags = "49";
-    else {
-        flags = it->second;
-        paramMap.erase(it);
-    }
-
+    std::string flags = params.get("flags", "49");
     Tools::SetFlagsInString(flags, HVF_IMPORT_OVA);
+    params.set("flags", flags, CONFIG_LAYER_COMMAND_LINE);
 
-    paramMap.insert(std::make_pair("flags", flags));
-
-    return this->createMachine("", startMachine, paramMap); // no user data file
+    return this->createMachine(ctx, "", startMachine, params); // no user data file
 }
 
 
-bool RequestHandler::destroyMachine(const std::string& machineName, bool force) {
-    HVInstancePtr hv = detectHypervisor();
-    if (!hv) {
-        std::cerr << "Unable to detect hypervisor\n";
+bool RequestHandler::destroyMachine(HypervisorContext& ctx, const std::string& machineName, bool force) {
+    HVInstancePtr hv = ctx.hypervisor();
+    if (!hv)
         return false;
-    }
 
-    HVSessionPtr session = FindSessionByName(machineName, hv, true);
+    HVSessionPtr session = ctx.openSession(machineName);
     if (!session) {
         std::cerr << "Unable to find the machine: " << machineName << std::endl;
         return false; //we didn't match the name
@@ -408,7 +643,8 @@ bool RequestHandler::destroyMachine(const std::string& machineName, bool force)
         return false;
     }
 
-    if (this->isMachineRunning(machineName)) {
+    Stats::Operation operation(ctx, "destroy", machineName);
+    if (ctx.isRunning(machineName)) { //the session is opened already, no need to look it up again
         if (!force) { //prompt user for confirmation
             std::cout << "The machine '" << machineName << "' is running, do you want do destroy it? [y/N]: ";
             std::string decision;
@@ -416,64 +652,253 @@ bool RequestHandler::destroyMachine(const std::string& machineName, bool force)
             boost::algorithm::to_lower(decision);
 
             if (!gotInput || (decision != "y" && decision != "yes")) { //just <Enter> or something else than yes
+                operation.cancel();
                 return true; //user does not want to destroy it
             }
         }
+        Trace::Span span("wait:stop", machineName);
         vboxSession->stop();
         vboxSession->wait();
     }
 
+    //destroyVM fails while VirtualBox still holds a lock on the machine (e.g. just after it was stopped),
+    //so we wait for VirtualBox to release it and try again, until the deadline
+    RetryPolicy retry = RetryPolicy::FromConfig("destroy", DESTROY_RETRY_INITIAL_MS, DESTROY_RETRY_MAX_MS,
+                                                DESTROY_TIMEOUT_MS);
+    std::string machineId = VBoxManage::GetMachineId(session);
+    int attempts = 0;
+    int unlockedFailures = 0; //attempts which failed although the machine was not locked
     int ret;
-    for (int i=0; i < DESTROY_TRIES; ++i) {
-        ret = vboxSession->destroyVM();
-        vboxSession->wait();
-
+    while (true) {
+        {
+            Trace::Span span("wait:destroyVM", machineName);
+            ret = vboxSession->destroyVM();
+            vboxSession->wait();
+        }
+        ++attempts;
         if (ret == HVE_OK)
             break;
 
-        sleepMs(6000); //give VBox time to recover
+        MachineLockState lockState = MACHINE_LOCKED;
+        int polls = 0;
+        {
+            Trace::Span span("wait:release", machineName);
+            do {
+                if (!retry.backoff()) //deadline passed
+                    break;
+                lockState = GetMachineLockState(hv, machineId);
+                ++polls;
+            } while (lockState == MACHINE_LOCKED);
+        }
+        if (lockState == MACHINE_UNREGISTERED) { //the previous attempt got through after all
+            ret = HVE_OK;
+            break;
+        }
+        if (lockState == MACHINE_LOCKED) //still locked at the deadline
+            break;
+        //not a lock (e.g. linked clones still use the disks of the machine), waiting would not help
+        if (polls == 1 && ++unlockedFailures == 2)
+            break;
     }
     if (ret != HVE_OK) { // we failed every time
-        std::cerr << "Unable to delete the machine, tried " << DESTROY_TRIES << " times\n";
+        std::cerr << "Unable to delete the machine " << machineName << ", tried " << attempts << " times in "
+                  << retry.elapsedMs() / 1000.0 << " s\n";
         return false;
     }
-    hv->sessionDelete(session);
+    {
+        //deleting modifies the sessions of the hypervisor, other threads may be using them
+        std::lock_guard<std::recursive_mutex> lock(ctx.mutex());
+        hv->sessionDelete(session);
+    }
+    ctx.forgetSession(machineName);
+    PortAllocator::Release(machineName);
 
+    operation.succeeded();
     return true;
 }
 
 
-bool RequestHandler::pauseMachine(const std::string& machineName) {
-    HVInstancePtr hv = detectHypervisor();
-    if (!hv) {
-        std::cerr << "Unable to detect hypervisor\n";
+bool RequestHandler::destroyMachines(HypervisorContext& ctx, const std::vector<std::string>& machineNames, bool force,
+                                     unsigned parallelism) {
+    if (machineNames.size() == 1) { //the user is asked the same way as before
+        bool success = this->destroyMachine(ctx, machineNames[0], force);
+        ContextIso::Evict(ctx.hypervisor()); //the context ISOs of the destroyed machines
+        return success;
+    }
+
+    std::vector<std::string> toDestroy = machineNames;
+    if (!force) {
+        std::vector<std::string> running;
+        for (size_t i=0; i < machineNames.size(); ++i) {
+            if (ctx.isRunning(machineNames[i]))
+                running.push_back(machineNames[i]);
+        }
+
+        if (!running.empty()) { //ask once for all of them
+            std::cout << "These machines are running: " << boost::algorithm::join(running, ", ") << std::endl
+                      << "Do you want to destroy them? [y/N]: ";
+            std::string decision;
+            bool gotInput = Tools::GetUserInput(decision);
+            boost::algorithm::to_lower(decision);
+
+            if (!gotInput || (decision != "y" && decision != "yes")) { //keep the running ones
+                std::cout << "Skipping the running machines\n";
+                toDestroy.clear();
+                for (size_t i=0; i < machineNames.size(); ++i) {
+                    if (std::find(running.begin(), running.end(), machineNames[i]) == running.end())
+                        toDestroy.push_back(machineNames[i]);
+                }
+            }
+        }
+    }
+
+    //the user has confirmed everything, no prompts from the worker threads
+    bool success = this->forEachMachine(toDestroy, [&](const std::string& machineName) {
+        return this->destroyMachine(ctx, machineName, true);
+    }, parallelism);
+    ContextIso::Evict(ctx.hypervisor());
+    return success;
+}
+
+
+bool RequestHandler::forEachMachine(const std::vector<std::string>& machineNames, const machineOperationType& operation,
+                                    unsigned parallelism) {
+    if (machineNames.size() == 1)
+        return operation(machineNames[0]);
+
+    std::vector<bool> results = WorkerPool::Run(machineNames.size(), parallelism, [&](size_t i) {
+        return operation(machineNames[i]);
+    });
+
+    bool success = true;
+    for (size_t i=0; i < machineNames.size(); ++i) {
+        std::cout << machineNames[i] << ": " << (results[i] ? "OK" : "FAILED") << std::endl;
+        success = success && results[i];
+    }
+    return success;
+}
+
+
+bool RequestHandler::listSnapshots(HypervisorContext& ctx, const std::string& machineName) {
+    HVInstancePtr hv = ctx.hypervisor();
+    if (!hv)
+        return false;
+
+    HVSessionPtr session = ctx.openSession(machineName);
+    if (!session) {
+        std::cerr << "Unable to find the machine: " << machineName << std::endl;
+        return false;
+    }
+    VBoxManage::vmInfoType info;
+    if (!VBoxManage::GetVMInfo(hv, VBoxManage::GetMachineId(session), info)) {
+        std::cerr << "Unable to get information about the machine: " << machineName << std::endl;
         return false;
     }
 
-    HVSessionPtr session = FindSessionByName(machineName, hv, true);
+    //SnapshotName="...", children of the N-th snapshot are SnapshotName-N="...", their children SnapshotName-N-M, ...
+    //the keys sort as strings (SnapshotName-1-10 before SnapshotName-1-2), the tree order compares the numbers
+    std::vector<std::pair<std::vector<int>, std::string> > snapshots;
+    for (VBoxManage::vmInfoType::const_iterator it = info.begin(); it != info.end(); ++it) {
+        if (it->first.compare(0, 12, "SnapshotName") == 0)
+            snapshots.push_back(std::make_pair(SnapshotPath(it->first), it->second));
+    }
+    std::sort(snapshots.begin(), snapshots.end());
+
+    std::string current = info["CurrentSnapshotName"];
+    for (size_t i=0; i < snapshots.size(); ++i) {
+        std::cout << std::string(snapshots[i].first.size() * 2, ' ') << snapshots[i].second
+                  << (snapshots[i].second == current ? "\t(current)" : "") << std::endl;
+    }
+    if (snapshots.empty())
+        std::cout << "The machine '" << machineName << "' has no snapshots\n";
+
+    return true;
+}
+
+
+bool RequestHandler::pauseMachine(HypervisorContext& ctx, const std::string& machineName) {
+    HVInstancePtr hv = ctx.hypervisor();
+    if (!hv)
+        return false;
+
+    HVSessionPtr session = ctx.openSession(machineName);
     if (!session) {
         std::cerr << "Unable to find the machine: " << machineName << std::endl;
         return false; //we didn't match the name
     }
 
-    session->pause();
-    session->wait(); //wait for the session until it finishes all tasks
+    Stats::Operation operation(ctx, "pause", machineName);
+    {
+        Trace::Span span("wait:pause", machineName);
+        session->pause();
+        session->wait(); //wait for the session until it finishes all tasks
+    }
+    ctx.invalidateRunningMachines();
+    if (GetVMState(hv, session) != "paused") {
+        std::cerr << "Unable to pause the machine: " << machineName << std::endl;
+        return false;
+    }
 
+    operation.succeeded();
     return true; //we started the session, we don't have to go through the rest of machines
 }
 
 
-bool RequestHandler::sshIntoMachine(const std::string& login) {
+bool RequestHandler::resolveMachineNames(HypervisorContext& ctx, const std::vector<std::string>& patterns, bool all,
+                                         std::vector<std::string>& outNames) {
+    bool needMachines = all;
+    for (size_t i=0; i < patterns.size(); ++i)
+        needMachines = needMachines || Tools::IsGlobPattern(patterns[i]);
+
+    std::vector<std::string> existing;
+    if (needMachines) {
+        const std::vector<SessionIndexEntry>* entries = ctx.indexedSessions();
+        if (!entries)
+            return false;
+        for (std::vector<SessionIndexEntry>::const_iterator it = entries->begin(); it != entries->end(); ++it)
+            existing.push_back(it->name);
+    }
+
+    std::set<std::string> seen; //every machine is listed only once, in the order of the patterns
+    if (all) {
+        for (size_t i=0; i < existing.size(); ++i) {
+            if (seen.insert(existing[i]).second)
+                outNames.push_back(existing[i]);
+        }
+    }
+    for (size_t i=0; i < patterns.size(); ++i) {
+        if (!Tools::IsGlobPattern(patterns[i])) {
+            if (seen.insert(patterns[i]).second)
+                outNames.push_back(patterns[i]);
+            continue;
+        }
+
+        bool matched = false;
+        for (size_t j=0; j < existing.size(); ++j) {
+            if (Tools::MatchGlob(patterns[i], existing[j])) {
+                matched = true;
+                if (seen.insert(existing[j]).second)
+                    outNames.push_back(existing[j]);
+            }
+        }
+        if (!matched) {
+            std::cerr << "No machine matches: " << patterns[i] << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+bool RequestHandler::sshIntoMachine(HypervisorContext& ctx, const std::string& login, bool waitReady) {
 #ifdef _WIN32
     std::cerr << "SSH into machine is not supported on Windows\n";
     return false;
 #else // linux or mac
-    HVInstancePtr hv = detectHypervisor();
-    if (!hv) {
-        std::cerr << "Unable to detect hypervisor\n";
+    HVInstancePtr hv = ctx.hypervisor();
+    if (!hv)
         return false;
-    }
-    hv->loadSessions();
 
     std::string machineName = login;
     std::string username;
@@ -483,13 +908,13 @@ bool RequestHandler::sshIntoMachine(const std::string& login) {
         username = tokens[0];
     }
 
-    HVSessionPtr session = hv->sessionByName(machineName);
+    HVSessionPtr session = ctx.sessionByName(machineName);
     if (!session) {
         std::cerr << "Unable to find the machine: " << machineName << std::endl;
         return false; //we didn't match the name
     }
 
-    if (! this->isMachineRunning(machineName)) {
+    if (! this->isMachineRunning(ctx, machineName)) {
         std::cerr << "Machine '" << machineName << "' is not running\n";
         return false;
     }
@@ -516,10 +941,13 @@ bool RequestHandler::sshIntoMachine(const std::string& login) {
         std::cerr << "No ssh port found for this machine\n";
         return false;
     }
+    if (waitReady && !this->waitForReady(ctx, machineName))
+        return false;
     std::string x11String = "-Y";
     std::string portString = "-p " + port;
     std::string fullAddress = username + "@127.0.0.1";
 
+    Trace::Flush(); //exec replaces this process, so there is no exit to write the trace on
     int res = execl(sshBin.c_str(), sshBin.c_str(), x11String.c_str(), portString.c_str(), fullAddress.c_str(),
                     (char*) NULL);
     if (res == -1) {
@@ -532,46 +960,245 @@ bool RequestHandler::sshIntoMachine(const std::string& login) {
 }
 
 
-bool RequestHandler::startMachine(const std::string& machineName) {
-    HVInstancePtr hv = detectHypervisor();
-    if (!hv) {
-        std::cerr << "Unable to detect hypervisor\n";
+bool RequestHandler::restoreMachine(HypervisorContext& ctx, const std::string& machineName, const std::string& tag) {
+    HVInstancePtr hv = ctx.hypervisor();
+    if (!hv)
+        return false;
+
+    HVSessionPtr session = ctx.openSession(machineName);
+    if (!session) {
+        std::cerr << "Unable to find the machine: " << machineName << std::endl;
+        return false;
+    }
+    std::string machineId = VBoxManage::GetMachineId(session);
+    VBoxManage::vmInfoType info;
+    if (!VBoxManage::GetVMInfo(hv, machineId, info) || !HasSnapshot(info, tag)) {
+        std::cerr << "The machine '" << machineName << "' has no snapshot '" << tag << "', list them with: "
+                  << "cernvm-launch snapshots " << machineName << std::endl;
+        return false;
+    }
+
+    Stats::Operation operation(ctx, "restore", machineName);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool wasRunning = ctx.isRunning(machineName);
+    if (wasRunning) {
+        //the current state is thrown away, there is no point in saving it
+        {
+            Trace::Span span("wait:stop", machineName);
+            session->stop();
+            session->wait();
+        }
+        ctx.invalidateRunningMachines();
+
+        RetryPolicy retry = RetryPolicy::FromConfig("destroy", DESTROY_RETRY_INITIAL_MS, DESTROY_RETRY_MAX_MS,
+                                                    DESTROY_TIMEOUT_MS);
+        if (!WaitForRelease(hv, machineId, machineName, retry)) {
+            std::cerr << "The machine '" << machineName << "' was not released by VirtualBox in "
+                      << retry.elapsedMs() / 1000.0 << " s\n";
+            return false;
+        }
+    }
+
+    {
+        Trace::Span span("restoreSnapshot", machineName);
+        std::vector<std::string> lines;
+        std::vector<std::string> args = {"snapshot", machineId, "restore", tag};
+        if (VBoxManage::Run(hv, args, &lines) != 0) {
+            std::cerr << "Unable to restore the snapshot:\n" << boost::algorithm::join(lines, "\n") << std::endl;
+            return false;
+        }
+    }
+
+    //a live snapshot leaves the machine in the saved state, so it is only resumed
+    if (wasRunning && !this->startMachine(ctx, machineName))
+        return false;
+
+    double seconds = std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::steady_clock::now() - start).count() / 1000.0;
+    std::cout << "Machine '" << machineName << "' restored to '" << tag << "' in " << seconds << " s\n";
+
+    operation.succeeded();
+    return true;
+}
+
+
+bool RequestHandler::snapshotMachine(HypervisorContext& ctx, const std::string& machineName, const std::string& tag) {
+    HVInstancePtr hv = ctx.hypervisor();
+    if (!hv)
+        return false;
+
+    if (tag == GOLDEN_SNAPSHOT) {
+        std::cerr << "'" << GOLDEN_SNAPSHOT << "' is used by linked clones, take it with: cernvm-launch golden "
+                  << machineName << std::endl;
+        return false;
+    }
+    HVSessionPtr session = ctx.openSession(machineName);
+    if (!session) {
+        std::cerr << "Unable to find the machine: " << machineName << std::endl;
+        return false;
+    }
+    std::string machineId = VBoxManage::GetMachineId(session);
+    VBoxManage::vmInfoType info;
+    if (!VBoxManage::GetVMInfo(hv, machineId, info)) {
+        std::cerr << "Unable to get information about the machine: " << machineName << std::endl;
         return false;
     }
 
-    HVSessionPtr session = FindSessionByName(machineName, hv, true);
+    Stats::Operation operation(ctx, "snapshot", machineName);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<std::string> lines;
+    //VirtualBox allows several snapshots with the same name, restore would pick any of them,
+    //so the older ones are deleted, but only once the new one is taken (a failed take keeps them)
+    std::vector<std::string> olderSnapshots = GetSnapshotUUIDs(info, tag);
+    {
+        //a live snapshot does not pause the machine for the whole time of saving its memory
+        Trace::Span span("takeSnapshot", machineName);
+        std::vector<std::string> args = {"snapshot", machineId, "take", tag, "--description", "Taken by CernVM-Launch"};
+        if (ctx.isRunning(machineName))
+            args.push_back("--live");
+        if (VBoxManage::Run(hv, args, &lines) != 0) {
+            std::cerr << "Unable to take the snapshot:\n" << boost::algorithm::join(lines, "\n") << std::endl;
+            return false;
+        }
+    }
+
+    for (size_t i=0; i < olderSnapshots.size(); ++i) {
+        Trace::Span span("deleteSnapshot", machineName);
+        std::vector<std::string> args = {"snapshot", machineId, "delete", olderSnapshots[i]};
+        if (VBoxManage::Run(hv, args, &lines) != 0) {
+            std::cerr << "The snapshot was taken, but the older snapshot '" << tag << "' (" << olderSnapshots[i]
+                      << ") could not be deleted, restore may pick any of them:\n"
+                      << boost::algorithm::join(lines, "\n") << std::endl;
+            return false;
+        }
+    }
+
+    double seconds = std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::steady_clock::now() - start).count() / 1000.0;
+    std::cout << "Snapshot '" << tag << "' of '" << machineName << "' taken in " << seconds << " s, "
+              << "reset the machine with: cernvm-launch restore " << machineName << " " << tag << std::endl;
+
+    operation.succeeded();
+    return true;
+}
+
+
+bool RequestHandler::startMachine(HypervisorContext& ctx, const std::string& machineName) {
+    if (!ctx.hypervisor())
+        return false;
+
+    HVSessionPtr session = ctx.openSession(machineName);
     if (!session) {
         std::cerr << "Unable to find the machine: " << machineName << std::endl;
         return false; //we didn't match the name
     }
 
+    //resuming a saved or paused machine does not boot it, it is much faster than a start
+    int state = session->getState();
+    Stats::Operation operation(ctx, state == SS_SAVED || state == SS_PAUSED ? "resume" : "start", machineName);
+
+    //a paused machine keeps its memory, it is admitted already
+    Admission::Reservation reservation;
+    if (!ctx.isRunning(machineName)) {
+        Trace::Span span("admission", machineName);
+        if (!Admission::Admit(ctx, machineName, session->parameters->getNum<int>("memory", 0),
+                              session->parameters->getNum<int>("cpus", 0), reservation))
+            return false;
+    }
+
     ParameterMapPtr emptyMap = ParameterMap::instance(); //we don't want to specify additional parameters
-    session->start(emptyMap);
+    {
+        Trace::Span span("wait:start", machineName);
+        session->start(emptyMap);
 
-    session->wait(); //wait for the session until it finishes all tasks
+        session->wait(); //wait for the session until it finishes all tasks
+    }
+    ctx.invalidateRunningMachines();
+    if (!ctx.isRunning(machineName)) {
+        std::cerr << "Unable to start the machine: " << machineName << std::endl;
+        return false;
+    }
 
+    operation.succeeded();
     return true; //we started the session, we don't have to go through the rest of machines
 }
 
 
-bool RequestHandler::stopMachine(const std::string& machineName) {
-    HVInstancePtr hv = detectHypervisor();
-    if (!hv) {
-        std::cerr << "Unable to detect hypervisor\n";
+bool RequestHandler::stopMachine(HypervisorContext& ctx, const std::string& machineName) {
+    if (!ctx.hypervisor())
         return false;
-    }
 
-    HVSessionPtr session = FindSessionByName(machineName, hv, true);
-    if (!session)
+    HVSessionPtr session = ctx.openSession(machineName);
+    if (!session) {
+        std::cerr << "Unable to find the machine: " << machineName << std::endl;
         return false; //cannot open the session
+    }
 
-    session->hibernate(); //save state and stop
+    Stats::Operation operation(ctx, "stop", machineName);
+    {
+        Trace::Span span("wait:hibernate", machineName);
+        session->hibernate(); //save state and stop
 
-    session->wait(); //wait for the session until it finishes all tasks
+        session->wait(); //wait for the session until it finishes all tasks
+    }
+    ctx.invalidateRunningMachines();
+    if (ctx.isRunning(machineName)) {
+        std::cerr << "Unable to stop the machine: " << machineName << std::endl;
+        return false;
+    }
 
+    operation.succeeded();
     return true; //we started the session, we don't have to go through the rest of machines
 }
 
+
+bool RequestHandler::waitForReady(HypervisorContext& ctx, const std::string& machineName, int timeoutMs) {
+    HVInstancePtr hv = ctx.hypervisor();
+    if (!hv)
+        return false;
+
+    HVSessionPtr session = ctx.openSession(machineName);
+    if (!session) {
+        std::cerr << "Unable to find the machine: " << machineName << std::endl;
+        return false;
+    }
+    int port = 0;
+    if (!Tools::ParseInt(session->local->get("apiPort", ""), port)) {
+        std::cerr << "No ssh port found for this machine\n";
+        return false;
+    }
+    if (!this->isMachineRunning(ctx, machineName)) {
+        std::cerr << "Machine '" << machineName << "' is not running\n";
+        return false;
+    }
+
+    RetryPolicy retry = timeoutMs < 0
+        ? RetryPolicy::FromConfig("ready", READY_RETRY_INITIAL_MS, READY_RETRY_MAX_MS, READY_TIMEOUT_MS)
+        : RetryPolicy(READY_RETRY_INITIAL_MS, READY_RETRY_MAX_MS, timeoutMs);
+    {
+        //VirtualBox forwards the port before the guest is up, only the SSH banner tells the sshd runs
+        Trace::Span span("wait:ready", machineName);
+        while (!Tools::ProbeSshPort(port, READY_PROBE_TIMEOUT_MS)) {
+            if (!retry.backoff()) {
+                std::cerr << "Machine '" << machineName << "' is not ready, no SSH server answered on port " << port
+                          << " in " << retry.elapsedMs() / 1000.0 << " s\n";
+                return false;
+            }
+        }
+    }
+
+    std::cout << "Machine '" << machineName << "' is ready (waited " << retry.elapsedMs() / 1000.0 << " s";
+    VBoxManage::vmInfoType info;
+    long long bootMs = VBoxManage::GetVMInfo(hv, VBoxManage::GetMachineId(session), info)
+                       ? MsSinceStateChange(info) : -1;
+    if (bootMs >= 0)
+        std::cout << ", " << bootMs / 1000.0 << " s since it was started";
+    std::cout << ")" << std::endl;
+
+    return true;
+}
+
+
 //-----------------------------------------------------------------------------
 // Local helper functions
 //-----------------------------------------------------------------------------
@@ -623,44 +1250,420 @@ bool CheckCreationParameters(ParameterMapPtr params) {
 }
 
 
-//Prompt for username. if none is provided, use given default
-std::string PromptForMachineName(const std::string& defaultValue) {
-    std::cout << "Enter VM name [" << defaultValue << "]: ";
-    std::string userValue;
-    if (! Tools::GetUserInput(userValue)) //no input
-        return defaultValue;
+bool AdoptLinkedClone(HypervisorContext& ctx, HVSessionPtr base, const std::string& machineName,
+                      const Config& params) {
+    HVInstancePtr hv = ctx.hypervisor();
+    VBoxManage::vmInfoType info;
+    if (!VBoxManage::GetVMInfo(hv, machineName, info)) {
+        std::cerr << "Unable to get information about the clone: " << machineName << std::endl;
+        return false;
+    }
 
-    return userValue;
+    //the clone has the same port forwarding as the base, which would collide once both are running
+    std::string guestApiPort = base->parameters->get("apiPort", "22");
+    int hostApiPort = 0;
+    if (!PortAllocator::Allocate(ctx, machineName, hostApiPort))
+        return false;
+    PortAllocator::ReleaseGuard portGuard(machineName);
+    std::vector<std::string> deleteArgs = {"modifyvm", info["UUID"]};
+    std::vector<std::string> modifyArgs = {"modifyvm", info["UUID"]};
+    for (VBoxManage::vmInfoType::const_iterator it = info.begin(); it != info.end(); ++it) {
+        //Forwarding(N)="name,protocol,hostIP,hostPort,guestIP,guestPort"
+        std::vector<std::string> rule = Tools::SplitString(it->second, ',', 0);
+        if (it->first.compare(0, 11, "Forwarding(") != 0 || rule.size() != 6 || rule[5] != guestApiPort)
+            continue;
+        deleteArgs.insert(deleteArgs.end(), {"--natpf1", "delete", rule[0]});
+        modifyArgs.insert(modifyArgs.end(), {"--natpf1", rule[0] + "," + rule[1] + "," + rule[2] + ","
+                                             + std::to_string(hostApiPort) + "," + rule[4] + "," + rule[5]});
+    }
+    if (params.has("cpus"))
+        modifyArgs.insert(modifyArgs.end(), {"--cpus", params.get("cpus")});
+    if (params.has("memory"))
+        modifyArgs.insert(modifyArgs.end(), {"--memory", params.get("memory")});
+
+    std::vector<std::string> lines;
+    if ((deleteArgs.size() > 2 && VBoxManage::Run(hv, deleteArgs, &lines) != 0)
+        || (modifyArgs.size() > 2 && VBoxManage::Run(hv, modifyArgs, &lines) != 0)) {
+        std::cerr << "Unable to configure the clone:\n" << boost::algorithm::join(lines, "\n") << std::endl;
+        return false;
+    }
+
+    //the session points to the already existing VM, so libcernvm does not create a new one
+    std::lock_guard<std::recursive_mutex> lock(ctx.mutex());
+    Trace::Span span("allocateSession", machineName);
+    HVSessionPtr session = hv->allocateSession();
+    session->parameters->fromParameters(base->parameters, false, true);
+    session->parameters->set("name", machineName);
+    if (params.has("cpus"))
+        session->parameters->set("cpus", params.get("cpus"));
+    if (params.has("memory"))
+        session->parameters->set("memory", params.get("memory"));
+    session->local->fromParameters(base->local, false, true);
+    session->local->set("vboxid", info["UUID"]);
+    session->local->set("baseFolder", boost::filesystem::path(info["CfgFile"]).parent_path().string());
+    session->local->set("apiPort", std::to_string(hostApiPort));
+    session->wait();
+
+    portGuard.keep();
+    return true;
 }
 
 
-//Find and opens a session with the corresponding machineName. If 'loadSession' flag
-//is true, we load sessions on the hypervisor. Defaults to false.
-HVSessionPtr FindSessionByName(const std::string& machineName, HVInstancePtr& hypervisor, bool loadSessions) {
-    if (!hypervisor)
-        return HVSessionPtr();
+bool CreatePreparedMachine(HypervisorContext& ctx, ParameterMapPtr parameters, bool startMachine, bool bulk,
+                           const std::string& contextIso) {
+    HVInstancePtr hv = ctx.hypervisor();
+    if (!hv)
+        return false;
+
+    std::string machineName = parameters->get("name", "");
+    std::string msgPrefix = bulk ? machineName + ": " : "";
+
+    if (! isSanitized(&machineName, SAFE_ALNUM_CHARS)) {
+        std::cerr << msgPrefix << "Machine name contains illegal characters, use only following: "
+                  << SAFE_ALNUM_CHARS << std::endl;
+        return false;
+    }
+
+    if (ctx.openSession(machineName)) { //we already have this session
+        std::cerr << msgPrefix << "The machine already exists\n";
+        return false;
+    }
 
-    if (loadSessions)
-        hypervisor->loadSessions();
+    Stats::Operation operation(ctx, "create", machineName);
+    operation.setCernVMVersion(parameters->get("cernvmVersion", ""));
 
-    HVSessionPtr session = hypervisor->sessionByName(machineName);
-    if (!session)
-        return HVSessionPtr();
+    //the reservation is held until the machine is running
+    Admission::Reservation reservation;
+    if (startMachine) {
+        Trace::Span span("admission", machineName);
+        if (!Admission::Admit(ctx, machineName, parameters->getNum<int>("memory", 0),
+                              parameters->getNum<int>("cpus", 0), reservation))
+            return false;
+    }
 
-    //we found our session, try to open it
-    ParameterMapPtr sessParamMap = session->parameters;
-    FiniteTaskPtr pOpen = boost::make_shared<FiniteTask>();
-    pOpen->setMax(1);
+    //libcernvm picks a random port for the API port forwarding only if the session has none,
+    //which collides when several machines are created at once
+    int apiPort = 0;
+    if (!PortAllocator::Allocate(ctx, machineName, apiPort))
+        return false;
+    PortAllocator::ReleaseGuard portGuard(machineName); //released if the creation fails
 
-    //open the session, i.e. start the FSM thread
-    session = hypervisor->sessionOpen(sessParamMap, pOpen, false); //bypass verification, we're locals
-    if (!session)
-        return HVSessionPtr();
-    session->wait();
+    //allocate a new session
+    HVSessionPtr session;
+    {
+        //allocating modifies the sessions of the hypervisor, other threads may be using them
+        std::lock_guard<std::recursive_mutex> lock(ctx.mutex());
+        Trace::Span span("allocateSession", machineName);
+        session = hv->allocateSession();
+
+        //load our parameters into the newly created session
+        session->parameters->fromParameters(parameters, false, true); //don't clear defaults, but overwrite local keys
+        if (!contextIso.empty()) //without the user data libcernvm does not build the context ISO
+            session->parameters->erase("userData");
+        session->local->set("apiPort", std::to_string(apiPort));
+        session->wait();
+    }
+
+    //get our newly allocated session and open it (i.e. start the FSM => initiate the creation)
+    session = ctx.openSession(machineName);
+    if (!session) {
+        std::cerr << msgPrefix << "Could not open the session\n";
+        return false;
+    }
+
+    ParameterMapPtr emptyMap = ParameterMap::instance(); //we don't want to specify additional parameters
+    if (contextIso.empty()) {
+        //we need to start the session, so the creation process gets initiated
+        //the creation includes the image download, context ISO build and all VBoxManage configuration
+        Trace::Span span("wait:create", machineName);
+        session->start(emptyMap); //start scheduled
+        session->wait(); //wait for the session until it finishes all tasks
+    }
+    else {
+        //stopping a missing machine only creates and configures it, the ISO has to be attached before the first boot
+        {
+            Trace::Span span("wait:create", machineName);
+            session->stop();
+            session->wait();
+        }
+        if (!ContextIso::Attach(hv, session, contextIso)) {
+            std::cerr << msgPrefix << "The machine was created without the context, destroy it and try again\n";
+            return false;
+        }
+        if (startMachine) {
+            Trace::Span span("wait:start", machineName);
+            session->start(emptyMap);
+            session->wait();
+        }
+    }
+
+    if (!bulk) {
+        std::cout << "Parameters used for the machine creation:\n";
+        Tools::PrintParameters(CreationInfoFields, session->parameters);
+    }
+
+    if (!startMachine && contextIso.empty()) { //stop the session if required
+        Trace::Span span("wait:stop", machineName);
+        session->stop();
+        session->wait();
+    }
+    ctx.invalidateRunningMachines();
 
-    return session;
+    if (GetVMState(hv, session).empty()) { //the port goes back to the pool with the guard
+        std::cerr << msgPrefix << "The machine '" << machineName << "' was not created\n";
+        return false;
+    }
+    portGuard.keep(); //the machine exists and uses the port, even if it did not start
+    if (startMachine && !ctx.isRunning(machineName)) {
+        std::cerr << msgPrefix << "The machine '" << machineName << "' was created, but it did not start\n";
+        return false;
+    }
+    operation.succeeded();
+    return true;
 }
 
 
-} //anonymous namespace
+bool HasSnapshot(const VBoxManage::vmInfoType& info, const std::string& snapshotName) {
+    //SnapshotName="...", nested snapshots are SnapshotName-1="...", SnapshotName-1-1="...", ...
+    for (VBoxManage::vmInfoType::const_iterator it = info.begin(); it != info.end(); ++it) {
+        if (it->first.compare(0, 12, "SnapshotName") == 0 && it->second == snapshotName)
+            return true;
+    }
+    return false;
+}
+
+
+std::vector<int> SnapshotPath(const std::string& key) {
+    std::vector<int> path;
+    std::vector<std::string> parts;
+    boost::algorithm::split(parts, key, boost::algorithm::is_any_of("-"));
+    for (size_t i=1; i < parts.size(); ++i) { //parts[0] is SnapshotName
+        int index = 0;
+        Tools::ParseInt(parts[i], index);
+        path.push_back(index);
+    }
+    return path;
+}
+
+
+std::vector<std::string> GetSnapshotUUIDs(const VBoxManage::vmInfoType& info, const std::string& snapshotName) {
+    //SnapshotName-1-1="..." goes with SnapshotUUID-1-1="..."
+    std::vector<std::string> uuids;
+    for (VBoxManage::vmInfoType::const_iterator it = info.begin(); it != info.end(); ++it) {
+        if (it->first.compare(0, 12, "SnapshotName") != 0 || it->second != snapshotName)
+            continue;
+        VBoxManage::vmInfoType::const_iterator uuid = info.find("SnapshotUUID" + it->first.substr(12));
+        if (uuid != info.end())
+            uuids.push_back(uuid->second);
+    }
+    return uuids;
+}
+
+
+bool WaitForRelease(HVInstancePtr hv, const std::string& machineId, const std::string& machineName, RetryPolicy& retry) {
+    Trace::Span span("wait:release", machineName);
+    while (GetMachineLockState(hv, machineId) == MACHINE_LOCKED) {
+        if (!retry.backoff())
+            return false;
+    }
+    return true;
+}
+
+
+long long MsSinceStateChange(const VBoxManage::vmInfoType& info) {
+    //e.g. VMStateChangeTime="2016-08-22T14:11:31.024000000", in UTC
+    VBoxManage::vmInfoType::const_iterator it = info.find("VMStateChangeTime");
+    std::tm time = std::tm();
+    int milliseconds = 0;
+    if (it == info.end() || std::sscanf(it->second.c_str(), "%d-%d-%dT%d:%d:%d.%3d", &time.tm_year, &time.tm_mon,
+                                        &time.tm_mday, &time.tm_hour, &time.tm_min, &time.tm_sec,
+                                        &milliseconds) < 6)
+        return -1;
+    time.tm_year -= 1900;
+    time.tm_mon -= 1;
+#ifdef _WIN32
+    std::time_t changed = _mkgmtime(&time);
+#else
+    std::time_t changed = timegm(&time);
+#endif
+    if (changed == (std::time_t) -1)
+        return -1;
+
+    long long nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          std::chrono::system_clock::now().time_since_epoch()).count();
+    long long ms = nowMs - ((long long) changed * 1000 + milliseconds);
+    return ms < 0 ? -1 : ms;
+}
+
+
+std::string GetVMState(HVInstancePtr hv, HVSessionPtr session) {
+    VBoxManage::vmInfoType info;
+    if (!VBoxManage::GetVMInfo(hv, VBoxManage::GetMachineId(session), info))
+        return "";
+    return info["VMState"];
+}
+
+
+MachineLockState GetMachineLockState(HVInstancePtr hv, const std::string& machineId) {
+    VBoxManage::vmInfoType info;
+    bool notFound = false;
+    if (!VBoxManage::GetVMInfo(hv, machineId, info, &notFound))
+        //a failed query (e.g. VBoxSVC busy) is retried, the machine may still be registered
+        return notFound ? MACHINE_UNREGISTERED : MACHINE_LOCKED;
+
+    //only the final states, transient ones (stopping, saving, ...) keep the machine locked
+    std::string state = info["VMState"];
+    if (state != "poweroff" && state != "aborted" && state != "saved")
+        return MACHINE_LOCKED;
+    if (info.count("SessionState") && info["SessionState"] != "unlocked")
+        return MACHINE_LOCKED;
+
+    return MACHINE_RELEASED;
+}
+
+
+bool PrefetchCernVMImage(HVInstancePtr hv, ParameterMapPtr parameters) {
+    int flags = parameters->getNum<int>("flags", 0);
+    if (flags & (HVF_DEPLOYMENT_HDD | HVF_DEPLOYMENT_HDD_LOCAL | HVF_DEPLOYMENT_ISO_LOCAL))
+        return true; //no CernVM ISO is downloaded for these deployments
+
+    //the same version, flavor and architecture the session would download
+    std::string version = parameters->get("cernvmVersion", "latest");
+    std::string flavor = parameters->get("cernvmFlavor", "prod");
+    std::string arch = (flags & HVF_SYSTEM_64BIT) ? "x86_64" : "i386";
+
+    ImageCache cache(Tools::GetDataFolder() + "/" + IMAGE_CACHE_FOLDER);
+    std::string imageFile;
+    if (!cache.fetch(hv, version, flavor, arch, imageFile))
+        return false;
+    cache.evict(hv, ImageCache::SizeLimit(), imageFile); //not fatal, the cache is just bigger than wanted
+
+    return true;
+}
+
+
+bool PrepareContextIso(ParameterMapPtr parameters, const std::vector<ContextIso::ContextFile>& contextFiles,
+                       std::string& outIso) {
+    outIso.clear();
+    std::string userData = parameters->get("userData", "");
+    if (contextFiles.empty() && (userData.empty() || !ContextIso::IsCacheEnabled()))
+        return true; //libcernvm takes care of it
+
+    return ContextIso::GetCachedIso(userData, contextFiles, outIso);
+}
+
+
+bool PrepareCreationParameters(const std::string& userDataFile, Config& params) {
+    if (userDataFile.empty()) { // no user data provided, ask to use the default
+        std::string decision;
+        std::cout << "You have not provided a user data file, do you want to use a default one?\n";
+        std::cout << "Default user data:\n\n" << DEFAULT_USER_DATA << std::endl;
+        std::cout << "Continue with default context? [Y/n]: "; //default is yes
+        bool gotInput = Tools::GetUserInput(decision);
+        boost::algorithm::to_lower(decision);
+
+        if (gotInput && decision != "y" && decision != "yes") { //something else than yes
+            std::cout << "Aborting, no context provided\n";
+            return false;
+        }
+        //Save user data (userData from the parameter file takes precedence, as before)
+        params.set("userData", DEFAULT_USER_DATA, CONFIG_LAYER_DEFAULTS);
+    }
+    else { //user wants to provide the user data
+        std::string userData;
+        bool res;
+        {
+            Trace::Span span("loadUserData", userDataFile);
+            res = Tools::LoadFileIntoString(userDataFile, userData);
+        }
+
+        if (!res) {
+            std::cerr << "Error while processing file: " << userDataFile << std::endl;
+            return false;
+        }
+        //if user accidentally specified userData in parameter map file, we overwrite it
+        if (params.has("userData"))
+            std::cout << "Ignoring the userData specified in the parameter file, using userData file instead\n";
+        //Save user data
+        params.set("userData", userData, CONFIG_LAYER_COMMAND_LINE);
+    }
+
+    //Missing values come from the global config file and the hardcoded defaults,
+    //the layers keep the precedence
+    //(the keys configuring CernVM-Launch itself are not stored in the sessions)
+    Config* globalConfig = Tools::GetGlobalConfig();
+    std::vector<std::string> globalKeys = globalConfig ? globalConfig->keys() : std::vector<std::string>();
+    for (size_t i=0; i < globalKeys.size(); ++i) {
+        if (!Config::IsLaunchKey(globalKeys[i]))
+            params.set(globalKeys[i], globalConfig->get(globalKeys[i]), CONFIG_LAYER_GLOBAL);
+    }
+    for (paramMapType::const_iterator it = DefaultCreationParams.begin(); it != DefaultCreationParams.end(); ++it)
+        params.set(it->first, it->second, CONFIG_LAYER_DEFAULTS);
+
+    //If user wants to create the machine from his own ISO, we need to let libcernvm know
+    if (params.has("isoPath")) {
+        std::string isoPath = params.get("isoPath");
+        if (! file_exists(isoPath)) {
+            std::cerr << "Provided ISO path '" << isoPath << "' does not exist or is not readable\n";
+            return false;
+        }
 
+        //Set the import flag
+        std::string flags = params.get("flags", "49");
+        Tools::SetFlagsInString(flags, HVF_DEPLOYMENT_ISO_LOCAL);
+        params.set("flags", flags, CONFIG_LAYER_COMMAND_LINE);
+
+        //We don't know what CernVM ISO version user provided, so we just set the cernvmVersion to the given path
+        params.set("cernvmVersion", isoPath, CONFIG_LAYER_COMMAND_LINE);
+    }
+
+    return true;
+}
+
+
+void PrintParametersJson(ParameterMapPtr paramMap, const std::vector<std::string>& hiddenKeys) {
+    std::vector<std::string> keys = paramMap->enumKeys();
+    std::sort(keys.begin(), keys.end());
+
+    std::cout << "{";
+    bool first = true;
+    for (std::vector<std::string>::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+        if (std::find(hiddenKeys.begin(), hiddenKeys.end(), *it) != hiddenKeys.end())
+            continue;
+        std::cout << (first ? "" : ", ") << "\"" << Tools::EscapeJson(*it) << "\": \""
+                  << Tools::EscapeJson(paramMap->get(*it, "")) << "\"";
+        first = false;
+    }
+    std::cout << "}";
+}
+
+
+void PrintMachineJson(const std::string& name, bool running, HVSessionPtr session) {
+    std::cout << "  {\"name\": \"" << Tools::EscapeJson(name) << "\", \"running\": " << (running ? "true" : "false");
+
+    std::cout << ",\n   \"parameters\": ";
+    PrintParametersJson(session->parameters, HiddenListParameters);
+    std::cout << ",\n   \"local\": ";
+    PrintParametersJson(session->local, std::vector<std::string>());
+
+    //the API port of the machine is forwarded to a port on localhost
+    int guestPort = 0, hostPort = 0;
+    std::cout << ",\n   \"forwardedPorts\": [";
+    if (Tools::ParseInt(session->parameters->get("apiPort", ""), guestPort)
+        && Tools::ParseInt(session->local->get("apiPort", ""), hostPort))
+        std::cout << "{\"guest\": " << guestPort << ", \"host\": " << hostPort << "}";
+    std::cout << "]}";
+}
+
+
+//Prompt for username. if none is provided, use given default
+std::string PromptForMachineName(const std::string& defaultValue) {
+    std::cout << "Enter VM name [" << defaultValue << "]: ";
+    std::string userValue;
+    if (! Tools::GetUserInput(userValue)) //no input
+        return defaultValue;
+
+    return userValue;
+}
+
+} //anonymous namespace
@@ -0,0 +1,79 @@
+/**
+ * Exponential backoff with jitter under an overall deadline, for operations
+ * waiting for VirtualBox to release a machine.
+ */
+
+#include <algorithm>
+
+#include <CernVM/Utilities.h>
+
+#include "RetryPolicy.h"
+#include "Tools.h"
+
+
+using namespace Launch;
+
+
+//helper functions and definitions in an anonymous namespace (local)
+namespace {
+
+//Get a number from the global config (validated when the config is loaded)
+int GetConfigMs(const std::string& key, int defaultValue);
+
+} //anonymous namespace
+
+
+RetryPolicy::RetryPolicy(int initialDelayMs, int maxDelayMs, int timeoutMs)
+    : _start(std::chrono::steady_clock::now()),
+      _deadline(_start + std::chrono::milliseconds(timeoutMs)),
+      _delayMs(std::max(initialDelayMs, 1)), _maxDelayMs(std::max(maxDelayMs, 1)), _waits(0),
+      _random(std::random_device()()) {
+}
+
+
+RetryPolicy RetryPolicy::FromConfig(const std::string& prefix, int initialDelayMs, int maxDelayMs, int timeoutMs) {
+    return RetryPolicy(GetConfigMs(prefix + "RetryInitialMs", initialDelayMs),
+                       GetConfigMs(prefix + "RetryMaxMs", maxDelayMs),
+                       GetConfigMs(prefix + "TimeoutMs", timeoutMs));
+}
+
+
+bool RetryPolicy::backoff() {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (now >= _deadline)
+        return false;
+
+    //jitter, so machines destroyed in parallel do not poll VirtualBox in lockstep
+    int delayMs = _delayMs / 2 + std::uniform_int_distribution<int>(0, _delayMs - _delayMs / 2)(_random);
+    long long remainingMs = std::chrono::duration_cast<std::chrono::milliseconds>(_deadline - now).count();
+    sleepMs(std::min<long long>(delayMs, remainingMs));
+
+    _delayMs = std::min(_delayMs * 2, _maxDelayMs);
+    ++_waits;
+    return true;
+}
+
+
+long long RetryPolicy::elapsedMs() const {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - _start).count();
+}
+
+
+int RetryPolicy::waits() const {
+    return _waits;
+}
+
+
+//-----------------------------------------------------------------------------
+// Local helper functions
+//-----------------------------------------------------------------------------
+namespace {
+
+int GetConfigMs(const std::string& key, int defaultValue) {
+    Config* config = Tools::GetGlobalConfig();
+    if (!config)
+        return defaultValue;
+    return config->getInt(key, defaultValue);
+}
+
+} //anonymous namespace
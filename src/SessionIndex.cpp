@@ -0,0 +1,164 @@
+/**
+ * Compact on-disk index of the stored sessions.
+ */
+
+#include <fstream>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
+#include "SessionIndex.h"
+#include "Tools.h"
+
+
+using namespace Launch;
+
+
+//helper functions and definitions in an anonymous namespace (local)
+namespace {
+
+//Bump the version whenever the file format changes, old index files are then rebuilt
+const std::string INDEX_HEADER = "launch-session-index";
+const int INDEX_VERSION = 1;
+
+//Line types of the index file (fields are tab separated)
+const std::string LINE_FILE = "F";    // F  stamp  filename
+const std::string LINE_SESSION = "S"; // S  name  cernvmVersion  apiPort  baseFolder
+
+} //anonymous namespace
+
+
+SessionIndex::SessionIndex(const std::string& runFolder, const std::string& indexFile)
+    : _runFolder(runFolder), _indexFile(indexFile) {
+}
+
+
+//Index file layout:
+//  header line: launch-session-index VERSION BUILT_AT FOLDER_STAMP
+//  one F line per file in the run folder, one S line per session
+bool SessionIndex::load() {
+    std::ifstream ifs(_indexFile.c_str());
+    if (!ifs.good())
+        return false;
+
+    std::string line;
+    if (!std::getline(ifs, line))
+        return false;
+
+    std::istringstream header(line);
+    std::string headerName;
+    int version = 0;
+    std::time_t builtAt = 0, folderStamp = 0;
+    if (!(header >> headerName >> version >> builtAt >> folderStamp)
+            || headerName != INDEX_HEADER || version != INDEX_VERSION)
+        return false;
+
+    fileStampsType fileStamps;
+    std::vector<SessionIndexEntry> entries;
+    while (std::getline(ifs, line)) {
+        std::vector<std::string> fields = Tools::SplitString(line, '\t', 5);
+        if (fields[0] == LINE_FILE && fields.size() == 3) {
+            std::istringstream stamp(fields[1]);
+            std::time_t fileStamp;
+            if (!(stamp >> fileStamp))
+                return false;
+            fileStamps[fields[2]] = fileStamp;
+        }
+        else if (fields[0] == LINE_SESSION && fields.size() == 5) {
+            SessionIndexEntry entry;
+            entry.name = fields[1];
+            entry.cernvmVersion = fields[2];
+            entry.apiPort = fields[3];
+            entry.baseFolder = fields[4];
+            entries.push_back(entry);
+        }
+        else //corrupted index
+            return false;
+    }
+
+    //compare with the current state of the run folder
+    std::time_t currentFolderStamp;
+    fileStampsType currentFileStamps;
+    if (!this->scanRunFolder(currentFolderStamp, currentFileStamps))
+        return false;
+    if (currentFolderStamp != folderStamp || currentFileStamps != fileStamps)
+        return false;
+
+    //the stamps have one second resolution, a change in the same second when the index
+    //was built would go unnoticed, so we do not trust such an index
+    if (folderStamp >= builtAt)
+        return false;
+    for (fileStampsType::const_iterator it = fileStamps.begin(); it != fileStamps.end(); ++it) {
+        if (it->second >= builtAt)
+            return false;
+    }
+
+    _entries.swap(entries);
+    return true;
+}
+
+
+bool SessionIndex::store(const std::vector<SessionIndexEntry>& entries) {
+    _entries = entries;
+
+    std::time_t builtAt = std::time(NULL);
+    std::time_t folderStamp;
+    fileStampsType fileStamps;
+    if (!this->scanRunFolder(folderStamp, fileStamps))
+        return false;
+
+    std::ostringstream content;
+    content << INDEX_HEADER << " " << INDEX_VERSION << " " << builtAt << " " << folderStamp << "\n";
+    for (fileStampsType::const_iterator it = fileStamps.begin(); it != fileStamps.end(); ++it)
+        content << LINE_FILE << "\t" << it->second << "\t" << it->first << "\n";
+    for (std::vector<SessionIndexEntry>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+        content << LINE_SESSION << "\t" << it->name << "\t" << it->cernvmVersion << "\t"
+                << it->apiPort << "\t" << it->baseFolder << "\n";
+    }
+
+    //write a temporary file and rename it, so readers never see a partial index
+    std::string tmpFile = _indexFile + ".tmp";
+    {
+        std::ofstream ofs(tmpFile.c_str(), std::ios::out | std::ios::trunc);
+        if (!ofs.good())
+            return false;
+        ofs << content.str();
+        if (!ofs.good())
+            return false;
+    }
+
+    boost::system::error_code ec;
+    boost::filesystem::rename(tmpFile, _indexFile, ec);
+    if (ec) {
+        boost::filesystem::remove(tmpFile, ec);
+        return false;
+    }
+    return true;
+}
+
+
+const std::vector<SessionIndexEntry>& SessionIndex::entries() const {
+    return _entries;
+}
+
+
+bool SessionIndex::scanRunFolder(std::time_t& outFolderStamp, fileStampsType& outFileStamps) const {
+    boost::system::error_code ec;
+    boost::filesystem::path runFolder(_runFolder);
+
+    outFolderStamp = boost::filesystem::last_write_time(runFolder, ec);
+    if (ec)
+        return false;
+
+    outFileStamps.clear();
+    boost::filesystem::directory_iterator it(runFolder, ec), end;
+    for (; !ec && it != end; it.increment(ec)) {
+        if (!boost::filesystem::is_regular_file(it->status())) //VM folders change all the time, skip them
+            continue;
+        std::time_t fileStamp = boost::filesystem::last_write_time(it->path(), ec);
+        if (ec)
+            return false;
+        outFileStamps[it->path().filename().string()] = fileStamp;
+    }
+    return !ec;
+}
@@ -0,0 +1,406 @@
+/**
+ * History of the operations on machines and the latency statistics built from it.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+
+#include <boost/filesystem.hpp>
+
+#include "FileLock.h"
+#include "Stats.h"
+#include "Tools.h"
+
+
+namespace Launch {
+namespace Stats {
+
+//helper functions and definitions in an anonymous namespace (local)
+namespace {
+
+const std::string LOCK_EXTENSION = ".lock";
+const std::string ROTATED_EXTENSION = ".1";
+const std::string ALL_VERSIONS = "all";
+
+//Operations being recorded by each thread (nested ones, e.g. start inside restore, get the phases too)
+std::mutex ActiveMutex;
+std::map<std::thread::id, std::vector<Operation*> > ActiveOperations;
+std::atomic<int> ActiveCount(0);
+
+//Successful operations of one version (CernVM or VirtualBox), lastIndex orders the versions by their last use
+struct VersionGroup {
+    std::string version;
+    std::vector<long long> durationsMs;
+    size_t lastIndex;
+};
+
+std::string GetLogFile();
+long long NowUs();
+//Append the record to the log (rotated when it is too big)
+bool AppendRecord(const Record& record);
+//Parse a line of the log, returns false for an incomplete line (e.g. the program was killed while writing it)
+bool ParseRecord(const std::string& line, Record& outRecord);
+bool LoadFile(const std::string& file, std::vector<Record>& outRecords);
+//Print a row of the latency table
+void PrintRow(const std::string& operation, const std::string& version, std::vector<long long>& durationsMs,
+              int failed);
+//Print the regression of the operation with the version used last, compared to the version used before it.
+//kind: VirtualBox or CernVM
+bool PrintRegression(const std::string& operation, const std::string& kind, std::vector<VersionGroup>& groups,
+                     int thresholdPercent);
+
+} //anonymous namespace
+
+
+Operation::Operation(HypervisorContext& ctx, const std::string& name, const std::string& machineName)
+    : _startUs(NowUs()), _enabled(false), _cancelled(false) {
+    Config* config = Tools::GetGlobalConfig();
+    if (config && !config->getBool("statsLog", true))
+        return;
+
+    _record.timestamp = 0;
+    _record.operation = name;
+    _record.machineName = machineName;
+    _record.success = false;
+    _record.durationMs = 0;
+    HVInstancePtr hv = ctx.hypervisor();
+    if (hv)
+        _record.hypervisorVersion = hv->version.verString;
+    HVSessionPtr session = hv ? ctx.openSession(machineName) : HVSessionPtr();
+    if (session)
+        _record.cernvmVersion = session->parameters->get("cernvmVersion", "");
+
+    std::lock_guard<std::mutex> lock(ActiveMutex);
+    ActiveOperations[std::this_thread::get_id()].push_back(this);
+    ++ActiveCount;
+    _enabled = true;
+}
+
+
+Operation::~Operation() {
+    if (!_enabled)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(ActiveMutex);
+        std::map<std::thread::id, std::vector<Operation*> >::iterator it =
+            ActiveOperations.find(std::this_thread::get_id());
+        if (it != ActiveOperations.end()) {
+            it->second.erase(std::remove(it->second.begin(), it->second.end(), this), it->second.end());
+            if (it->second.empty())
+                ActiveOperations.erase(it);
+        }
+        --ActiveCount;
+    }
+    if (_cancelled)
+        return;
+
+    _record.timestamp = (long long) std::time(NULL);
+    _record.durationMs = (NowUs() - _startUs) / 1000;
+    AppendRecord(_record);
+}
+
+
+void Operation::setName(const std::string& name) {
+    _record.operation = name;
+}
+
+
+void Operation::setCernVMVersion(const std::string& version) {
+    _record.cernvmVersion = version;
+}
+
+
+void Operation::succeeded() {
+    _record.success = true;
+}
+
+
+void Operation::cancel() {
+    _cancelled = true;
+}
+
+
+void Operation::addPhase(const std::string& name, long long durationUs) {
+    //a phase done several times (e.g. creation of a machine with a context ISO) is summed
+    _record.phasesMs[name] += durationUs / 1000;
+}
+
+
+bool IsRecording() {
+    return ActiveCount > 0;
+}
+
+
+void AddPhase(const std::string& name, long long durationUs) {
+    if (!IsRecording())
+        return;
+    std::lock_guard<std::mutex> lock(ActiveMutex);
+    std::map<std::thread::id, std::vector<Operation*> >::iterator it = ActiveOperations.find(std::this_thread::get_id());
+    if (it == ActiveOperations.end())
+        return;
+    for (size_t i=0; i < it->second.size(); ++i)
+        it->second[i]->addPhase(name, durationUs);
+}
+
+
+bool LoadRecords(std::vector<Record>& outRecords) {
+    std::string file = GetLogFile();
+    FileLock lock(file + LOCK_EXTENSION);
+    if (!lock.locked())
+        return false;
+    return LoadFile(file + ROTATED_EXTENSION, outRecords) && LoadFile(file, outRecords);
+}
+
+
+long long Percentile(std::vector<long long>& values, int percentile) {
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    //nearest rank: the smallest value with at least percentile % of the values not above it
+    size_t rank = (values.size() * percentile + 99) / 100;
+    return values[rank ? rank - 1 : 0];
+}
+
+
+bool Print(const std::string& operation) {
+    std::vector<Record> records;
+    if (!LoadRecords(records))
+        return false;
+
+    //operation -> version -> durations of the successful runs, and the failed runs
+    std::map<std::string, std::map<std::string, std::vector<long long> > > durations;
+    std::map<std::string, std::map<std::string, int> > failures;
+    std::map<std::string, std::vector<VersionGroup> > hypervisorGroups;
+    std::map<std::string, std::vector<VersionGroup> > cernvmGroups;
+    for (size_t i=0; i < records.size(); ++i) {
+        const Record& record = records[i];
+        if (!operation.empty() && record.operation != operation)
+            continue;
+        std::string version = record.cernvmVersion.empty() ? "unknown" : record.cernvmVersion;
+        if (!record.success) {
+            ++failures[record.operation][ALL_VERSIONS];
+            ++failures[record.operation][version];
+            durations[record.operation]; //listed even if it always failed
+            continue;
+        }
+        durations[record.operation][ALL_VERSIONS].push_back(record.durationMs);
+        durations[record.operation][version].push_back(record.durationMs);
+
+        for (int kind=0; kind < 2; ++kind) {
+            std::vector<VersionGroup>& groups = kind ? cernvmGroups[record.operation]
+                                                     : hypervisorGroups[record.operation];
+            const std::string& groupVersion = kind ? record.cernvmVersion : record.hypervisorVersion;
+            if (groupVersion.empty())
+                continue;
+            size_t g = 0;
+            while (g < groups.size() && groups[g].version != groupVersion)
+                ++g;
+            if (g == groups.size()) {
+                VersionGroup group = {groupVersion, std::vector<long long>(), 0};
+                groups.push_back(group);
+            }
+            groups[g].durationsMs.push_back(record.durationMs);
+            groups[g].lastIndex = i;
+        }
+    }
+
+    if (durations.empty()) {
+        std::cout << (operation.empty() ? "No operations recorded yet" : "No '" + operation + "' operations recorded yet")
+                  << " (in " << GetLogFile() << ")\n";
+        return true;
+    }
+
+    std::cout << std::left << std::setw(10) << "OPERATION" << std::setw(24) << "CERNVM VERSION"
+              << std::right << std::setw(7) << "COUNT" << std::setw(8) << "FAILED"
+              << std::setw(10) << "P50 (s)" << std::setw(10) << "P95 (s)" << std::setw(10) << "P99 (s)" << std::endl;
+    for (std::map<std::string, std::map<std::string, std::vector<long long> > >::iterator it = durations.begin();
+         it != durations.end(); ++it) {
+        std::map<std::string, int>& failed = failures[it->first];
+        PrintRow(it->first, ALL_VERSIONS, it->second[ALL_VERSIONS], failed[ALL_VERSIONS]);
+        //per version rows only tell something new with several versions
+        std::set<std::string> versions;
+        for (std::map<std::string, std::vector<long long> >::const_iterator v = it->second.begin(); v != it->second.end(); ++v)
+            versions.insert(v->first);
+        for (std::map<std::string, int>::const_iterator v = failed.begin(); v != failed.end(); ++v)
+            versions.insert(v->first);
+        versions.erase(ALL_VERSIONS);
+        if (versions.size() < 2)
+            continue;
+        for (std::set<std::string>::const_iterator v = versions.begin(); v != versions.end(); ++v)
+            PrintRow("", *v, it->second[*v], failed[*v]);
+    }
+
+    Config* config = Tools::GetGlobalConfig();
+    int thresholdPercent = config ? config->getInt("statsRegressionPercent", DEFAULT_REGRESSION_PERCENT)
+                                  : DEFAULT_REGRESSION_PERCENT;
+    bool regression = false;
+    std::cout << "\nRegressions (median slower by more than " << thresholdPercent << " %):\n";
+    for (std::map<std::string, std::map<std::string, std::vector<long long> > >::const_iterator it = durations.begin();
+         it != durations.end(); ++it) {
+        //print both, an upgrade of VirtualBox and of CernVM can come together
+        bool hypervisorRegression = PrintRegression(it->first, "VirtualBox", hypervisorGroups[it->first],
+                                                    thresholdPercent);
+        bool cernvmRegression = PrintRegression(it->first, "CernVM", cernvmGroups[it->first], thresholdPercent);
+        regression = regression || hypervisorRegression || cernvmRegression;
+    }
+    if (!regression)
+        std::cout << "\tnone\n";
+
+    return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Local helper functions
+//-----------------------------------------------------------------------------
+namespace {
+
+std::string GetLogFile() {
+    return (boost::filesystem::path(Tools::GetDataFolder()) / STATS_FILE).string();
+}
+
+
+long long NowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+//Log line layout (tab separated, one line per operation):
+//  TIMESTAMP OPERATION MACHINE_NAME ok|failed DURATION_MS CERNVM_VERSION VIRTUALBOX_VERSION PHASE=MS,PHASE=MS,...
+bool AppendRecord(const Record& record) {
+    std::ostringstream line;
+    line << record.timestamp << "\t" << record.operation << "\t" << record.machineName << "\t"
+         << (record.success ? "ok" : "failed") << "\t" << record.durationMs << "\t" << record.cernvmVersion
+         << "\t" << record.hypervisorVersion << "\t";
+    for (std::map<std::string, long long>::const_iterator it = record.phasesMs.begin(); it != record.phasesMs.end(); ++it)
+        line << (it == record.phasesMs.begin() ? "" : ",") << it->first << "=" << it->second;
+    line << "\n";
+
+    std::string file = GetLogFile();
+    FileLock lock(file + LOCK_EXTENSION);
+    if (!lock.locked())
+        return false;
+
+    boost::system::error_code ec;
+    if (boost::filesystem::exists(file, ec) && (long long) boost::filesystem::file_size(file, ec) > MAX_LOG_SIZE && !ec)
+        boost::filesystem::rename(file, file + ROTATED_EXTENSION, ec); //replaces the older one
+
+    std::ofstream ofs(file.c_str(), std::ios::out | std::ios::app);
+    ofs << line.str();
+    if (!ofs.good()) {
+        std::cerr << "Unable to write the operation log " << file << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+bool ParseRecord(const std::string& line, Record& outRecord) {
+    std::vector<std::string> fields = Tools::SplitString(line, '\t', 0);
+    long long timestamp = 0;
+    long long durationMs = 0;
+    if (fields.size() != 8 || !Tools::ParseInt(fields[0], timestamp) || !Tools::ParseInt(fields[4], durationMs)
+        || (fields[3] != "ok" && fields[3] != "failed"))
+        return false;
+
+    outRecord.timestamp = timestamp;
+    outRecord.operation = fields[1];
+    outRecord.machineName = fields[2];
+    outRecord.success = fields[3] == "ok";
+    outRecord.durationMs = durationMs;
+    outRecord.cernvmVersion = fields[5];
+    outRecord.hypervisorVersion = fields[6];
+    outRecord.phasesMs.clear();
+    std::vector<std::string> phases = Tools::SplitString(fields[7], ',', 0);
+    for (size_t i=0; i < phases.size(); ++i) {
+        std::string::size_type eq = phases[i].rfind('=');
+        long long phaseMs = 0;
+        if (eq != std::string::npos && Tools::ParseInt(phases[i].substr(eq + 1), phaseMs))
+            outRecord.phasesMs[phases[i].substr(0, eq)] = phaseMs;
+    }
+    return true;
+}
+
+
+bool LoadFile(const std::string& file, std::vector<Record>& outRecords) {
+    std::ifstream ifs(file.c_str());
+    if (!ifs.good()) //nothing recorded yet (or not rotated yet)
+        return true;
+
+    std::string line;
+    Record record;
+    while (std::getline(ifs, line)) {
+        if (ParseRecord(line, record))
+            outRecords.push_back(record);
+    }
+    return true;
+}
+
+
+void PrintRow(const std::string& operation, const std::string& version, std::vector<long long>& durationsMs,
+              int failed) {
+    std::cout << std::left << std::setw(10) << operation << std::setw(24) << version << std::right
+              << std::setw(7) << durationsMs.size() << std::setw(8) << failed;
+    std::streamsize precision = std::cout.precision(2);
+    std::cout << std::fixed;
+    if (durationsMs.empty())
+        std::cout << std::setw(10) << "-" << std::setw(10) << "-" << std::setw(10) << "-";
+    else
+        std::cout << std::setw(10) << Percentile(durationsMs, 50) / 1000.0
+                  << std::setw(10) << Percentile(durationsMs, 95) / 1000.0
+                  << std::setw(10) << Percentile(durationsMs, 99) / 1000.0;
+    std::cout << std::endl;
+    std::cout.unsetf(std::ios::fixed);
+    std::cout.precision(precision);
+}
+
+
+bool PrintRegression(const std::string& operation, const std::string& kind, std::vector<VersionGroup>& groups,
+                     int thresholdPercent) {
+    if (groups.size() < 2)
+        return false;
+    //compare the version used last with the one used before it (a downgrade compares the same way)
+    size_t current = 0;
+    for (size_t g=1; g < groups.size(); ++g) {
+        if (groups[g].lastIndex > groups[current].lastIndex)
+            current = g;
+    }
+    size_t previous = current == 0 ? 1 : 0;
+    for (size_t g=0; g < groups.size(); ++g) {
+        if (g != current && groups[g].lastIndex > groups[previous].lastIndex)
+            previous = g;
+    }
+    VersionGroup& now = groups[current];
+    VersionGroup& before = groups[previous];
+    if (now.durationsMs.size() < MIN_REGRESSION_SAMPLES || before.durationsMs.size() < MIN_REGRESSION_SAMPLES)
+        return false;
+
+    long long nowMs = Percentile(now.durationsMs, 50);
+    long long beforeMs = Percentile(before.durationsMs, 50);
+    if (nowMs * 100 <= beforeMs * (100 + thresholdPercent))
+        return false;
+
+    std::cout << "\t" << operation << ": " << nowMs / 1000.0 << " s with " << kind << " " << now.version
+              << " (" << now.durationsMs.size() << " runs), " << beforeMs / 1000.0 << " s with " << before.version
+              << " (" << before.durationsMs.size() << " runs)";
+    if (beforeMs > 0)
+        std::cout << ", +" << (nowMs - beforeMs) * 100 / beforeMs << " %";
+    std::cout << std::endl;
+    return true;
+}
+
+} //anonymous namespace
+
+} //namespace Stats
+} //namespace Launch
@@ -3,8 +3,30 @@
  * Author: Petr Jirout, 2016
  */
 
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#ifdef _WIN32
+#include <winsock2.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+#ifdef __APPLE__
+#include <mach-o/dyld.h>
+#endif
 
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
@@ -17,8 +39,9 @@
 namespace Launch {
 namespace Tools {
 
-//Global config map singleton object
-configMapType GlobalConfigMap;
+//Global config singleton object
+Config GlobalConfig;
+bool GlobalConfigLoaded = false;
 
 //systemPath changes the slashes to correct ones
 const std::string GLOBAL_CONFIG_FILENAME = systemPath(getHomeDir() + "/.cernvm-launch.conf");
@@ -40,16 +63,64 @@ const std::string defaultConfigFileStrPartTwo = \
 "disk=20000\n"
 "executionCap=100\n"
 "# Flags: 64bit, headful mode, graphical extensions\n"
-"flags=49\n";
-
-
-//Add non-existent items from sourceMap to outMap
-void AddMissingValuesToMap(configMapType& outMap, const configMapType& sourceMap) {
-    configMapType::const_iterator it = sourceMap.begin();
-    for (; it != sourceMap.end(); ++it) {
-        if (outMap.find(it->second) == outMap.end())
-            outMap.insert(std::make_pair(it->first, it->second));
+"flags=49\n"
+"########### CernVM-Launch operations ###########\n"
+"# How many machines are handled at once by bulk operations (e.g. create --count)\n"
+"parallelism=4\n"
+"# Destroy waits for VirtualBox to release the machine: first and maximal delay between checks, overall timeout\n"
+"destroyRetryInitialMs=250\n"
+"destroyRetryMaxMs=4000\n"
+"destroyTimeoutMs=60000\n"
+"# Size limit of the CernVM image cache in MB, least recently used images are evicted (0 is unlimited)\n"
+"cacheSizeLimitMB=0\n"
+"# Reuse context ISOs built from the same user data (0 lets libcernvm build an ISO for every machine)\n"
+"contextIsoCache=0\n"
+"# Admission control: machines are started only if they fit into the host memory and CPUs (0 disables it)\n"
+"admissionControl=1\n"
+"# Memory and CPUs of the running machines can exceed the host ones by these ratios (in percent)\n"
+"memoryOvercommitPercent=100\n"
+"cpuOvercommitPercent=400\n"
+"# Starting machines which do not fit wait for resources: first and maximal delay between checks, overall timeout (0 rejects them at once)\n"
+"admissionRetryInitialMs=500\n"
+"admissionRetryMaxMs=5000\n"
+"admissionTimeoutMs=300000\n"
+"# wait-ready and ssh --wait probe the SSH port: first and maximal delay between probes, overall timeout\n"
+"readyRetryInitialMs=50\n"
+"readyRetryMaxMs=500\n"
+"readyTimeoutMs=300000\n"
+"# User of exec (when no --user is given), and how long its shared SSH connections are kept open (0 closes them)\n"
+"sshUser=\n"
+"sshControlPersistSeconds=600\n"
+"# Range of the host ports forwarded to the API ports of the machines\n"
+"portRangeStart=40000\n"
+"portRangeEnd=49999\n"
+"# Log times of the machine operations for the stats command (0 disables it), slowdown reported as a regression\n"
+"statsLog=1\n"
+"statsRegressionPercent=20\n";
+
+
+std::string EscapeJson(const std::string& str) {
+    std::string result;
+    result.reserve(str.size());
+    for (size_t i=0; i < str.size(); ++i) {
+        unsigned char c = str[i];
+        switch (c) {
+            case '"':  result += "\\\""; break;
+            case '\\': result += "\\\\"; break;
+            case '\n': result += "\\n"; break;
+            case '\r': result += "\\r"; break;
+            case '\t': result += "\\t"; break;
+            default:
+                if (c < 0x20) { //other control characters
+                    char buffer[8];
+                    std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                    result += buffer;
+                }
+                else
+                    result.push_back(c);
+        }
     }
+    return result;
 }
 
 
@@ -95,24 +166,83 @@ bool CreateDefaultGlobalConfig() {
 }
 
 
-//Get a pointer to the global config object, load if necessary
-configMapTypePtr GetGlobalConfig() {
-    if (GlobalConfigMap.empty()) {
-        bool configLoaded = LoadGlobalConfig(GlobalConfigMap);
-        if (!configLoaded) { //unable to load the config, create a default one
-            if (!CreateDefaultGlobalConfig()) { //unable to write a global config file
-                std::cerr << "Unable to create default config\n";
-                return NULL;
-            }
-            GlobalConfigMap.clear();
-        }
-        configLoaded = LoadGlobalConfig(GlobalConfigMap);
-        if (!configLoaded) { //unable to load the newly created config
-            std::cerr << "Unable to load newly created config\n";
-            return NULL;
+bool IsGlobPattern(const std::string& str) {
+    return str.find_first_of("*?[") != std::string::npos;
+}
+
+
+bool IsTcpPortFree(int port) {
+#ifdef _WIN32
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+        return false;
+    SOCKET fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == INVALID_SOCKET) {
+        WSACleanup();
+        return false;
     }
+#else
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1)
+        return false;
+#endif
+
+    //VirtualBox binds the forwarded ports of running machines only
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    bool isFree = bind(fd, (sockaddr*) &addr, sizeof(addr)) == 0;
+
+#ifdef _WIN32
+    closesocket(fd);
+    WSACleanup();
+#else
+    close(fd);
+#endif
+    return isFree;
+}
+
+
+//Get a pointer to the global config object, load if necessary
+Config* GetGlobalConfig() {
+    if (GlobalConfigLoaded)
+        return &GlobalConfig;
+
+    boost::system::error_code ec;
+    if (!boost::filesystem::exists(GLOBAL_CONFIG_FILENAME, ec) && !CreateDefaultGlobalConfig()) {
+        std::cerr << "Unable to create default config\n";
+        return NULL;
     }
-    return &GlobalConfigMap;
+    if (!LoadGlobalConfig(GlobalConfig)) //an unreadable or invalid config is never overwritten by the default one
+        return NULL;
+
+    GlobalConfigLoaded = true;
+    return &GlobalConfig;
+}
+
+
+//The libcernvm application data folder, i.e. 'CernVM' or '.cernvm' subdirectory of the launchHomeFolder
+std::string GetDataFolder() {
+    return getAppDataPath();
+}
+
+
+std::string GetExecutablePath() {
+#if defined(_WIN32)
+    char path[MAX_PATH];
+    DWORD len = GetModuleFileNameA(NULL, path, MAX_PATH);
+    return len > 0 && len < MAX_PATH ? std::string(path, len) : "";
+#elif defined(__APPLE__)
+    char path[PATH_MAX];
+    uint32_t size = sizeof(path);
+    return _NSGetExecutablePath(path, &size) == 0 ? std::string(path) : "";
+#else
+    boost::system::error_code ec;
+    boost::filesystem::path path = boost::filesystem::read_symlink("/proc/self/exe", ec);
+    return ec ? "" : path.string();
+#endif
 }
 
 
@@ -170,8 +300,8 @@ bool MakeAbsolutePath(const std::string& path, std::string& outPath) {
 
 
 //Load global config file (with default VM parameters and Launch configuration)
-bool LoadGlobalConfig(std::map<const std::string, const std::string>& outMap) {
-    bool success = Tools::LoadFileIntoMap(GLOBAL_CONFIG_FILENAME, outMap);
+bool LoadGlobalConfig(Config& outConfig) {
+    bool success = outConfig.loadFile(GLOBAL_CONFIG_FILENAME, CONFIG_LAYER_GLOBAL);
 
     if (! success) {
         std::cout << "Unable to load the global config file: " << GLOBAL_CONFIG_FILENAME << std::endl;
@@ -213,68 +343,106 @@ std::vector<std::string> SplitString(const std::string &str, const char delim,
 }
 
 
-//Load <string,string> map from a file with key=value items.
-//Lines starting with '#' are considered as comments, thus ignored.
-//Lines without KEY_VALUE_SEPARATOR (i.e. '=') are ignored as well
-//Values can be quoted either with single or double quotes (quotes are discarded).
-//Existing values in the map are overwrited with a new value
-//We do not store items with an empty value.
-bool LoadFileIntoMap(const std::string& filename, std::map<const std::string, const std::string>& outMap) {
+//Fill output string with the content of the given file.
+//If an error occurs, false is returned.
+bool LoadFileIntoString(const std::string& filename, std::string& output) {
     std::ifstream ifs (filename);
+
     if (!ifs.good()) //error when opening a file
         return false;
 
-    for (std::string line; std::getline(ifs, line); ) { //for each line in the input
-        std::string key, value;
-        size_t len = line.size();
-        size_t i = 0;
+    //read the whole file at once, reserving the space up front
+    ifs.seekg(0, std::ios::end);
+    std::streamoff size = ifs.tellg();
+    ifs.seekg(0, std::ios::beg);
+    ifs.clear(); //pipes cannot seek, they are read as they come
+    if (size > 0)
+        output.reserve(output.size() + size + 1);
+    output.append(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
 
-        //ignore comments
-        if (len == 0 || line[0] == COMMENT_CHAR)
-            continue;
+    if (!output.empty() && output[output.size()-1] != '\n') //the last line is always terminated
+        output += "\n";
 
-        while (i < len && line[i++] != KEY_VALUE_SEPARATOR) //read the key
-            key.push_back(line[i-1]);
-
-        while (i++ < len) //read the value
-            value.push_back(line[i-1]);
-
-        boost::trim(key);
-        boost::trim(value);
-        //if the value is quoted, strip the quotes
-        size_t valueSize = value.size();
-        if (valueSize > 1 && (
-                (value[0] == '"' && value[valueSize-1] == '"') ||    // double quotes
-                (value[0] == '\'' && value[valueSize-1] == '\'') )) { // single quotes
-            value.erase(0, 1); //front quote
-            value.erase(value.size()-1); //end quote
-        }
+    return !ifs.bad();
+}
+
+
+bool MatchGlob(const std::string& pattern, const std::string& str) {
+    size_t p = 0, s = 0;
+    //position after the last '*' and the string position it is matched up to, for backtracking
+    size_t starP = std::string::npos, starS = 0;
 
-        if (key.empty() || value.empty()) //ignore invalid lines: empty or without value
+    while (s < str.size()) {
+        if (p < pattern.size() && pattern[p] == '*') {
+            starP = ++p;
+            starS = s;
+            continue;
+        }
+        if (p < pattern.size() && pattern[p] == '[') {
+            size_t i = p + 1;
+            bool negate = i < pattern.size() && pattern[i] == '!';
+            if (negate)
+                ++i;
+            bool matched = false;
+            size_t first = i;
+            for (; i < pattern.size() && (pattern[i] != ']' || i == first); ++i) {
+                if (i + 2 < pattern.size() && pattern[i+1] == '-' && pattern[i+2] != ']') { //range
+                    if (pattern[i] <= str[s] && str[s] <= pattern[i+2])
+                        matched = true;
+                    i += 2;
+                }
+                else if (pattern[i] == str[s])
+                    matched = true;
+            }
+            if (i < pattern.size() && matched != negate) { //closed set which matched
+                p = i + 1;
+                ++s;
+                continue;
+            }
+            if (i >= pattern.size() && str[s] == '[') { //unclosed set, '[' is a literal
+                ++p;
+                ++s;
+                continue;
+            }
+        }
+        else if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == str[s])) {
+            ++p;
+            ++s;
             continue;
-        else { //put on the map (little cumbersome, since we have a const std::string map)
-            std::map<const std::string, const std::string>::iterator it = outMap.find(key);
-            if (it != outMap.end()) //the key already exists, erase it
-                outMap.erase(it);
-            outMap.insert(std::make_pair(key, value));
         }
+        if (starP == std::string::npos) //mismatch and nothing to backtrack to
+            return false;
+        p = starP; //let the last '*' consume one more character
+        s = ++starS;
     }
-    return true;
+    while (p < pattern.size() && pattern[p] == '*')
+        ++p;
+    return p == pattern.size();
 }
 
-//Fill output string with the content of the given file.
-//If an error occurs, false is returned.
-bool LoadFileIntoString(const std::string& filename, std::string& output) {
-    std::ifstream ifs (filename);
 
-    if (!ifs.good()) //error when opening a file
+bool ParseInt(const std::string& str, int& outValue) {
+    if (str.empty())
         return false;
+    errno = 0;
+    char* end = NULL;
+    long value = std::strtol(str.c_str(), &end, 10);
+    if (*end != '\0' || errno == ERANGE || value < INT_MIN || value > INT_MAX)
+        return false;
+    outValue = (int) value;
+    return true;
+}
 
-    for (std::string line; std::getline(ifs, line); ) { //for each line in the input
-        output += line;
-        output += "\n"; //std::getline discards the newline
-    }
 
+bool ParseInt(const std::string& str, long long& outValue) {
+    if (str.empty())
+        return false;
+    errno = 0;
+    char* end = NULL;
+    long long value = std::strtoll(str.c_str(), &end, 10);
+    if (*end != '\0' || errno == ERANGE)
+        return false;
+    outValue = value;
     return true;
 }
 
@@ -288,6 +456,89 @@ void PrintParameters(const std::vector<std::string>& fields, const ParameterMapP
     }
 }
 
+bool ProbeSshPort(int port, int timeoutMs) {
+#ifdef _WIN32
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+        return false;
+    SOCKET fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == INVALID_SOCKET) {
+        WSACleanup();
+        return false;
+    }
+    u_long nonBlocking = 1;
+    ioctlsocket(fd, FIONBIO, &nonBlocking);
+#else
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1)
+        return false;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+    //both the connect and the banner must come within timeoutMs
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now()
+                                                     + std::chrono::milliseconds(timeoutMs);
+    auto waitFor = [&](bool read) {
+        long long remainingMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                    deadline - std::chrono::steady_clock::now()).count();
+        if (remainingMs <= 0)
+            return false;
+        timeval timeout;
+        timeout.tv_sec = remainingMs / 1000;
+        timeout.tv_usec = (remainingMs % 1000) * 1000;
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(fd, &fds);
+        return select(fd + 1, read ? &fds : NULL, read ? NULL : &fds, NULL, &timeout) > 0;
+    };
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    bool connected = connect(fd, (sockaddr*) &addr, sizeof(addr)) == 0;
+#ifdef _WIN32
+    bool pending = !connected && WSAGetLastError() == WSAEWOULDBLOCK;
+    int errorLength = sizeof(int);
+#else
+    bool pending = !connected && errno == EINPROGRESS;
+    socklen_t errorLength = sizeof(int);
+#endif
+    if (pending && waitFor(false)) {
+        int error = -1;
+        connected = getsockopt(fd, SOL_SOCKET, SO_ERROR, (char*) &error, &errorLength) == 0 && error == 0;
+    }
+
+    //the server sends its banner first, e.g. 'SSH-2.0-OpenSSH_7.4'
+    char banner[4];
+    int received = 0;
+    while (connected && received < (int) sizeof(banner) && waitFor(true)) {
+        int res = recv(fd, banner + received, sizeof(banner) - received, 0);
+        if (res <= 0)
+            break;
+        received += res;
+    }
+
+#ifdef _WIN32
+    closesocket(fd);
+    WSACleanup();
+#else
+    close(fd);
+#endif
+    return received == (int) sizeof(banner) && memcmp(banner, "SSH-", sizeof(banner)) == 0;
+}
+
+
+std::string QuoteArgument(const std::string& arg) {
+#ifdef _WIN32
+    return "\"" + boost::algorithm::replace_all_copy(arg, "\"", "\\\"") + "\"";
+#else
+    return "'" + boost::algorithm::replace_all_copy(arg, "'", "'\\''") + "'";
+#endif
+}
+
+
 //Set additional binary mask flags in the given string
 bool SetFlagsInString(std::string& flagsStr, int additionalFlags) {
     int numFlags;
@@ -304,5 +555,66 @@ bool SetFlagsInString(std::string& flagsStr, int additionalFlags) {
 }
 
 
+bool SpawnDetached(const std::vector<std::string>& args, const std::string& logFile) {
+    if (args.empty())
+        return false;
+#ifdef _WIN32
+    std::string commandLine;
+    for (size_t i=0; i < args.size(); ++i)
+        commandLine += (i ? " \"" : "\"") + args[i] + "\"";
+
+    SECURITY_ATTRIBUTES attributes = {sizeof(attributes), NULL, TRUE}; //the child inherits the log handle
+    HANDLE log = CreateFileA(logFile.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE, &attributes,
+                             OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (log == INVALID_HANDLE_VALUE)
+        return false;
+    STARTUPINFOA startupInfo;
+    memset(&startupInfo, 0, sizeof(startupInfo));
+    startupInfo.cb = sizeof(startupInfo);
+    startupInfo.dwFlags = STARTF_USESTDHANDLES;
+    startupInfo.hStdOutput = log;
+    startupInfo.hStdError = log;
+    PROCESS_INFORMATION processInfo;
+    bool success = CreateProcessA(NULL, &commandLine[0], NULL, NULL, TRUE, DETACHED_PROCESS, NULL, NULL,
+                                  &startupInfo, &processInfo) != 0;
+    if (success) {
+        CloseHandle(processInfo.hProcess);
+        CloseHandle(processInfo.hThread);
+    }
+    CloseHandle(log);
+    return success;
+#else
+    std::vector<char*> argv;
+    for (size_t i=0; i < args.size(); ++i)
+        argv.push_back(const_cast<char*>(args[i].c_str()));
+    argv.push_back(NULL);
+
+    //fork twice, so the program is adopted by init and never becomes our zombie
+    pid_t child = fork();
+    if (child == -1)
+        return false;
+    if (child == 0) {
+        setsid();
+        if (fork() != 0)
+            _exit(0);
+        int in = open("/dev/null", O_RDONLY);
+        int out = open(logFile.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (in != -1)
+            dup2(in, STDIN_FILENO);
+        if (out != -1) {
+            dup2(out, STDOUT_FILENO);
+            dup2(out, STDERR_FILENO);
+        }
+        execv(argv[0], &argv[0]);
+        _exit(127);
+    }
+    int status = 0;
+    while (waitpid(child, &status, 0) == -1 && errno == EINTR)
+        ;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#endif
+}
+
+
 } //namespace Tools
 } //namespace Launch
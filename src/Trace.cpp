@@ -0,0 +1,142 @@
+/**
+ * Recording of per-phase timings (spans), written in the Chrome trace-event format.
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Stats.h"
+#include "Tools.h"
+#include "Trace.h"
+
+
+namespace Launch {
+namespace Trace {
+
+//helper functions and definitions in an anonymous namespace (local)
+namespace {
+
+//One complete event ("ph":"X") of the trace
+struct SpanRecord {
+    std::string name;
+    std::string detail;
+    long long   startUs;
+    long long   durationUs;
+    int         threadId;
+};
+
+bool                    TraceEnabled = false;
+std::string             TraceFilename;
+std::mutex              TraceMutex;
+std::vector<SpanRecord> TraceSpans;
+//Small sequential numbers for threads, so the viewer shows them in order of appearance
+std::map<std::thread::id, int> ThreadIds;
+
+//Microseconds since the start of the program (all spans share the same time base)
+long long NowUs();
+void      FlushOnExit();
+
+} //anonymous namespace
+
+
+void Enable(const std::string& filename) {
+    std::lock_guard<std::mutex> lock(TraceMutex);
+    if (!TraceEnabled)
+        std::atexit(FlushOnExit);
+    TraceFilename = filename;
+    TraceEnabled = true;
+    NowUs(); //initialize the time base
+}
+
+
+bool IsEnabled() {
+    return TraceEnabled;
+}
+
+
+bool Flush() {
+    std::lock_guard<std::mutex> lock(TraceMutex);
+    if (!TraceEnabled)
+        return true;
+
+    std::ofstream ofs(TraceFilename.c_str(), std::ios::out | std::ios::trunc);
+    if (!ofs.good()) {
+        std::cerr << "Unable to write the trace file: " << TraceFilename << std::endl;
+        return false;
+    }
+
+    ofs << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (size_t i=0; i < TraceSpans.size(); ++i) {
+        const SpanRecord& span = TraceSpans[i];
+        ofs << (i ? ",\n" : "\n")
+            << "{\"name\":\"" << Tools::EscapeJson(span.name) << "\",\"cat\":\"launch\",\"ph\":\"X\""
+            << ",\"ts\":" << span.startUs << ",\"dur\":" << span.durationUs
+            << ",\"pid\":1,\"tid\":" << span.threadId;
+        if (!span.detail.empty())
+            ofs << ",\"args\":{\"detail\":\"" << Tools::EscapeJson(span.detail) << "\"}";
+        ofs << "}";
+    }
+    ofs << "\n]}\n";
+
+    return ofs.good();
+}
+
+
+Span::Span(const std::string& name, const std::string& detail)
+    : _startUs(-1) {
+    //the spans are the phases of the operations in the stats log as well
+    if (!TraceEnabled && !Stats::IsRecording())
+        return;
+    _name = name;
+    _detail = detail;
+    _startUs = NowUs();
+}
+
+
+Span::~Span() {
+    if (_startUs < 0) //neither tracing nor the stats were enabled
+        return;
+
+    SpanRecord record;
+    record.name = _name;
+    record.detail = _detail;
+    record.startUs = _startUs;
+    record.durationUs = NowUs() - _startUs;
+    Stats::AddPhase(_name, record.durationUs);
+    if (!TraceEnabled)
+        return;
+
+    std::lock_guard<std::mutex> lock(TraceMutex);
+    std::map<std::thread::id, int>::iterator it = ThreadIds.find(std::this_thread::get_id());
+    if (it == ThreadIds.end())
+        it = ThreadIds.insert(std::make_pair(std::this_thread::get_id(), (int) ThreadIds.size() + 1)).first;
+    record.threadId = it->second;
+    TraceSpans.push_back(record);
+}
+
+
+//-----------------------------------------------------------------------------
+// Local helper functions
+//-----------------------------------------------------------------------------
+namespace {
+
+long long NowUs() {
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+void FlushOnExit() {
+    Flush();
+}
+
+} //anonymous namespace
+
+} //namespace Trace
+} //namespace Launch
@@ -0,0 +1,100 @@
+/**
+ * Direct VBoxManage invocations, for the few operations libcernvm does not provide.
+ */
+
+#include <cstdio>
+#include <sstream>
+
+#include <boost/algorithm/string.hpp>
+
+#include "Tools.h"
+#include "Trace.h"
+#include "VBoxManage.h"
+
+#ifdef _WIN32
+#define popen  _popen
+#define pclose _pclose
+#else
+#include <sys/wait.h>
+#endif
+
+
+namespace Launch {
+namespace VBoxManage {
+
+int Run(HVInstancePtr hv, const std::vector<std::string>& args, std::vector<std::string>* outLines) {
+    if (!hv)
+        return -1;
+
+    std::string command = Tools::QuoteArgument(hv->hvBinary);
+    for (size_t i=0; i < args.size(); ++i)
+        command += " " + Tools::QuoteArgument(args[i]);
+    command += " 2>&1";
+#ifdef _WIN32
+    command = "\"" + command + "\""; //cmd.exe strips the outer quotes
+#endif
+
+    Trace::Span span("VBoxManage", args.empty() ? "" : args[0]);
+    FILE* pipe = popen(command.c_str(), "r");
+    if (!pipe)
+        return -1;
+
+    std::string output;
+    char buffer[4096];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), pipe)) > 0)
+        output.append(buffer, count);
+
+    int status = pclose(pipe);
+#ifndef _WIN32
+    status = (status != -1 && WIFEXITED(status)) ? WEXITSTATUS(status) : -1;
+#endif
+
+    if (outLines) {
+        std::istringstream iss(output);
+        for (std::string line; std::getline(iss, line); ) {
+            if (!line.empty() && line[line.size()-1] == '\r')
+                line.erase(line.size()-1);
+            outLines->push_back(line);
+        }
+    }
+    return status;
+}
+
+
+bool GetVMInfo(HVInstancePtr hv, const std::string& machine, vmInfoType& outInfo, bool* outNotFound) {
+    std::vector<std::string> args = {"showvminfo", machine, "--machinereadable"};
+    std::vector<std::string> lines;
+    if (outNotFound)
+        *outNotFound = false;
+    if (Run(hv, args, &lines) != 0) {
+        //other failures (e.g. VBoxSVC busy or timing out) say nothing about the machine
+        for (size_t i=0; outNotFound && i < lines.size(); ++i) {
+            if (lines[i].find("Could not find a registered machine") != std::string::npos
+                    || lines[i].find("VBOX_E_OBJECT_NOT_FOUND") != std::string::npos)
+                *outNotFound = true;
+        }
+        return false;
+    }
+
+    for (size_t i=0; i < lines.size(); ++i) {
+        size_t pos = lines[i].find('=');
+        if (pos == std::string::npos)
+            continue;
+        std::string key = lines[i].substr(0, pos);
+        std::string value = lines[i].substr(pos + 1);
+        boost::algorithm::trim_if(key, boost::algorithm::is_any_of("\""));
+        boost::algorithm::trim_if(value, boost::algorithm::is_any_of("\""));
+        outInfo[key] = value;
+    }
+    return true;
+}
+
+
+std::string GetMachineId(HVSessionPtr session) {
+    std::string name = session->parameters->get("name", "");
+    return session->local->get("vboxid", name);
+}
+
+} //namespace VBoxManage
+} //namespace Launch
@@ -0,0 +1,57 @@
+/**
+ * Bounded pool of worker threads for operations on several machines at once.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <iostream>
+#include <thread>
+
+#include "Tools.h"
+#include "WorkerPool.h"
+
+
+namespace Launch {
+namespace WorkerPool {
+
+unsigned DefaultParallelism() {
+    Config* config = Tools::GetGlobalConfig();
+    if (!config)
+        return DEFAULT_PARALLELISM;
+    return config->getInt("parallelism", DEFAULT_PARALLELISM); //validated when the config is loaded
+}
+
+
+std::vector<bool> Run(size_t jobCount, unsigned parallelism, const jobType& job) {
+    //std::vector<bool> is packed, threads must not write into it concurrently
+    std::vector<char> results(jobCount, 0);
+    std::atomic<size_t> nextJob(0);
+
+    auto worker = [&]() {
+        for (size_t i = nextJob++; i < jobCount; i = nextJob++) {
+            try {
+                results[i] = job(i) ? 1 : 0;
+            }
+            catch (std::exception& e) {
+                std::cerr << "Unexpected error: " << e.what() << std::endl;
+            }
+        }
+    };
+
+    size_t threadCount = std::min<size_t>(std::max(parallelism, 1u), jobCount);
+    if (threadCount <= 1)
+        worker(); //no need for extra threads
+    else {
+        std::vector<std::thread> threads;
+        for (size_t i=0; i < threadCount; ++i)
+            threads.push_back(std::thread(worker));
+        for (size_t i=0; i < threads.size(); ++i)
+            threads[i].join();
+    }
+
+    return std::vector<bool>(results.begin(), results.end());
+}
+
+} //namespace WorkerPool
+} //namespace Launch
@@ -3,9 +3,12 @@
  * Author: Petr Jirout, 2016
  */
 
+#include <algorithm>
+#include <climits>
 #include <iostream>
 #include <string>
 #include <map>
+#include <vector>
 
 #include <CernVM/Utilities.h>
 #include <CernVM/Hypervisor.h>
@@ -13,8 +16,17 @@
 #include <CernVM/Hypervisor/Virtualbox/VBoxCommon.h>
 #include <CernVM/Hypervisor/Virtualbox/VBoxSession.h>
 
+#include "Batch.h"
+#include "Daemon.h"
+#include "Fleet.h"
+#include "Metrics.h"
+#include "Pool.h"
+#include "RemoteExec.h"
+#include "Stats.h"
 #include "Tools.h"
+#include "Trace.h"
 #include "RequestHandler.h"
+#include "WorkerPool.h"
 
 using namespace Launch;
 
@@ -29,9 +41,21 @@ bool CheckArgCount(int argc, int desiredCount, const std::string& errorMessageOn
 //Check if we should print help or not, before processing anything
 //(for avoiding prompting user for configuration too early
 int  CheckPrintHelp(int argc, char**argv);
-int  DispatchArguments(int argc, char** argv, Launch::RequestHandler& handler);
-int  HandleCreateRequest(int argc, char** argv, Launch::RequestHandler& handler);
-int  HandleImportRequest(int argc, char** argv, Launch::RequestHandler& handler);
+int  DispatchArguments(int argc, char** argv, Launch::HypervisorContext& ctx, Launch::RequestHandler& handler);
+int  HandleApplyRequest(int argc, char** argv, Launch::HypervisorContext& ctx, Launch::RequestHandler& handler);
+int  HandleBatchRequest(int argc, char** argv, Launch::HypervisorContext& ctx, Launch::RequestHandler& handler);
+int  HandleCreateRequest(int argc, char** argv, Launch::HypervisorContext& ctx, Launch::RequestHandler& handler);
+int  HandleExecRequest(int argc, char** argv, Launch::HypervisorContext& ctx, Launch::RequestHandler& handler);
+int  HandleImportRequest(int argc, char** argv, Launch::HypervisorContext& ctx, Launch::RequestHandler& handler);
+int  HandleListRequest(int argc, char** argv, Launch::HypervisorContext& ctx, Launch::RequestHandler& handler);
+int  HandleMetricsRequest(int argc, char** argv, Launch::HypervisorContext& ctx, Launch::RequestHandler& handler);
+int  HandlePoolRequest(int argc, char** argv, Launch::HypervisorContext& ctx, Launch::RequestHandler& handler);
+int  HandlePrefetchRequest(int argc, char** argv, Launch::HypervisorContext& ctx, Launch::RequestHandler& handler);
+int  HandleWaitReadyRequest(int argc, char** argv, Launch::HypervisorContext& ctx, Launch::RequestHandler& handler);
+//start, stop, pause and destroy, which accept several machine names, glob patterns or '--all'
+int  HandleMachinesRequest(int argc, char** argv, Launch::HypervisorContext& ctx, Launch::RequestHandler& handler);
+//Process global options (given before the command) and remove them from the arguments
+int  ParseGlobalOptions(int& argc, char**& argv);
 void PrintHelp();
 void PrintVersion();
 
@@ -48,34 +72,45 @@ const int ERR_RUNTIME_ERROR = 4;
 
 int main(int argc, char** argv) {
     int exitCode = 0;
+    if ((exitCode = ParseGlobalOptions(argc, argv)) != ERR_OK)
+        return exitCode;
     if ((exitCode = CheckPrintHelp(argc, argv)) != ERR_OK)
         return exitCode;
 
-    Tools::configMapTypePtr configMap = Tools::GetGlobalConfig();
-    if (configMap) {
-        if (configMap->find("launchHomeFolder") != configMap->end()) {
+    Trace::Span commandSpan("command", argv[1]);
+    Launch::Config* config;
+    {
+        Trace::Span span("GetGlobalConfig");
+        config = Tools::GetGlobalConfig();
+    }
+    if (config) {
+        if (config->has("launchHomeFolder")) {
             std::string canonLaunchPath;
-            if (!Tools::MakeAbsolutePath(configMap->at("launchHomeFolder"), canonLaunchPath)) {
+            if (!Tools::MakeAbsolutePath(config->get("launchHomeFolder"), canonLaunchPath)) {
                 std::cerr << "Unable to create an absolute path from the given launchHomeFolder: "
-                          << configMap->at("launchHomeFolder") << std::endl;
+                          << config->get("launchHomeFolder") << std::endl;
                 return ERR_RUNTIME_ERROR;
             }
 
-            //Save the absolute path to the config map
-            configMap->erase("launchHomeFolder");
-            configMap->insert(std::make_pair("launchHomeFolder", canonLaunchPath));
+            //Save the absolute path to the config
+            config->set("launchHomeFolder", canonLaunchPath, Launch::CONFIG_LAYER_GLOBAL);
 
             //Initialize the libcernvm path
-            bool ret = setAppDataBasePath(configMap->at("launchHomeFolder"));
+            bool ret = setAppDataBasePath(canonLaunchPath);
             if (! ret)
-                std::cerr << "Unable to set launchHomeFolder to: " << configMap->at("launchHomeFolder") << std::endl;
+                std::cerr << "Unable to set launchHomeFolder to: " << canonLaunchPath << std::endl;
         }
     }
     else
         return ERR_RUNTIME_ERROR; //error message is printed by GetGlobalConfig
 
+    //Let a running daemon handle the command, otherwise we handle it in this process
+    if (Daemon::IsForwardable(argc, argv) && Daemon::ForwardRequest(argc, argv, exitCode))
+        return exitCode;
+
+    Launch::HypervisorContext ctx;
     Launch::RequestHandler handler;
-    exitCode = DispatchArguments(argc, argv, handler);
+    exitCode = DispatchArguments(argc, argv, ctx, handler);
 
     return exitCode;
 }
@@ -115,7 +150,7 @@ int CheckPrintHelp(int argc, char** argv) {
 //Parse given arguments, verify them, and dispatch it to the correct function.
 //If anything is wrong, it prints the error message and returns appropriate code.
 //On success, 0 is returned.
-int DispatchArguments(int argc, char** argv, Launch::RequestHandler& handler) {
+int DispatchArguments(int argc, char** argv, Launch::HypervisorContext& ctx, Launch::RequestHandler& handler) {
     if (argc <= 1) {
         PrintHelp();
         return ERR_INVALID_PARAM_COUNT;
@@ -125,56 +160,79 @@ int DispatchArguments(int argc, char** argv, Launch::RequestHandler& handler) {
 
     //list VMs
     if (action == "list") {
-        if (argc == 3) {
-            if (std::string(argv[2]) == "--running") //list only running machines
-                success = handler.listRunningCvmMachines();
-            else //the user requested details of a machine
-                success = handler.listMachineDetail(argv[2]);
-        }
-        else if (CheckArgCount(argc, 2, "'list' takes no argument"))
-            success = handler.listCvmMachines();
-        else
-            return ERR_INVALID_PARAM_COUNT;
+        return HandleListRequest(argc, argv, ctx, handler);
     }
     //create a VM
     else if (action == "create") {
-        return HandleCreateRequest(argc, argv, handler);
-    }
-    //pause a VM
-    else if (action == "pause") {
-        if (!CheckArgCount(argc, 3, "'pause' requires one argument: machine name"))
-            return ERR_INVALID_PARAM_COUNT;
-        success = handler.pauseMachine(argv[2]);
+        return HandleCreateRequest(argc, argv, ctx, handler);
     }
     //import a VM
     else if (action == "import") {
-        return HandleImportRequest(argc, argv, handler);
+        return HandleImportRequest(argc, argv, ctx, handler);
+    }
+    //start, stop, pause or destroy one or more VMs
+    else if (action == "start" || action == "stop" || action == "pause" || action == "destroy") {
+        return HandleMachinesRequest(argc, argv, ctx, handler);
     }
-    //start a VM
-    else if (action == "start") {
-        if (!CheckArgCount(argc, 3, "'start' requires one argument: machine name"))
+    else if (action == "daemon") {
+        if (argc == 3 && std::string(argv[2]) == "--stop")
+            success = Daemon::StopDaemon();
+        else if (!CheckArgCount(argc, 2, "'daemon' takes no argument, except optional '--stop'"))
             return ERR_INVALID_PARAM_COUNT;
-        success = handler.startMachine(argv[2]);
+        else
+            success = Daemon::Serve(ctx, handler, DispatchArguments);
+    }
+    else if (action == "golden") {
+        if (!CheckArgCount(argc, 3, "'golden' requires one argument: machine name"))
+            return ERR_INVALID_PARAM_COUNT;
+        success = handler.goldenMachine(ctx, argv[2]);
+    }
+    else if (action == "snapshot" || action == "restore") {
+        if (!CheckArgCount(argc, 4, "'" + action + "' requires two arguments: machine name and snapshot tag"))
+            return ERR_INVALID_PARAM_COUNT;
+        if (action == "snapshot")
+            success = handler.snapshotMachine(ctx, argv[2], argv[3]);
+        else
+            success = handler.restoreMachine(ctx, argv[2], argv[3]);
     }
-    //stop a VM
-    else if (action == "stop") {
-        if (!CheckArgCount(argc, 3, "'stop' requires one argument: machine name"))
+    else if (action == "snapshots") {
+        if (!CheckArgCount(argc, 3, "'snapshots' requires one argument: machine name"))
             return ERR_INVALID_PARAM_COUNT;
-        success = handler.stopMachine(argv[2]);
+        success = handler.listSnapshots(ctx, argv[2]);
     }
-    //destroy a VM
-    else if (action == "destroy") {
-        if (argc == 4 && std::string(argv[2]) == "--force") // ./cernvm-launch destroy --force machine_name
-            success = handler.destroyMachine(argv[3], true); // force true
-        else if (!CheckArgCount(argc, 3, "'destroy' requires one argument: machine name"))
+    else if (action == "stats") {
+        if (argc > 3) {
+            std::cerr << "'stats' takes at most one argument: operation (e.g. start)\n";
             return ERR_INVALID_PARAM_COUNT;
-        else // ./cernvm-launch destroy machine_name
-            success = handler.destroyMachine(argv[2], false);
+        }
+        success = Stats::Print(argc == 3 ? argv[2] : "");
+    }
+    else if (action == "prefetch") {
+        return HandlePrefetchRequest(argc, argv, ctx, handler);
+    }
+    else if (action == "batch") {
+        return HandleBatchRequest(argc, argv, ctx, handler);
+    }
+    else if (action == "apply") {
+        return HandleApplyRequest(argc, argv, ctx, handler);
+    }
+    else if (action == "pool") {
+        return HandlePoolRequest(argc, argv, ctx, handler);
     }
     else if (action == "ssh") {
-        if (!CheckArgCount(argc, 3, "'ssh' requires one argument: machine name"))
+        bool waitReady = argc > 2 && std::string(argv[2]) == "--wait";
+        if (!CheckArgCount(argc - waitReady, 3, "'ssh' requires one argument: machine name (after optional '--wait')"))
             return ERR_INVALID_PARAM_COUNT;
-        success = handler.sshIntoMachine(argv[2]);
+        success = handler.sshIntoMachine(ctx, argv[2 + waitReady], waitReady);
+    }
+    else if (action == "exec") {
+        return HandleExecRequest(argc, argv, ctx, handler);
+    }
+    else if (action == "wait-ready") {
+        return HandleWaitReadyRequest(argc, argv, ctx, handler);
+    }
+    else if (action == "metrics") {
+        return HandleMetricsRequest(argc, argv, ctx, handler);
     }
     //print help
     else if (action == "-h" || action == "--help" || action == "help") {
@@ -202,7 +260,7 @@ int DispatchArguments(int argc, char** argv, Launch::RequestHandler& handler) {
 
 //Parse given arguments and invoke an appropriate method. Print error message on invalid input
 //Returns err code
-int HandleCreateRequest(int argc, char** argv, Launch::RequestHandler& handler) {
+int HandleCreateRequest(int argc, char** argv, Launch::HypervisorContext& ctx, Launch::RequestHandler& handler) {
 
     //These parameters flags require a value, e.g. --ram 512
     std::map<std::string, std::string> paramFlags = {
@@ -212,10 +270,16 @@ int HandleCreateRequest(int argc, char** argv, Launch::RequestHandler& handler)
         {"--name", ""},
         {"--sharedFolder", ""},
         {"--iso", ""},
+        {"--count", ""},
+        {"--name-prefix", ""},
+        {"--parallel", ""},
+        {"--linked-from", ""},
+        {"--from-pool", ""},
     };
     bool noStartFlag = false;
     std::string userDataFile;
     std::string paramFile;
+    std::vector<Launch::ContextIso::ContextFile> contextFiles;
 
     if (argc <= 1 || std::string(argv[1]) != "create")
         return ERR_INVALID_OPERATION;
@@ -225,6 +289,17 @@ int HandleCreateRequest(int argc, char** argv, Launch::RequestHandler& handler)
             noStartFlag = true;
             continue;
         }
+        if (std::string(argv[i]) == "--context-file") { // this flag can be given several times
+            if (i+1 == argc) {
+                std::cerr << "Missing value for: " << argv[i] << std::endl;
+                return ERR_INVALID_PARAM_COUNT;
+            }
+            Launch::ContextIso::ContextFile contextFile;
+            if (!Launch::ContextIso::ParseContextFile(argv[++i], contextFile))
+                return ERR_INVALID_PARAM_TYPE;
+            contextFiles.push_back(contextFile);
+            continue;
+        }
         bool matchedFlag = false;
         std::map<std::string, std::string>::iterator it = paramFlags.begin();
         for (; it != paramFlags.end(); ++it) { // go through paramFlags
@@ -254,13 +329,17 @@ int HandleCreateRequest(int argc, char** argv, Launch::RequestHandler& handler)
             }
         }
     }
-    //handler.createMachine(useData, boolStartOpt, paramFileOpt)
+    //handler.createMachine(ctx, useData, boolStartOpt, paramFileOpt)
     //Generic format: ./cernvm-launch create [--no-start] [--memory NUM] [--disk NUM] [--cpus NUM]
-    //                  [--sharedFolder PATH] [--iso PATH] [userData_file] [config_file]
+    //                  [--sharedFolder PATH] [--iso PATH] [--count NUM --name-prefix NAME [--parallel NUM]]
+    //                  [--context-file PATH[:DEST]]...
+    //                  [userData_file] [config_file]
+    //    or:           ./cernvm-launch create --linked-from BASE [--no-start] [--name NAME] [--memory NUM] [--cpus NUM]
+    //    or:           ./cernvm-launch create --from-pool POOL --name NAME [--no-start]
 
-    Tools::configMapType paramMap;
+    Launch::Config params;
     if (! paramFile.empty()) {
-        bool res = Tools::LoadFileIntoMap(paramFile, paramMap);
+        bool res = params.loadFile(paramFile, Launch::CONFIG_LAYER_FILE);
         if (!res) {
             std::cerr << "Error while processing file: " << paramFile << std::endl;
             return ERR_INVALID_PARAM_TYPE;
@@ -274,17 +353,148 @@ int HandleCreateRequest(int argc, char** argv, Launch::RequestHandler& handler)
             continue;
         std::string key = (it->first).substr(2); // remove the '--'
 
-        if (paramMap.find(key) != paramMap.end())
-            paramMap.erase(paramMap.find(key));
-
         //If user specified '--iso' parameter, we set isoPath parameter (libcernvm name)
         if (key == "iso")
-            paramMap.insert(std::make_pair("isoPath", it->second));
+            key = "isoPath";
+        else if (key == "name-prefix") //same name as in the parameter file
+            key = "namePrefix";
+        else if (key == "linked-from")
+            key = "linkedFrom";
+        else if (key == "from-pool")
+            key = "fromPool";
+
+        if (!params.set(key, it->second, Launch::CONFIG_LAYER_COMMAND_LINE))
+            return ERR_INVALID_PARAM_TYPE;
+    }
+
+    //Bulk creation, given either on the command line or in the parameter file.
+    //These are not machine parameters, so they are removed from the config
+    bool hasCount = params.has("count");
+    int count = params.getInt("count", 1);
+    std::string namePrefix = params.extract("namePrefix");
+    bool hasParallel = params.has("parallel");
+    int parallelism = params.getInt("parallel", Launch::WorkerPool::DefaultParallelism());
+    std::string linkedFrom = params.extract("linkedFrom");
+    std::string fromPool = params.extract("fromPool");
+    params.erase("count");
+    params.erase("parallel");
+    bool success;
+
+    if (!fromPool.empty()) {
+        //the machine comes from the pool, everything else is given by the profile of the pool
+        std::vector<std::string> keys = params.keys();
+        if (keys.size() != 1 || keys[0] != "name" || hasCount || !linkedFrom.empty()
+                || !userDataFile.empty() || !contextFiles.empty()) {
+            std::cerr << "'--from-pool' can be combined only with '--name' (required) and '--no-start'\n";
+            return ERR_INVALID_PARAM_COUNT;
+        }
+        success = Launch::Pool::CreateFromPool(ctx, handler, fromPool, params.get("name"), !noStartFlag);
+    }
+    else if (!linkedFrom.empty()) {
+        if (hasCount) {
+            std::cerr << "'--linked-from' cannot be combined with '--count'\n";
+            return ERR_INVALID_PARAM_COUNT;
+        }
+        if (!userDataFile.empty() || !contextFiles.empty()) {
+            std::cerr << "A linked clone uses the context of its base machine, do not give a user data file or context files\n";
+            return ERR_INVALID_PARAM_COUNT;
+        }
+        success = handler.createLinkedClone(ctx, linkedFrom, !noStartFlag, params);
+    }
+    else if (!hasCount) {
+        if (!namePrefix.empty() || hasParallel) {
+            std::cerr << "'--name-prefix' and '--parallel' can be used only together with '--count'\n";
+            return ERR_INVALID_PARAM_COUNT;
+        }
+        success = handler.createMachine(ctx, userDataFile, !noStartFlag, params, contextFiles);
+    }
+    else {
+        //count and parallel are validated as positive numbers by the config
+        if (namePrefix.empty()) {
+            std::cerr << "'--count' requires '--name-prefix'\n";
+            return ERR_INVALID_PARAM_COUNT;
+        }
+        if (params.has("name")) {
+            std::cerr << "Machine name cannot be used with '--count', machines are named by '--name-prefix'\n";
+            return ERR_INVALID_PARAM_COUNT;
+        }
+        success = handler.createMachines(ctx, userDataFile, !noStartFlag, params, count, namePrefix, parallelism,
+                                        contextFiles);
+    }
+
+    if (success)
+        return ERR_OK;
+    else
+        return ERR_RUNTIME_ERROR;
+}
+
+
+//Parse given arguments and invoke the operation for every selected machine. Print error message on invalid input
+//Returns err code
+int HandleMachinesRequest(int argc, char** argv, Launch::HypervisorContext& ctx, Launch::RequestHandler& handler) {
+    //Generic format: ./cernvm-launch start|stop|pause|destroy [--parallel NUM] (--all | MACHINE_NAME|PATTERN...)
+    //                (destroy takes an optional --force as well)
+    std::string action = argv[1];
+    std::vector<std::string> patterns;
+    bool allFlag = false;
+    bool forceFlag = false;
+    int parallelism = 0;
+
+    for (int i=2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--all")
+            allFlag = true;
+        else if (arg == "--force" && action == "destroy")
+            forceFlag = true;
+        else if (arg == "--parallel") {
+            if (i+1 == argc) {
+                std::cerr << "Missing value for: " << arg << std::endl;
+                return ERR_INVALID_PARAM_COUNT;
+            }
+            if (!Tools::ParseInt(argv[++i], parallelism) || parallelism <= 0) {
+                std::cerr << "Invalid parallelism: '" << argv[i] << "', a positive number is expected\n";
+                return ERR_INVALID_PARAM_TYPE;
+            }
+        }
+        else if (arg.size() > 1 && arg[0] == '-') {
+            std::cerr << "Unknown option for '" << action << "': " << arg << std::endl;
+            return ERR_INVALID_PARAM_TYPE;
+        }
         else
-            paramMap.insert(std::make_pair(key, it->second));
+            patterns.push_back(arg);
     }
 
-    bool success = handler.createMachine(userDataFile, !noStartFlag, paramMap);
+    if (allFlag == !patterns.empty()) {
+        std::cerr << "'" << action << "' requires machine names (or glob patterns), or '--all'\n";
+        return ERR_INVALID_PARAM_COUNT;
+    }
+    if (parallelism == 0)
+        parallelism = Launch::WorkerPool::DefaultParallelism();
+
+    std::vector<std::string> machineNames;
+    if (!handler.resolveMachineNames(ctx, patterns, allFlag, machineNames))
+        return ERR_RUNTIME_ERROR;
+    if (machineNames.empty()) {
+        std::cout << "There are no machines\n";
+        return ERR_OK;
+    }
+
+    bool success;
+    if (action == "destroy")
+        success = handler.destroyMachines(ctx, machineNames, forceFlag, parallelism);
+    else {
+        bool (Launch::RequestHandler::*operation)(Launch::HypervisorContext&, const std::string&);
+        if (action == "start")
+            operation = &Launch::RequestHandler::startMachine;
+        else if (action == "stop")
+            operation = &Launch::RequestHandler::stopMachine;
+        else
+            operation = &Launch::RequestHandler::pauseMachine;
+
+        success = handler.forEachMachine(machineNames, [&](const std::string& machineName) {
+            return (handler.*operation)(ctx, machineName);
+        }, parallelism);
+    }
 
     if (success)
         return ERR_OK;
@@ -293,7 +503,403 @@ int HandleCreateRequest(int argc, char** argv, Launch::RequestHandler& handler)
 }
 
 
-int HandleImportRequest(int argc, char** argv, Launch::RequestHandler& handler) {
+int HandleApplyRequest(int argc, char** argv, Launch::HypervisorContext& ctx, Launch::RequestHandler& handler) {
+    //Generic format: ./cernvm-launch apply [--dry-run] [--prune] [--parallel NUM] MANIFEST
+    bool dryRun = false;
+    bool prune = false;
+    int parallelism = Launch::WorkerPool::DefaultParallelism();
+    std::string manifest;
+
+    for (int i=2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--dry-run")
+            dryRun = true;
+        else if (arg == "--prune")
+            prune = true;
+        else if (arg == "--parallel") {
+            if (i+1 == argc) {
+                std::cerr << "Missing value for: " << arg << std::endl;
+                return ERR_INVALID_PARAM_COUNT;
+            }
+            if (!Tools::ParseInt(argv[++i], parallelism) || parallelism <= 0) {
+                std::cerr << "Invalid parallelism: '" << argv[i] << "', a positive number is expected\n";
+                return ERR_INVALID_PARAM_TYPE;
+            }
+        }
+        else if (arg.size() > 1 && arg[0] == '-') {
+            std::cerr << "Unknown option for 'apply': " << arg << std::endl;
+            return ERR_INVALID_PARAM_TYPE;
+        }
+        else if (!manifest.empty()) {
+            std::cerr << "'apply' takes exactly one manifest\n";
+            return ERR_INVALID_PARAM_COUNT;
+        }
+        else
+            manifest = arg;
+    }
+    if (manifest.empty()) {
+        std::cerr << "'apply' requires a manifest file\n";
+        return ERR_INVALID_PARAM_COUNT;
+    }
+
+    std::vector<Fleet::FleetMachine> machines;
+    if (!Fleet::LoadManifest(manifest, machines))
+        return ERR_INVALID_PARAM_TYPE;
+
+    std::vector<Fleet::Action> plan;
+    if (!Fleet::Plan(ctx, machines, prune, plan))
+        return ERR_RUNTIME_ERROR;
+    Fleet::PrintPlan(plan);
+    if (dryRun || plan.empty())
+        return ERR_OK;
+
+    if (Fleet::Apply(ctx, handler, machines, plan, parallelism))
+        return ERR_OK;
+    else
+        return ERR_RUNTIME_ERROR;
+}
+
+
+int HandleBatchRequest(int argc, char** argv, Launch::HypervisorContext& ctx, Launch::RequestHandler& handler) {
+    //Generic format: ./cernvm-launch batch [--parallel NUM] [FILE|-]
+    int parallelism = 1; //lines may depend on the previous ones
+    std::string filename;
+
+    for (int i=2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--parallel") {
+            if (i+1 == argc) {
+                std::cerr << "Missing value for: " << arg << std::endl;
+                return ERR_INVALID_PARAM_COUNT;
+            }
+            if (!Tools::ParseInt(argv[++i], parallelism) || parallelism <= 0) {
+                std::cerr << "Invalid parallelism: '" << argv[i] << "', a positive number is expected\n";
+                return ERR_INVALID_PARAM_TYPE;
+            }
+        }
+        else if (arg.size() > 1 && arg[0] == '-') {
+            std::cerr << "Unknown option for 'batch': " << arg << std::endl;
+            return ERR_INVALID_PARAM_TYPE;
+        }
+        else if (!filename.empty()) {
+            std::cerr << "'batch' takes at most one file\n";
+            return ERR_INVALID_PARAM_COUNT;
+        }
+        else
+            filename = arg;
+    }
+    if (filename.empty())
+        filename = "-"; //commands from stdin
+
+    if (Batch::Run(filename, parallelism, ctx, handler, DispatchArguments))
+        return ERR_OK;
+    else
+        return ERR_RUNTIME_ERROR;
+}
+
+
+int HandleListRequest(int argc, char** argv, Launch::HypervisorContext& ctx, Launch::RequestHandler& handler) {
+    //Generic format: ./cernvm-launch list [--running] [--format text|json|ports] [MACHINE_NAME]
+    bool runningOnly = false;
+    std::string format = "text";
+    std::string machineName;
+
+    for (int i=2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--running")
+            runningOnly = true;
+        else if (arg == "--format") {
+            if (i+1 == argc) {
+                std::cerr << "Missing value for: " << arg << std::endl;
+                return ERR_INVALID_PARAM_COUNT;
+            }
+            format = argv[++i];
+            if (format != "text" && format != "json" && format != "ports") {
+                std::cerr << "Unknown format: " << format << " (use 'text', 'json' or 'ports')\n";
+                return ERR_INVALID_PARAM_TYPE;
+            }
+        }
+        else if (arg.size() > 1 && arg[0] == '-') {
+            std::cerr << "Unknown option for 'list': " << arg << std::endl;
+            return ERR_INVALID_PARAM_TYPE;
+        }
+        else if (!machineName.empty()) {
+            std::cerr << "'list' takes at most one machine name\n";
+            return ERR_INVALID_PARAM_COUNT;
+        }
+        else
+            machineName = arg;
+    }
+
+    bool success;
+    if (format == "json")
+        success = handler.listMachinesJson(ctx, runningOnly, machineName);
+    else if (format == "ports")
+        success = handler.listPortAllocations(ctx, runningOnly, machineName);
+    else if (!machineName.empty()) {
+        if (runningOnly) {
+            std::cerr << "'list --running' takes no machine name\n";
+            return ERR_INVALID_PARAM_COUNT;
+        }
+        success = handler.listMachineDetail(ctx, machineName); //the user requested details of a machine
+    }
+    else if (runningOnly)
+        success = handler.listRunningCvmMachines(ctx);
+    else
+        success = handler.listCvmMachines(ctx);
+
+    if (success)
+        return ERR_OK;
+    else
+        return ERR_RUNTIME_ERROR;
+}
+
+
+int HandlePoolRequest(int argc, char** argv, Launch::HypervisorContext& ctx, Launch::RequestHandler& handler) {
+    //Generic format: ./cernvm-launch pool fill [--parallel NUM] PROFILE [NUM]
+    //                ./cernvm-launch pool status
+    if (argc == 3 && std::string(argv[2]) == "status")
+        return Pool::Status(ctx) ? ERR_OK : ERR_RUNTIME_ERROR;
+    if (argc < 3 || std::string(argv[2]) != "fill") {
+        std::cerr << "'pool' requires a subcommand: fill or status\n";
+        return ERR_INVALID_PARAM_COUNT;
+    }
+
+    int parallelism = Launch::WorkerPool::DefaultParallelism();
+    int count = 0; //keep the size of the pool
+    std::string profile;
+    for (int i=3; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--parallel") {
+            if (i+1 == argc) {
+                std::cerr << "Missing value for: " << arg << std::endl;
+                return ERR_INVALID_PARAM_COUNT;
+            }
+            if (!Tools::ParseInt(argv[++i], parallelism) || parallelism <= 0) {
+                std::cerr << "Invalid parallelism: '" << argv[i] << "', a positive number is expected\n";
+                return ERR_INVALID_PARAM_TYPE;
+            }
+        }
+        else if (arg.size() > 1 && arg[0] == '-') {
+            std::cerr << "Unknown option for 'pool fill': " << arg << std::endl;
+            return ERR_INVALID_PARAM_TYPE;
+        }
+        else if (profile.empty())
+            profile = arg;
+        else if (count == 0) {
+            if (!Tools::ParseInt(arg, count) || count <= 0) {
+                std::cerr << "Invalid pool size: '" << arg << "', a positive number is expected\n";
+                return ERR_INVALID_PARAM_TYPE;
+            }
+        }
+        else {
+            std::cerr << "'pool fill' takes a profile and an optional pool size\n";
+            return ERR_INVALID_PARAM_COUNT;
+        }
+    }
+    if (profile.empty()) {
+        std::cerr << "'pool fill' requires a profile\n";
+        return ERR_INVALID_PARAM_COUNT;
+    }
+
+    if (Pool::Fill(ctx, handler, profile, count, parallelism))
+        return ERR_OK;
+    else
+        return ERR_RUNTIME_ERROR;
+}
+
+
+int HandlePrefetchRequest(int argc, char** argv, Launch::HypervisorContext& ctx, Launch::RequestHandler& handler) {
+    //Generic format: ./cernvm-launch prefetch [--flavor FLAVOR] [--arch ARCH] VERSION...
+    //                ./cernvm-launch prefetch --list
+    std::string flavor = "prod";
+    std::string arch = "x86_64";
+    std::vector<std::string> versions;
+
+    if (argc == 3 && std::string(argv[2]) == "--list")
+        return handler.listCachedImages() ? ERR_OK : ERR_RUNTIME_ERROR;
+
+    for (int i=2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--flavor" || arg == "--arch") {
+            if (i+1 == argc) {
+                std::cerr << "Missing value for: " << arg << std::endl;
+                return ERR_INVALID_PARAM_COUNT;
+            }
+            (arg == "--flavor" ? flavor : arch) = argv[++i];
+        }
+        else if (arg.size() > 1 && arg[0] == '-') {
+            std::cerr << "Unknown option for 'prefetch': " << arg << std::endl;
+            return ERR_INVALID_PARAM_TYPE;
+        }
+        else
+            versions.push_back(arg);
+    }
+    if (versions.empty()) {
+        std::cerr << "'prefetch' requires at least one CernVM version (or '--list')\n";
+        return ERR_INVALID_PARAM_COUNT;
+    }
+
+    if (handler.prefetchImages(ctx, versions, flavor, arch))
+        return ERR_OK;
+    else
+        return ERR_RUNTIME_ERROR;
+}
+
+
+int HandleExecRequest(int argc, char** argv, Launch::HypervisorContext& ctx, Launch::RequestHandler& handler) {
+    //Generic format: ./cernvm-launch exec [--parallel NUM] [--user USER] (--all | MACHINE_NAME|PATTERN...) -- COMMAND...
+    std::vector<std::string> patterns;
+    std::vector<std::string> command;
+    std::string user;
+    bool allFlag = false;
+    int parallelism = 0;
+
+    for (int i=2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--") {
+            command.assign(argv + i + 1, argv + argc);
+            break;
+        }
+        else if (arg == "--all")
+            allFlag = true;
+        else if (arg == "--parallel" || arg == "--user") {
+            if (i+1 == argc) {
+                std::cerr << "Missing value for: " << arg << std::endl;
+                return ERR_INVALID_PARAM_COUNT;
+            }
+            if (arg == "--user")
+                user = argv[++i];
+            else if (!Tools::ParseInt(argv[++i], parallelism) || parallelism <= 0) {
+                std::cerr << "Invalid parallelism: '" << argv[i] << "', a positive number is expected\n";
+                return ERR_INVALID_PARAM_TYPE;
+            }
+        }
+        else if (arg.size() > 1 && arg[0] == '-') {
+            std::cerr << "Unknown option for 'exec': " << arg << std::endl;
+            return ERR_INVALID_PARAM_TYPE;
+        }
+        else
+            patterns.push_back(arg);
+    }
+
+    if (allFlag == !patterns.empty()) {
+        std::cerr << "'exec' requires machine names (or glob patterns), or '--all'\n";
+        return ERR_INVALID_PARAM_COUNT;
+    }
+    if (command.empty()) {
+        std::cerr << "'exec' requires a command after '--'\n";
+        return ERR_INVALID_PARAM_COUNT;
+    }
+    Launch::Config* globalConfig = Tools::GetGlobalConfig();
+    if (user.empty() && globalConfig)
+        user = globalConfig->get("sshUser");
+    if (user.empty()) {
+        std::cerr << "'exec' requires --user (or sshUser in the global config)\n";
+        return ERR_INVALID_PARAM_COUNT;
+    }
+    if (parallelism == 0)
+        parallelism = Launch::WorkerPool::DefaultParallelism();
+
+    std::vector<std::string> machineNames;
+    if (!handler.resolveMachineNames(ctx, patterns, allFlag, machineNames))
+        return ERR_RUNTIME_ERROR;
+    if (allFlag) { //all running machines, stopped ones are not an error
+        machineNames.erase(std::remove_if(machineNames.begin(), machineNames.end(), [&](const std::string& name) {
+            return !ctx.isRunning(name);
+        }), machineNames.end());
+    }
+    if (machineNames.empty()) {
+        std::cout << "There are no machines\n";
+        return ERR_OK;
+    }
+
+    if (Launch::RemoteExec::Run(ctx, machineNames, user, command, parallelism))
+        return ERR_OK;
+    else
+        return ERR_RUNTIME_ERROR;
+}
+
+
+int HandleWaitReadyRequest(int argc, char** argv, Launch::HypervisorContext& ctx, Launch::RequestHandler& handler) {
+    //Generic format: ./cernvm-launch wait-ready [--timeout SECONDS] MACHINE_NAME
+    int timeoutMs = -1; //readyTimeoutMs of the global config
+    std::string machineName;
+
+    for (int i=2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--timeout") {
+            int seconds = 0;
+            if (i+1 == argc) {
+                std::cerr << "Missing value for: " << arg << std::endl;
+                return ERR_INVALID_PARAM_COUNT;
+            }
+            if (!Tools::ParseInt(argv[++i], seconds) || seconds < 0 || seconds > INT_MAX / 1000) {
+                std::cerr << "Invalid value of --timeout: " << argv[i] << ", expected a number of seconds\n";
+                return ERR_INVALID_PARAM_TYPE;
+            }
+            timeoutMs = seconds * 1000;
+        }
+        else if (arg.size() > 1 && arg[0] == '-') {
+            std::cerr << "Unknown option for 'wait-ready': " << arg << std::endl;
+            return ERR_INVALID_PARAM_TYPE;
+        }
+        else if (machineName.empty())
+            machineName = arg;
+        else {
+            std::cerr << "'wait-ready' requires one machine name\n";
+            return ERR_INVALID_PARAM_COUNT;
+        }
+    }
+    if (machineName.empty()) {
+        std::cerr << "'wait-ready' requires one argument: machine name\n";
+        return ERR_INVALID_PARAM_COUNT;
+    }
+
+    if (handler.waitForReady(ctx, machineName, timeoutMs))
+        return ERR_OK;
+    else
+        return ERR_RUNTIME_ERROR;
+}
+
+
+int HandleMetricsRequest(int argc, char** argv, Launch::HypervisorContext& ctx, Launch::RequestHandler& handler) {
+    //Generic format: ./cernvm-launch metrics --textfile PATH [--interval SECONDS]
+    std::string textfile;
+    int intervalS = 0; //write once
+
+    for (int i=2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--textfile" || arg == "--interval") {
+            if (i+1 == argc) {
+                std::cerr << "Missing value for: " << arg << std::endl;
+                return ERR_INVALID_PARAM_COUNT;
+            }
+            if (arg == "--textfile")
+                textfile = argv[++i];
+            else if (!Tools::ParseInt(argv[++i], intervalS) || intervalS < 1) {
+                std::cerr << "Invalid value of --interval: " << argv[i] << ", expected a number of seconds\n";
+                return ERR_INVALID_PARAM_TYPE;
+            }
+        }
+        else {
+            std::cerr << "Unknown option for 'metrics': " << arg << std::endl;
+            return ERR_INVALID_PARAM_TYPE;
+        }
+    }
+    if (textfile.empty()) {
+        std::cerr << "'metrics' requires --textfile PATH\n";
+        return ERR_INVALID_PARAM_COUNT;
+    }
+
+    if (Metrics::Export(ctx, textfile, intervalS))
+        return ERR_OK;
+    else
+        return ERR_RUNTIME_ERROR;
+}
+
+
+int HandleImportRequest(int argc, char** argv, Launch::HypervisorContext& ctx, Launch::RequestHandler& handler) {
     //These parameters flags require a value, e.g. --ram 512
     std::map<std::string, std::string> paramFlags = {
         {"--memory", ""},
@@ -353,9 +959,9 @@ int HandleImportRequest(int argc, char** argv, Launch::RequestHandler& handler)
         return ERR_INVALID_PARAM_COUNT;
     }
 
-    Tools::configMapType paramMap;
+    Launch::Config params;
     if (! paramFile.empty()) {
-        bool res = Tools::LoadFileIntoMap(paramFile, paramMap);
+        bool res = params.loadFile(paramFile, Launch::CONFIG_LAYER_FILE);
         if (!res) {
             std::cerr << "Error while processing file: " << paramFile << std::endl;
             return ERR_INVALID_PARAM_TYPE;
@@ -368,12 +974,11 @@ int HandleImportRequest(int argc, char** argv, Launch::RequestHandler& handler)
         if ((it->second).empty()) // no value set
             continue;
         std::string key = (it->first).substr(2); // remove the '--'
-        if (paramMap.find(key) != paramMap.end())
-            paramMap.erase(paramMap.find(key));
-        paramMap.insert(std::make_pair(key, it->second));
+        if (!params.set(key, it->second, Launch::CONFIG_LAYER_COMMAND_LINE))
+            return ERR_INVALID_PARAM_TYPE;
     }
 
-    bool success = handler.importMachine(imageFile, !noStartFlag, paramMap);
+    bool success = handler.importMachine(ctx, imageFile, !noStartFlag, params);
 
     if (success)
         return ERR_OK;
@@ -382,21 +987,75 @@ int HandleImportRequest(int argc, char** argv, Launch::RequestHandler& handler)
 }
 
 
+//Global options are given before the command, e.g. cernvm-launch --trace FILE list
+int ParseGlobalOptions(int& argc, char**& argv) {
+    while (argc > 1 && std::string(argv[1]) == "--trace") {
+        if (argc < 3) {
+            std::cerr << "Missing value for: --trace\n";
+            return ERR_INVALID_PARAM_COUNT;
+        }
+        Trace::Enable(argv[2]);
+
+        //drop the option and its value, keep the program name
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+    return ERR_OK;
+}
+
+
 void PrintHelp() {
-    std::cout << "Usage: cernvm-launch OPTION\n"
+    std::cout << "Usage: cernvm-launch [--trace FILE] OPTION\n"
+              << "GLOBAL OPTIONS:\n"
+              << "\t--trace FILE\t\tWrite timings of the command phases to FILE (Chrome trace-event format).\n"
               << "OPTIONS:\n"
+              << "\tapply [--dry-run] [--prune] [--parallel NUM] MANIFEST\n"
+              << "\t\tCreate, start, stop or destroy machines to match the manifest (--dry-run prints the plan only).\n"
+              << "\tbatch [--parallel NUM] [FILE|-]\n"
+              << "\t\tRun the commands of the file (or stdin), one per line, in one process.\n"
+              << "\t\tWith --parallel, the output of the commands running at once is interleaved.\n"
               << "\tcreate [--no-start] [--name MACHINE_NAME] [--cpus NUM] [--memory NUM_MB] [--disk NUM_MB]\n"
               << "\t       [--iso PATH] [--sharedFolder PATH] [USER_DATA_FILE] [CONFIGURATION_FILE]\n"
+              << "\t       [--count NUM --name-prefix PREFIX [--parallel NUM]] [--context-file PATH[:DEST]]...\n"
               << "\t\tCreate a machine with default or specified user data.\n"
-              << "\tdestroy [--force] MACHINE_NAME\tDestroy an existing machine.\n"
+              << "\t\tWith --context-file, add the file into the context ISO (as DEST, default is the file name).\n"
+              << "\t\tWith --count, create NUM machines named PREFIX-1, PREFIX-2, ... (at most --parallel at once).\n"
+              << "\tcreate --linked-from BASE [--no-start] [--name MACHINE_NAME] [--cpus NUM] [--memory NUM_MB]\n"
+              << "\t\tCreate a machine as a linked clone of the golden snapshot of BASE.\n"
+              << "\tcreate --from-pool POOL --name MACHINE_NAME [--no-start]\n"
+              << "\t\tTake a pre-warmed machine from the pool (see 'pool').\n"
+              << "\tdaemon [--stop]\t\tRun (or stop) a daemon keeping the hypervisor and sessions loaded.\n"
+              << "\tdestroy [--force] [--parallel NUM] (--all | MACHINE_NAME...)\n"
+              << "\t\tDestroy existing machines.\n"
+              << "\texec [--parallel NUM] [--user USER] (--all | MACHINE_NAME...) -- COMMAND...\n"
+              << "\t\tRun the command on running machines over shared SSH connections, print the output of each.\n"
+              << "\tgolden MACHINE_NAME\tTake a golden snapshot of a stopped machine, to be used by --linked-from.\n"
               << "\timport [--no-start] [--name MACHINE_NAME] [--memory NUM_MB] [--disk NUM_MB]\n"
               << "\t       [--cpus NUM] [--sharedFolder PATH] OVA_IMAGE_FILE [CONFIGURATION_FILE]\n"
               << "\t\tCreate a new machine from an OVA image.\n"
-              << "\tlist [--running] [MACHINE_NAME]\tList all existing machines or a detailed info about one.\n"
-              << "\tpause MACHINE_NAME\tPause a running machine.\n"
-              << "\tssh [user@]MACHINE_NAME\tSSH into an existing machine.\n"
-              << "\tstart MACHINE_NAME\tStart an existing machine.\n"
-              << "\tstop MACHINE_NAME\tStop a running machine.\n"
+              << "\tlist [--running] [--format text|json|ports] [MACHINE_NAME]\n"
+              << "\t\tList all existing machines or a detailed info about one.\n"
+              << "\t\tWith --format json, list all the details of the machines in one JSON array.\n"
+              << "\t\tWith --format ports, list the host ports allocated to the machines.\n"
+              << "\tmetrics --textfile PATH [--interval SECONDS]\n"
+              << "\t\tWrite metrics of the machines for the node_exporter textfile collector (every SECONDS).\n"
+              << "\tpause [--parallel NUM] (--all | MACHINE_NAME...)\tPause running machines.\n"
+              << "\tpool fill [--parallel NUM] PROFILE [NUM]\n"
+              << "\t\tKeep NUM machines of the profile created, booted and saved, for 'create --from-pool'.\n"
+              << "\tpool status\t\tList the pools and their ready machines.\n"
+              << "\tprefetch [--flavor FLAVOR] [--arch ARCH] VERSION...\n"
+              << "\t\tDownload CernVM images into the image cache ahead of 'create'. Use --list to list the cache.\n"
+              << "\trestore MACHINE_NAME TAG\tReset the machine to its snapshot (a running machine is resumed from it).\n"
+              << "\tsnapshot MACHINE_NAME TAG\tTake a snapshot (a live one of a running machine), replace an older one.\n"
+              << "\tsnapshots MACHINE_NAME\tList the snapshots of the machine.\n"
+              << "\tssh [--wait] [user@]MACHINE_NAME\tSSH into an existing machine (--wait: once it is ready).\n"
+              << "\tstart [--parallel NUM] (--all | MACHINE_NAME...)\tStart existing machines.\n"
+              << "\tstats [OPERATION]\tPrint p50/p95/p99 times of the machine operations and their regressions.\n"
+              << "\tstop [--parallel NUM] (--all | MACHINE_NAME...)\tStop running machines.\n"
+              << "\t\tMachine names can be glob patterns (e.g. 'ci-*'), machines are handled concurrently.\n"
+              << "\twait-ready [--timeout SECONDS] MACHINE_NAME\n"
+              << "\t\tWait until the SSH server of a started machine answers, print the boot-to-ready time.\n"
               << "\t-v, --version\t\tPrint version.\n"
               << "\t-h, --help\t\tPrint this help message.\n";
 }